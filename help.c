@@ -75,7 +75,16 @@ uint8_t get_terminal_height(void)
 
 char TAG_TYPE[][8]     = { "single", "paired" };
 char attr_values[][20] = { "NONE", "any symbol", "number",
-                           "nb",   "nc",  "na",  "/path/to/text/file" };
+                           "nb",   "nc",  "na",  "/path/to/text/file",
+                           "rt",   "prec=N",    "ts[=symbol]",
+                           "src=/path/to/file", "/path/to/csv/file",
+                           "delim=symbol", "tsv", "hdr", "histogram",
+                           "names=N", "values=N", "sym=symbol",
+                           "bins=N|auto", "p=N[,N...]", "height=N",
+                           "bar", "sort=N", "sort", "desc",
+                           "join=/path/to/file", "on=N[:M]",
+                           "name=expression", "expression",
+                           "/path/to/txtm/file", "name" };
 const uint8_t ATTR_ASSIGN_LEN = 90;
 
 struct tags_help
@@ -87,10 +96,12 @@ struct tags_help
 };
 
 uint8_t tag_types[]   = { 1, 1, 1, 1, 1, 0, 1, 1, 1, 0,
-                          1, 1, 1, 1, 0, 0, 0, 0, 0, 0 };
+                          1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+                          0, 1, 1, 1, 0, 1, 0, 1 };
 
-uint8_t attrs_count[] = { 0, 0, 2, 0, 2, 1, 2, 4, 2, 2,
-                          2, 2, 2, 2, 1, 1, 0, 0, 0, 0 };
+uint8_t attrs_count[] = { 0, 0, 2, 0, 4, 1, 4, 13, 5, 2,
+                          2, 2, 2, 2, 1, 1, 0, 0, 0, 0,
+                          10, 6, 5, 4, 1, 1, 1, 1 };
 
 struct tags_help tags_hlp;
 void init_hlp(void)
@@ -135,11 +146,12 @@ void init_assignment(void)
     is_memory_allocated(tags_hlp.assignment[6]);
     strcpy(tags_hlp.assignment[6], "a histogram based on the specified data");
 
-    tags_hlp.assignment[7]  = calloc(109, sizeof(char));
+    tags_hlp.assignment[7]  = calloc(189, sizeof(char));
     is_memory_allocated(tags_hlp.assignment[7]);
     strcpy(tags_hlp.assignment[7], 
         "a table with borders, calculations of expressions, and right " 
-        "alignment of\n  numbers (can be disabled)");
+        "alignment of\n  numbers (can be disabled). Expressions can refer "
+        "to other cells: B2*C2,\n  SUM(B2:B9), AVG, MIN, MAX");
 
     tags_hlp.assignment[8]  = calloc(51, sizeof(char));
     is_memory_allocated(tags_hlp.assignment[8]);
@@ -197,6 +209,50 @@ void init_assignment(void)
     tags_hlp.assignment[19] = calloc(31, sizeof(char));
     is_memory_allocated(tags_hlp.assignment[19]);
     strcpy(tags_hlp.assignment[19], "insert current date and time");
+
+    tags_hlp.assignment[20] = calloc(64, sizeof(char));
+    is_memory_allocated(tags_hlp.assignment[20]);
+    strcpy(tags_hlp.assignment[20],
+        "a table or a histogram from a CSV or TSV file (quoted fields)");
+
+    tags_hlp.assignment[21] = calloc(64, sizeof(char));
+    is_memory_allocated(tags_hlp.assignment[21]);
+    strcpy(tags_hlp.assignment[21],
+        "count, sum, mean, stddev, min, max and quantiles of numbers");
+
+    tags_hlp.assignment[22] = calloc(64, sizeof(char));
+    is_memory_allocated(tags_hlp.assignment[22]);
+    strcpy(tags_hlp.assignment[22],
+        "a chart of a series of any length fitted to the doc width");
+
+    tags_hlp.assignment[23] = calloc(72, sizeof(char));
+    is_memory_allocated(tags_hlp.assignment[23]);
+    strcpy(tags_hlp.assignment[23],
+        "the content for every CSV record, {{N}}, {{name}} and {{#}} "
+        "replaced");
+
+    tags_hlp.assignment[24] = calloc(64, sizeof(char));
+    is_memory_allocated(tags_hlp.assignment[24]);
+    strcpy(tags_hlp.assignment[24],
+        "set a document variable for the expressions of <if> and <set>");
+
+    tags_hlp.assignment[25] = calloc(136, sizeof(char));
+    is_memory_allocated(tags_hlp.assignment[25]);
+    strcpy(tags_hlp.assignment[25],
+        "the content if the expression is not 0, the part after <else> "
+        "otherwise.\n  Comparisons: gt, ge, lt, le, eq, ne, and, or, not: "
+        "gt(x, 10)");
+
+    tags_hlp.assignment[26] = calloc(60, sizeof(char));
+    is_memory_allocated(tags_hlp.assignment[26]);
+    strcpy(tags_hlp.assignment[26],
+        "format a .txtm file as a part of the document (16 levels)");
+
+    tags_hlp.assignment[27] = calloc(124, sizeof(char));
+    is_memory_allocated(tags_hlp.assignment[27]);
+    strcpy(tags_hlp.assignment[27],
+        "define the tag <name>, {{content}} and {{N}} in the content are "
+        "replaced\n  by the content and attribute N of the tag");
 }
 
 void init_attrs(void)
@@ -238,6 +294,15 @@ void init_attrs(void)
     tags_hlp.attributes[4][1][1]  = calloc(17, sizeof(char));
     is_memory_allocated(tags_hlp.attributes[4][1][1]);
     strcpy(tags_hlp.attributes[4][1][1], "bulleted list");
+    tags_hlp.attributes[4][2][0]  = &attr_values[24];
+    tags_hlp.attributes[4][2][1]  = calloc(50, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[4][2][1]);
+    strcpy(tags_hlp.attributes[4][2][1],
+        "sorted items, numbers by value (stable)");
+    tags_hlp.attributes[4][3][0]  = &attr_values[25];
+    tags_hlp.attributes[4][3][1]  = calloc(24, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[4][3][1]);
+    strcpy(tags_hlp.attributes[4][3][1], "in descending order");
 
     /* lines */
     tags_hlp.attributes[5][0][0]  = &attr_values[2];
@@ -253,10 +318,19 @@ void init_attrs(void)
     is_memory_allocated(tags_hlp.attributes[6][1][1]);
     strcpy(tags_hlp.attributes[6][1][1],
         "a histogram drawn using the specified symbol");
+    tags_hlp.attributes[6][2][0]  = &attr_values[19];
+    tags_hlp.attributes[6][2][1]  = calloc(66, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[6][2][1]);
+    strcpy(tags_hlp.attributes[6][2][1],
+        "count raw samples in N bins (Sturges' rule for \"auto\")");
+    tags_hlp.attributes[6][3][0]  = &attr_values[10];
+    tags_hlp.attributes[6][3][1]  = calloc(34, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[6][3][1]);
+    strcpy(tags_hlp.attributes[6][3][1], "read the data from the file");
 
     /* table */
     tags_hlp.attributes[7][0][0]  = &attr_values[0];
-    tags_hlp.attributes[7][0][1]  = calloc(90, sizeof(char));
+    tags_hlp.attributes[7][0][1]  = calloc(92, sizeof(char));
     is_memory_allocated(tags_hlp.attributes[7][0][1]);
     strcpy(tags_hlp.attributes[7][0][1], 
         "a table with borders, calculations of expressions, "
@@ -273,6 +347,48 @@ void init_attrs(void)
     tags_hlp.attributes[7][3][1]  = calloc(36, sizeof(char));
     is_memory_allocated(tags_hlp.attributes[7][3][1]);
     strcpy(tags_hlp.attributes[7][3][1], "  don`t align numbers to the right");
+    tags_hlp.attributes[7][4][0]  = &attr_values[7];
+    tags_hlp.attributes[7][4][1]  = calloc(46, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[7][4][1]);
+    strcpy(tags_hlp.attributes[7][4][1],
+        "  shortest exact form of calculated numbers");
+    tags_hlp.attributes[7][5][0]  = &attr_values[8];
+    tags_hlp.attributes[7][5][1]  = calloc(35, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[7][5][1]);
+    strcpy(tags_hlp.attributes[7][5][1], "N digits after the decimal point");
+    tags_hlp.attributes[7][6][0]  = &attr_values[9];
+    tags_hlp.attributes[7][6][1]  = calloc(39, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[7][6][1]);
+    strcpy(tags_hlp.attributes[7][6][1],
+        "thousands separator (\",\" by default)");
+    tags_hlp.attributes[7][7][0]  = &attr_values[10];
+    tags_hlp.attributes[7][7][1]  = calloc(72, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[7][7][1]);
+    strcpy(tags_hlp.attributes[7][7][1],
+        "rows from a large file, streamed to the result without calculations");
+    tags_hlp.attributes[7][8][0]  = &attr_values[23];
+    tags_hlp.attributes[7][8][1]  = calloc(66, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[7][8][1]);
+    strcpy(tags_hlp.attributes[7][8][1],
+        "rows sorted by the column N after calculations, numbers by value");
+    tags_hlp.attributes[7][9][0]  = &attr_values[25];
+    tags_hlp.attributes[7][9][1]  = calloc(24, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[7][9][1]);
+    strcpy(tags_hlp.attributes[7][9][1], "in descending order");
+    tags_hlp.attributes[7][10][0] = &attr_values[14];
+    tags_hlp.attributes[7][10][1] = calloc(36, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[7][10][1]);
+    strcpy(tags_hlp.attributes[7][10][1], "the first row is a header");
+    tags_hlp.attributes[7][11][0] = &attr_values[26];
+    tags_hlp.attributes[7][11][1] = calloc(72, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[7][11][1]);
+    strcpy(tags_hlp.attributes[7][11][1],
+        "add the columns of matching rows from a table, CSV or TSV file");
+    tags_hlp.attributes[7][12][0] = &attr_values[27];
+    tags_hlp.attributes[7][12][1] = calloc(60, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[7][12][1]);
+    strcpy(tags_hlp.attributes[7][12][1],
+        "key columns of the table and the file (1 by default)");
 
     /* calc */
     tags_hlp.attributes[8][0][0]  = &attr_values[0];
@@ -284,10 +400,25 @@ void init_attrs(void)
     is_memory_allocated(tags_hlp.attributes[8][1][1]);
     strcpy(tags_hlp.attributes[8][1][1],
         "expression and result (<expression> = <result>)");
+    tags_hlp.attributes[8][2][0]  = &attr_values[7];
+    tags_hlp.attributes[8][2][1]  = calloc(41, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[8][2][1]);
+    strcpy(tags_hlp.attributes[8][2][1],
+        "        shortest exact form of numbers");
+    tags_hlp.attributes[8][3][0]  = &attr_values[8];
+    tags_hlp.attributes[8][3][1]  = calloc(39, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[8][3][1]);
+    strcpy(tags_hlp.attributes[8][3][1],
+        "    N digits after the decimal point");
+    tags_hlp.attributes[8][4][0]  = &attr_values[9];
+    tags_hlp.attributes[8][4][1]  = calloc(39, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[8][4][1]);
+    strcpy(tags_hlp.attributes[8][4][1],
+        "thousands separator (\",\" by default)");
     
     /* sep */
     tags_hlp.attributes[9][0][0]  = &attr_values[0];
-    tags_hlp.attributes[9][0][1]  = calloc(44, sizeof(char));
+    tags_hlp.attributes[9][0][1]  = calloc(46, sizeof(char));
     is_memory_allocated(tags_hlp.attributes[9][0][1]);
     strcpy(tags_hlp.attributes[9][0][1],
         "      a separator drawn using the symbol \"-\"");
@@ -299,7 +430,7 @@ void init_attrs(void)
 
     /* h1 */
     tags_hlp.attributes[10][0][0] = &attr_values[0];
-    tags_hlp.attributes[10][0][1] = calloc(46, sizeof(char));
+    tags_hlp.attributes[10][0][1] = calloc(48, sizeof(char));
     is_memory_allocated(tags_hlp.attributes[10][0][1]);
     strcpy(tags_hlp.attributes[10][0][1],
         "      the h1 header drawn using the symbol \"=\"");
@@ -311,7 +442,7 @@ void init_attrs(void)
 
     /* h2 */
     tags_hlp.attributes[11][0][0] = &attr_values[0];
-    tags_hlp.attributes[11][0][1] = calloc(46, sizeof(char));
+    tags_hlp.attributes[11][0][1] = calloc(48, sizeof(char));
     is_memory_allocated(tags_hlp.attributes[11][0][1]);
     strcpy(tags_hlp.attributes[11][0][1],
         "      the h2 header drawn using the symbol \"=\"");
@@ -323,7 +454,7 @@ void init_attrs(void)
     
     /* h3 */
     tags_hlp.attributes[12][0][0] = &attr_values[0];
-    tags_hlp.attributes[12][0][1] = calloc(46, sizeof(char));
+    tags_hlp.attributes[12][0][1] = calloc(48, sizeof(char));
     is_memory_allocated(tags_hlp.attributes[12][0][1]);
     strcpy(tags_hlp.attributes[12][0][1],
         "      the h3 header drawn using the symbol \"-\"");
@@ -335,7 +466,7 @@ void init_attrs(void)
 
     /* h4 */
     tags_hlp.attributes[13][0][0] = &attr_values[0];
-    tags_hlp.attributes[13][0][1] = calloc(46, sizeof(char));
+    tags_hlp.attributes[13][0][1] = calloc(48, sizeof(char));
     is_memory_allocated(tags_hlp.attributes[13][0][1]);
     strcpy(tags_hlp.attributes[13][0][1],
         "      the h4 header drawn using the symbol \"-\"");
@@ -350,6 +481,135 @@ void init_attrs(void)
 
     /* doc_width */
     tags_hlp.attributes[15][0][0] = &attr_values[2];
+
+    /* csv */
+    tags_hlp.attributes[20][0][0] = &attr_values[11];
+    tags_hlp.attributes[20][0][1] = calloc(30, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][0][1]);
+    strcpy(tags_hlp.attributes[20][0][1], "the file, always the first");
+    tags_hlp.attributes[20][1][0] = &attr_values[12];
+    tags_hlp.attributes[20][1][1] = calloc(38, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][1][1]);
+    strcpy(tags_hlp.attributes[20][1][1], "field delimiter (\",\" by default)");
+    tags_hlp.attributes[20][2][0] = &attr_values[13];
+    tags_hlp.attributes[20][2][1] = calloc(50, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][2][1]);
+    strcpy(tags_hlp.attributes[20][2][1],
+        "fields are separated by tabs (default for .tsv)");
+    tags_hlp.attributes[20][3][0] = &attr_values[14];
+    tags_hlp.attributes[20][3][1] = calloc(42, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][3][1]);
+    strcpy(tags_hlp.attributes[20][3][1],
+        "the first row is a header (histogram)");
+    tags_hlp.attributes[20][4][0] = &attr_values[15];
+    tags_hlp.attributes[20][4][1] = calloc(34, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][4][1]);
+    strcpy(tags_hlp.attributes[20][4][1], "a histogram instead of a table");
+    tags_hlp.attributes[20][5][0] = &attr_values[16];
+    tags_hlp.attributes[20][5][1] = calloc(40, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][5][1]);
+    strcpy(tags_hlp.attributes[20][5][1],
+        "column with bar names (1 by default)");
+    tags_hlp.attributes[20][6][0] = &attr_values[17];
+    tags_hlp.attributes[20][6][1] = calloc(40, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][6][1]);
+    strcpy(tags_hlp.attributes[20][6][1], "column with values (2 by default)");
+    tags_hlp.attributes[20][7][0] = &attr_values[18];
+    tags_hlp.attributes[20][7][1] = calloc(36, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][7][1]);
+    strcpy(tags_hlp.attributes[20][7][1],
+        "histogram symbol (\"#\" by default)");
+    tags_hlp.attributes[20][8][0] = &attr_values[3];
+    tags_hlp.attributes[20][8][1] = calloc(12, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][8][1]);
+    strcpy(tags_hlp.attributes[20][8][1], "  no border");
+    tags_hlp.attributes[20][9][0] = &attr_values[5];
+    tags_hlp.attributes[20][9][1] = calloc(36, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[20][9][1]);
+    strcpy(tags_hlp.attributes[20][9][1], "  don`t align numbers to the right");
+
+    /* stats */
+    tags_hlp.attributes[21][0][0] = &attr_values[20];
+    tags_hlp.attributes[21][0][1] = calloc(52, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[21][0][1]);
+    strcpy(tags_hlp.attributes[21][0][1],
+        "quantiles in percent (\"50,95,99\" by default)");
+    tags_hlp.attributes[21][1][0] = &attr_values[10];
+    tags_hlp.attributes[21][1][1] = calloc(34, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[21][1][1]);
+    strcpy(tags_hlp.attributes[21][1][1], "read the data from the file");
+    tags_hlp.attributes[21][2][0] = &attr_values[3];
+    tags_hlp.attributes[21][2][1] = calloc(12, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[21][2][1]);
+    strcpy(tags_hlp.attributes[21][2][1], "  no border");
+    tags_hlp.attributes[21][3][0] = &attr_values[7];
+    tags_hlp.attributes[21][3][1] = calloc(36, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[21][3][1]);
+    strcpy(tags_hlp.attributes[21][3][1], "  shortest exact form of numbers");
+    tags_hlp.attributes[21][4][0] = &attr_values[8];
+    tags_hlp.attributes[21][4][1] = calloc(40, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[21][4][1]);
+    strcpy(tags_hlp.attributes[21][4][1], "N digits after the decimal point");
+    tags_hlp.attributes[21][5][0] = &attr_values[9];
+    tags_hlp.attributes[21][5][1] = calloc(40, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[21][5][1]);
+    strcpy(tags_hlp.attributes[21][5][1],
+        "thousands separator (\",\" by default)");
+
+    /* chart */
+    tags_hlp.attributes[22][0][0] = &attr_values[0];
+    tags_hlp.attributes[22][0][1] = calloc(56, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[22][0][1]);
+    strcpy(tags_hlp.attributes[22][0][1],
+        "a line chart of min/max per column drawn using \"*\"");
+    tags_hlp.attributes[22][1][0] = &attr_values[22];
+    tags_hlp.attributes[22][1][1] = calloc(52, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[22][1][1]);
+    strcpy(tags_hlp.attributes[22][1][1],
+        "bars with means of the columns drawn using \"#\"");
+    tags_hlp.attributes[22][2][0] = &attr_values[21];
+    tags_hlp.attributes[22][2][1] = calloc(40, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[22][2][1]);
+    strcpy(tags_hlp.attributes[22][2][1], "N lines high (10 by default)");
+    tags_hlp.attributes[22][3][0] = &attr_values[18];
+    tags_hlp.attributes[22][3][1] = calloc(36, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[22][3][1]);
+    strcpy(tags_hlp.attributes[22][3][1], "draw using the specified symbol");
+    tags_hlp.attributes[22][4][0] = &attr_values[10];
+    tags_hlp.attributes[22][4][1] = calloc(34, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[22][4][1]);
+    strcpy(tags_hlp.attributes[22][4][1], "read the data from the file");
+
+    /* foreach */
+    tags_hlp.attributes[23][0][0] = &attr_values[11];
+    tags_hlp.attributes[23][0][1] = calloc(30, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[23][0][1]);
+    strcpy(tags_hlp.attributes[23][0][1], "the file, always the first");
+    tags_hlp.attributes[23][1][0] = &attr_values[14];
+    tags_hlp.attributes[23][1][1] = calloc(52, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[23][1][1]);
+    strcpy(tags_hlp.attributes[23][1][1],
+        "the first record holds the names for {{name}}");
+    tags_hlp.attributes[23][2][0] = &attr_values[12];
+    tags_hlp.attributes[23][2][1] = calloc(38, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[23][2][1]);
+    strcpy(tags_hlp.attributes[23][2][1], "field delimiter (\",\" by default)");
+    tags_hlp.attributes[23][3][0] = &attr_values[13];
+    tags_hlp.attributes[23][3][1] = calloc(24, sizeof(char));
+    is_memory_allocated(tags_hlp.attributes[23][3][1]);
+    strcpy(tags_hlp.attributes[23][3][1], "tab separated values");
+
+    /* set */
+    tags_hlp.attributes[24][0][0] = &attr_values[28];
+
+    /* if */
+    tags_hlp.attributes[25][0][0] = &attr_values[29];
+
+    /* include */
+    tags_hlp.attributes[26][0][0] = &attr_values[30];
+
+    /* define */
+    tags_hlp.attributes[27][0][0] = &attr_values[31];
 }
 
 
@@ -376,6 +636,33 @@ void free_hlp(void)
      free(tags_hlp.attributes);
 }
 
+void print_usage(FILE* file)
+{
+    fputs("usage:\n"
+          "  txtfmt                     format every .txtm file of the "
+          "current\n"
+          "                             directory into a .txt file\n"
+          "  txtfmt --merge template.txtm data.csv [output_dir]\n"
+          "                             one document per record of "
+          "data.csv\n"
+          "  txtfmt --watch             the same, and again whenever a "
+          "document\n"
+          "                             or a file it reads changes\n"
+          "  txtfmt --serve /path/to/socket\n"
+          "                             format the documents sent to a unix "
+          "socket\n"
+          "  txtfmt --help              this help and the help on the tags\n"
+          "options, before the others:\n"
+          "  --profile                  the time, bytes and allocations of "
+          "every tag\n"
+          "  --trace out.json           a trace of the tags for "
+          "chrome://tracing\n"
+          "                             or Perfetto\n"
+          "  --folded out.folded        folded stacks for flamegraph.pl or "
+          "speedscope\n",
+          file);
+}
+
 void help (void)
 {
     init_hlp();
@@ -390,6 +677,8 @@ void help (void)
         for ( i=0; i<get_terminal_width(); i++ ) 
             putchar('-');
 
+        puts("");
+        print_usage(stdout);
         puts("\nSelect the tag for which you want to get help:");
         int selected = -100;
 
@@ -20,6 +20,7 @@ void  init_assignment    (void);
 void  init_attrs         (void);
 void  free_hlp           (void);
 
+void print_usage         (FILE* file);
 void help                (void);
 
 #endif /* HELP_H */
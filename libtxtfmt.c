@@ -0,0 +1,62 @@
+/* libtxtfmt.c
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ */
+#include "tags_lib.h"
+#include "libtxtfmt.h"
+
+void txtfmt_init_options(struct txtfmt_options* opts)
+{
+    memset(opts, 0, sizeof(struct txtfmt_options));
+}
+
+int txtfmt_render(const char* input, size_t len,
+                  const struct txtfmt_options* opts, char** output,
+                  size_t* output_len)
+{
+    /* the engine works on NUL-terminated strings, so the input is copied
+       once; the options only live for this call */
+    if ( (input == NULL && len > 0) || output == NULL || output_len == NULL )
+        return TXTFMT_BAD_ARGUMENT;
+
+    struct txtfmt_options defaults;
+    if ( opts == NULL ) {
+        txtfmt_init_options(&defaults);
+        opts = &defaults;
+    }
+
+    char* text = calloc(len + 1, sizeof(char));
+    is_memory_allocated(text);
+    if ( len > 0 )
+        memcpy(text, input, len);
+
+    set_doc_paths(opts->include_paths, opts->include_paths_count);
+    set_doc_time(opts->timestamp);
+    error_file = opts->errors;
+    uint64_t out_len = 0;
+    *output = render_text(text, (opts->width == 0) ? DEFAULT_DOC_WIDTH :
+                                opts->width, &out_len);
+    *output_len = out_len;
+    set_doc_paths(NULL, 0);
+    set_doc_time(0);
+    error_file = NULL;
+    free(text);
+    return TXTFMT_OK;
+}
+
+void txtfmt_free(char* output)
+{
+    free(output);
+}
+
+void txtfmt_cleanup(void)
+{
+    clear_macros();
+    free_insert_cache();
+    free_workers();
+}
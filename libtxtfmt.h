@@ -0,0 +1,54 @@
+/* libtxtfmt.h
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ *
+ * txtFormatter as a library: make lib builds libtxtfmt.a and libtxtfmt.so.
+ * Documents are rendered in memory, any number of threads may render at
+ * the same time.
+ */
+#ifndef LIBTXTFMT_H
+#define LIBTXTFMT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TXTFMT_API __attribute__((visibility("default")))
+
+#define        TXTFMT_OK             0
+#define        TXTFMT_BAD_ARGUMENT   1
+
+struct txtfmt_options
+{
+    uint8_t        width;               /* 0 - 80 characters */
+    int64_t        timestamp;           /* <date> and <time>, 0 - now */
+    const char* const* include_paths;   /* for relative file names */
+    uint16_t       include_paths_count;
+    FILE*          errors;              /* NULL - stdout */
+};
+
+/* Renders len bytes of .txtm text; the input stops at the first '\0'.
+   *output is owned by the caller and freed with txtfmt_free(). Errors in
+   the document are written to opts->errors. */
+TXTFMT_API int  txtfmt_render         (const char* input, size_t len,
+                                       const struct txtfmt_options* opts,
+                                       char** output, size_t* output_len);
+TXTFMT_API void txtfmt_free           (char* output);
+TXTFMT_API void txtfmt_init_options   (struct txtfmt_options* opts);
+/* the cache of inserted files and the worker threads */
+TXTFMT_API void txtfmt_cleanup        (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBTXTFMT_H */
@@ -0,0 +1,167 @@
+/* parallel.c
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ */
+#include "parallel.h"
+#include "tags_lib.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+/* One job at a time is split into chunks of items; the workers and the
+   calling thread take chunks until the job is finished. */
+struct work_pool
+{
+    pthread_mutex_t  lock;
+    pthread_cond_t   job_ready;
+    pthread_cond_t   job_done;
+    pthread_mutex_t  job_lock;    /* one job at a time */
+    pthread_t        threads[MAX_WORKERS];
+    uint16_t         threads_count;
+    uint8_t          started;
+    uint8_t          stop;
+
+    void           (*func)(void*, uint32_t, uint32_t);
+    void*            ctx;
+    uint32_t         count;
+    uint32_t         chunk;
+    uint32_t         next;        /* first item of the next free chunk */
+    uint32_t         busy;        /* chunks taken but not finished */
+    uint64_t         generation;
+};
+
+struct work_pool pool = { .lock      = PTHREAD_MUTEX_INITIALIZER,
+                          .job_ready = PTHREAD_COND_INITIALIZER,
+                          .job_done  = PTHREAD_COND_INITIALIZER,
+                          .job_lock  = PTHREAD_MUTEX_INITIALIZER };
+__thread uint8_t in_worker = 0;
+
+uint16_t get_workers_count(void)
+{
+    char* env = getenv("TXTFMT_THREADS");
+    long n = (env != NULL) ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if ( n < 1 )
+        n = 1;
+
+    return (n > MAX_WORKERS) ? MAX_WORKERS : n;
+}
+
+/* takes chunks of the current job while there are any; pool.lock is held */
+void work_on_job(void)
+{
+    while ( pool.next < pool.count ) {
+        uint32_t start = pool.next;
+        uint32_t end = (pool.count - start > pool.chunk) ? start + pool.chunk
+                                                         : pool.count;
+        pool.next = end;
+        pool.busy++;
+        pthread_mutex_unlock(&pool.lock);
+        pool.func(pool.ctx, start, end);
+        pthread_mutex_lock(&pool.lock);
+        pool.busy--;
+    }
+
+    if ( pool.busy == 0 )
+        pthread_cond_broadcast(&pool.job_done);
+}
+
+void* worker(void* arg)
+{
+    (void)arg;
+    in_worker = 1;
+    uint64_t generation = 0;
+    pthread_mutex_lock(&pool.lock);
+    while ( 1 ) {
+        while ( !pool.stop && (pool.generation == generation
+                || pool.next >= pool.count) )
+            pthread_cond_wait(&pool.job_ready, &pool.lock);
+
+        if ( pool.stop )
+            break;
+
+        generation = pool.generation;
+        work_on_job();
+    }
+
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+void start_workers(void)
+{
+    /* the calling thread is one of the workers */
+    pool.threads_count = get_workers_count() - 1;
+    for ( uint16_t i=0; i<pool.threads_count; i++ ) {
+        if ( pthread_create(&pool.threads[i], NULL, worker, NULL) != 0 ) {
+            pool.threads_count = i;
+            break;
+        }
+    }
+
+    pool.started = 1;
+}
+
+void run_parallel(void (*func)(void*, uint32_t, uint32_t), void* ctx,
+                  uint32_t count, uint32_t min_items)
+{
+    /* small batches and nested calls from workers keep the serial path */
+    if ( count < min_items || in_worker ) {
+        func(ctx, 0, count);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.job_lock);
+    pthread_mutex_lock(&pool.lock);
+    if ( pool.started == 0 )
+        start_workers();
+
+    if ( pool.threads_count == 0 ) {
+        pthread_mutex_unlock(&pool.lock);
+        pthread_mutex_unlock(&pool.job_lock);
+        func(ctx, 0, count);
+        return;
+    }
+
+    /* a few chunks per thread even out the uneven expressions */
+    uint32_t chunk = count / ((pool.threads_count + 1) * 4);
+    pool.chunk = (chunk < min_items / 4 + 1) ? min_items / 4 + 1 : chunk;
+    pool.func = func;
+    pool.ctx = ctx;
+    pool.count = count;
+    pool.next = 0;
+    pool.busy = 0;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.job_ready);
+
+    in_worker = 1;
+    work_on_job();
+    while ( pool.next < pool.count || pool.busy > 0 )
+        pthread_cond_wait(&pool.job_done, &pool.lock);
+
+    in_worker = 0;
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.job_lock);
+}
+
+void free_workers(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    if ( pool.started == 0 ) {
+        pthread_mutex_unlock(&pool.lock);
+        return;
+    }
+
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.job_ready);
+    pthread_mutex_unlock(&pool.lock);
+    for ( uint16_t i=0; i<pool.threads_count; i++ )
+        pthread_join(pool.threads[i], NULL);
+
+    pool.started = 0;
+    pool.stop = 0;
+}
@@ -0,0 +1,25 @@
+/* parallel.h
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+
+/* batches smaller than this are processed in the calling thread */
+#define        PARALLEL_MIN_ITEMS    2048
+#define        MAX_WORKERS           64
+
+uint16_t       get_workers_count     (void);
+void           run_parallel          (void (*func)(void*, uint32_t, uint32_t),
+                                      void* ctx, uint32_t count,
+                                      uint32_t min_items);
+void           free_workers          (void);
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,416 @@
+/* profile.c
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ */
+#include "tags_lib.h"
+
+/* set once before the documents are rendered; every hook is a single
+   branch on it when nothing is collected */
+uint8_t           profiling = 0;
+__thread uint64_t profile_allocs = 0;
+
+/* the tags of the current document, per thread */
+__thread struct tag_profile   thread_profiles[MAX_PROFILED_TAGS];
+__thread uint16_t             thread_profiles_count = 0;
+__thread struct profile_frame profile_stack[MAX_PROFILE_DEPTH];
+__thread uint16_t             profile_depth = 0;
+
+/* all the documents */
+struct tag_profile total_profiles[MAX_PROFILED_TAGS];
+uint16_t           total_profiles_count = 0;
+pthread_mutex_t    total_profiles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* --trace: events of a thread are written in blocks */
+FILE*              trace_file = NULL;
+uint64_t           trace_start = 0;
+uint32_t           trace_threads = 0;
+pthread_mutex_t    trace_lock = PTHREAD_MUTEX_INITIALIZER;
+__thread struct str_buf trace_events = { NULL, 0, 0 };
+__thread uint32_t       trace_tid = 0;
+
+/* --folded: written when all the documents are done */
+FILE*                        folded_file = NULL;
+struct folded_stack*         total_stacks[FOLDED_BUCKETS];
+pthread_mutex_t              folded_lock = PTHREAD_MUTEX_INITIALIZER;
+__thread struct folded_stack* thread_stacks[FOLDED_BUCKETS];
+
+/****************************************************************************
+*                         functions for the frames                          *
+****************************************************************************/
+
+uint64_t get_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profile_enter(const char* name, uint8_t kind)
+{
+    /* frames deeper than the stack are not counted */
+    if ( profile_depth < MAX_PROFILE_DEPTH ) {
+        struct profile_frame* frame = &profile_stack[profile_depth];
+        frame->name = name;
+        frame->kind = kind;
+        frame->children_ns = 0;
+        frame->children_allocs = 0;
+        frame->allocs = profile_allocs;
+        frame->start = get_clock_ns();
+    }
+
+    profile_depth++;
+}
+
+void profile_leave(char** attrs, uint64_t bytes_in, uint64_t bytes_out)
+{
+    uint64_t end = get_clock_ns();
+    if ( --profile_depth >= MAX_PROFILE_DEPTH )
+        return;
+
+    struct profile_frame* frame = &profile_stack[profile_depth];
+    uint64_t elapsed = end - frame->start;
+    uint64_t allocs = profile_allocs - frame->allocs;
+    if ( profile_depth > 0 ) {
+        profile_stack[profile_depth - 1].children_ns += elapsed;
+        profile_stack[profile_depth - 1].children_allocs += allocs;
+    }
+
+    if ( (profiling & PROFILE_TRACE) && frame->kind != FRAME_STEP )
+        add_trace_event(frame, end, attrs, bytes_in, bytes_out);
+
+    if ( profiling & PROFILE_FOLDED )
+        add_thread_stack(elapsed - frame->children_ns);
+
+    if ( (profiling & PROFILE_REPORT) == 0 || frame->kind == FRAME_FILE )
+        return;
+
+    struct tag_profile* tp = find_tag_profile(thread_profiles,
+                                              &thread_profiles_count,
+                                              frame->name);
+    if ( tp == NULL )
+        return;
+
+    tp->calls++;
+    tp->total_ns += elapsed;
+    tp->self_ns += elapsed - frame->children_ns;
+    tp->bytes_in += bytes_in;
+    tp->bytes_out += bytes_out;
+    tp->allocs += allocs - frame->children_allocs;
+}
+
+/****************************************************************************
+*                         functions for --profile                           *
+****************************************************************************/
+
+struct tag_profile* find_tag_profile(struct tag_profile* profiles,
+                                     uint16_t* count, const char* name)
+{
+    /* a new entry if the name is not there; NULL if there is no room */
+    for ( uint16_t i=0; i<*count; i++ ) {
+        if ( strcmp(profiles[i].name, name) == 0 )
+            return &profiles[i];
+    }
+
+    if ( *count == MAX_PROFILED_TAGS )
+        return NULL;
+
+    struct tag_profile* tp = &profiles[(*count)++];
+    memset(tp, 0, sizeof(struct tag_profile));
+    snprintf(tp->name, sizeof(tp->name), "%s", name);
+    return tp;
+}
+
+void add_tag_profiles(struct tag_profile* to, uint16_t* to_count,
+                      const struct tag_profile* from, uint16_t from_count)
+{
+    for ( uint16_t i=0; i<from_count; i++ ) {
+        struct tag_profile* tp = find_tag_profile(to, to_count,
+                                                  from[i].name);
+        if ( tp == NULL )
+            continue;
+
+        tp->calls += from[i].calls;
+        tp->total_ns += from[i].total_ns;
+        tp->self_ns += from[i].self_ns;
+        tp->bytes_in += from[i].bytes_in;
+        tp->bytes_out += from[i].bytes_out;
+        tp->allocs += from[i].allocs;
+    }
+}
+
+int compare_tag_profiles(const void* a, const void* b)
+{
+    /* the most self time first */
+    const struct tag_profile* x = a;
+    const struct tag_profile* y = b;
+    return (x->self_ns < y->self_ns) - (x->self_ns > y->self_ns);
+}
+
+void print_tag_profiles(const char* title, struct tag_profile* profiles,
+                        uint16_t count)
+{
+    qsort(profiles, count, sizeof(struct tag_profile), compare_tag_profiles);
+    printf("  profile of %s:\n"
+           "  %-14s %9s %11s %11s %12s %12s %9s\n", title, "tag", "calls",
+           "total ms", "self ms", "bytes in", "bytes out", "allocs");
+    for ( uint16_t i=0; i<count; i++ ) {
+        const struct tag_profile* tp = &profiles[i];
+        printf("  %-14s %9lu %11.3f %11.3f %12lu %12lu %9lu\n", tp->name,
+               (unsigned long)tp->calls, tp->total_ns / 1e6,
+               tp->self_ns / 1e6, (unsigned long)tp->bytes_in,
+               (unsigned long)tp->bytes_out, (unsigned long)tp->allocs);
+    }
+}
+
+struct tag_profile* get_thread_profiles(uint16_t* count)
+{
+    /* the tags of the current document, see print_file_profile() */
+    *count = thread_profiles_count;
+    return thread_profiles;
+}
+
+void add_thread_profile(void)
+{
+    /* everything this thread has collected goes to the totals */
+    if ( profiling & PROFILE_TRACE )
+        flush_trace();
+
+    if ( profiling & PROFILE_FOLDED )
+        flush_folded();
+
+    if ( (profiling & PROFILE_REPORT) == 0 )
+        return;
+
+    pthread_mutex_lock(&total_profiles_lock);
+    add_tag_profiles(total_profiles, &total_profiles_count, thread_profiles,
+                     thread_profiles_count);
+    pthread_mutex_unlock(&total_profiles_lock);
+    thread_profiles_count = 0;
+}
+
+void print_file_profile(const char* filename)
+{
+    if ( profiling & PROFILE_REPORT )
+        print_tag_profiles(filename, thread_profiles, thread_profiles_count);
+
+    add_thread_profile();
+}
+
+void print_total_profile(void)
+{
+    if ( (profiling & PROFILE_REPORT) == 0 )
+        return;
+
+    pthread_mutex_lock(&total_profiles_lock);
+    print_tag_profiles("all documents", total_profiles,
+                       total_profiles_count);
+    pthread_mutex_unlock(&total_profiles_lock);
+}
+
+/****************************************************************************
+*                          functions for --trace                            *
+****************************************************************************/
+
+uint8_t start_trace(const char* path)
+{
+    /* trace event JSON for chrome://tracing and Perfetto, one track for
+       every thread that renders documents */
+    trace_file = fopen(path, "w");
+    if ( trace_file == NULL ) {
+        print_file_error((char*)path);
+        return 0;
+    }
+
+    trace_start = get_clock_ns();
+    fputs("[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+          "\"args\":{\"name\":\"txtfmt\"}}", trace_file);
+    profiling |= PROFILE_TRACE;
+    return 1;
+}
+
+void append_json_string(struct str_buf* sb, const char* str)
+{
+    char esc[8];
+    str_buf_append(sb, "\"");
+    for ( const char* pos = str; *pos != '\0'; pos++ ) {
+        if ( *pos == '"' || *pos == '\\' ) {
+            esc[0] = '\\';
+            esc[1] = *pos;
+            str_buf_append_n(sb, esc, 2);
+        } else if ( (uint8_t)*pos < 0x20 ) {
+            snprintf(esc, sizeof(esc), "\\u%04x", (uint8_t)*pos);
+            str_buf_append(sb, esc);
+        } else
+            str_buf_append_n(sb, pos, 1);
+    }
+
+    str_buf_append(sb, "\"");
+}
+
+void add_trace_event(const struct profile_frame* frame, uint64_t end,
+                     char** attrs, uint64_t bytes_in, uint64_t bytes_out)
+{
+    char num[128];
+    if ( trace_events.data == NULL )
+        str_buf_init(&trace_events, 4096);
+
+    if ( trace_tid == 0 ) {
+        pthread_mutex_lock(&trace_lock);
+        trace_tid = ++trace_threads;
+        pthread_mutex_unlock(&trace_lock);
+        snprintf(num, sizeof(num), ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                 "\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                 trace_tid, trace_tid);
+        str_buf_append(&trace_events, num);
+    }
+
+    str_buf_append(&trace_events, ",\n{\"name\":");
+    append_json_string(&trace_events, frame->name);
+    snprintf(num, sizeof(num), ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+             "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+             (frame->kind == FRAME_FILE) ? "file" : "tag", trace_tid,
+             (frame->start - trace_start) / 1e3,
+             (end - frame->start) / 1e3);
+    str_buf_append(&trace_events, num);
+    if ( attrs != NULL ) {
+        char* joined = join_attrs(attrs, 0);
+        str_buf_append(&trace_events, "\"attrs\":");
+        append_json_string(&trace_events, joined);
+        str_buf_append(&trace_events, ",");
+        free(joined);
+    }
+
+    snprintf(num, sizeof(num), "\"bytes_in\":%lu,\"bytes_out\":%lu}}",
+             (unsigned long)bytes_in, (unsigned long)bytes_out);
+    str_buf_append(&trace_events, num);
+    if ( trace_events.len > TRACE_FLUSH_SIZE )
+        flush_trace();
+}
+
+void flush_trace(void)
+{
+    if ( trace_events.len == 0 )
+        return;
+
+    pthread_mutex_lock(&trace_lock);
+    fwrite(trace_events.data, 1, trace_events.len, trace_file);
+    fflush(trace_file);
+    pthread_mutex_unlock(&trace_lock);
+    /* worker threads outlive the documents, their buffers don't */
+    free(trace_events.data);
+    trace_events.data = NULL;
+    trace_events.len = 0;
+}
+
+void finish_trace(void)
+{
+    if ( trace_file == NULL )
+        return;
+
+    flush_trace();
+    fputs("\n]\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+/****************************************************************************
+*                          functions for --folded                           *
+****************************************************************************/
+
+uint8_t start_folded(const char* path)
+{
+    /* "file;tag;tag self_ns" lines for flamegraph.pl and speedscope */
+    folded_file = fopen(path, "w");
+    if ( folded_file == NULL ) {
+        print_file_error((char*)path);
+        return 0;
+    }
+
+    profiling |= PROFILE_FOLDED;
+    return 1;
+}
+
+void add_folded_stack(struct folded_stack** buckets, const char* stack,
+                      uint64_t ns)
+{
+    uint32_t len = strlen(stack);
+    struct folded_stack** link = &buckets[hash_key(stack, len) %
+                                          FOLDED_BUCKETS];
+    for ( ; *link != NULL; link = &(*link)->next ) {
+        if ( strcmp((*link)->stack, stack) == 0 ) {
+            (*link)->ns += ns;
+            return;
+        }
+    }
+
+    struct folded_stack* fs = calloc(1, sizeof(struct folded_stack));
+    is_memory_allocated(fs);
+    fs->stack = strdup(stack);
+    is_memory_allocated(fs->stack);
+    fs->ns = ns;
+    *link = fs;
+}
+
+void add_thread_stack(uint64_t ns)
+{
+    /* the frame that has just left is profile_stack[profile_depth] */
+    struct str_buf stack;
+    str_buf_init(&stack, 256);
+    for ( uint16_t i=0; i<=profile_depth; i++ ) {
+        if ( i > 0 )
+            str_buf_append(&stack, ";");
+
+        /* ';' separates the frames and the last ' ' the count */
+        uint64_t start = stack.len;
+        str_buf_append(&stack, profile_stack[i].name);
+        for ( uint64_t j=start; j<stack.len; j++ ) {
+            if ( stack.data[j] == ';' || stack.data[j] == ' ' )
+                stack.data[j] = '_';
+        }
+    }
+
+    add_folded_stack(thread_stacks, stack.data, ns);
+    free(stack.data);
+}
+
+void flush_folded(void)
+{
+    pthread_mutex_lock(&folded_lock);
+    for ( uint16_t i=0; i<FOLDED_BUCKETS; i++ ) {
+        while ( thread_stacks[i] != NULL ) {
+            struct folded_stack* fs = thread_stacks[i];
+            thread_stacks[i] = fs->next;
+            add_folded_stack(total_stacks, fs->stack, fs->ns);
+            free(fs->stack);
+            free(fs);
+        }
+    }
+
+    pthread_mutex_unlock(&folded_lock);
+}
+
+void finish_folded(void)
+{
+    if ( folded_file == NULL )
+        return;
+
+    flush_folded();
+    for ( uint16_t i=0; i<FOLDED_BUCKETS; i++ ) {
+        while ( total_stacks[i] != NULL ) {
+            struct folded_stack* fs = total_stacks[i];
+            total_stacks[i] = fs->next;
+            fprintf(folded_file, "%s %lu\n", fs->stack,
+                    (unsigned long)fs->ns);
+            free(fs->stack);
+            free(fs);
+        }
+    }
+
+    fclose(folded_file);
+    folded_file = NULL;
+}
@@ -0,0 +1,98 @@
+/* profile.h
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* what is collected, see profiling */
+#define        PROFILE_REPORT        1     /* --profile */
+#define        PROFILE_TRACE         2     /* --trace out.json */
+#define        PROFILE_FOLDED        4     /* --folded out.folded */
+
+/* kinds of frames */
+#define        FRAME_TAG             0
+#define        FRAME_STEP            1     /* (parse) and (splice) */
+#define        FRAME_FILE            2
+
+#define        MAX_PROFILED_TAGS     128
+#define        MAX_PROFILE_DEPTH     256
+#define        PROFILE_PARSE         "(parse)"   /* finding tags and text */
+#define        PROFILE_SPLICE        "(splice)"  /* joining the results */
+#define        TRACE_FLUSH_SIZE      (1 << 20)
+#define        FOLDED_BUCKETS        4096
+
+struct tag_profile
+{
+    char       name[20];
+    uint64_t   calls;
+    uint64_t   total_ns;
+    uint64_t   self_ns;      /* without the tags executed inside */
+    uint64_t   bytes_in;
+    uint64_t   bytes_out;
+    uint64_t   allocs;       /* self, see is_memory_allocated() */
+};
+
+struct profile_frame
+{
+    const char* name;
+    uint8_t    kind;
+    uint64_t   start;
+    uint64_t   children_ns;
+    uint64_t   allocs;
+    uint64_t   children_allocs;
+};
+
+/* self time of a call stack: "file;tag;tag" */
+struct folded_stack
+{
+    char*      stack;
+    uint64_t   ns;
+    struct folded_stack* next;
+};
+
+extern uint8_t           profiling;
+extern __thread uint64_t profile_allocs;
+
+uint64_t       get_clock_ns          (void);
+void           profile_enter         (const char* name, uint8_t kind);
+void           profile_leave         (char** attrs, uint64_t bytes_in,
+                                      uint64_t bytes_out);
+struct tag_profile* find_tag_profile (struct tag_profile* profiles,
+                                      uint16_t* count, const char* name);
+void           add_tag_profiles      (struct tag_profile* to,
+                                      uint16_t* to_count,
+                                      const struct tag_profile* from,
+                                      uint16_t from_count);
+int            compare_tag_profiles  (const void* a, const void* b);
+void           print_tag_profiles    (const char* title,
+                                      struct tag_profile* profiles,
+                                      uint16_t count);
+struct tag_profile* get_thread_profiles(uint16_t* count);
+void           add_thread_profile    (void);
+void           print_file_profile    (const char* filename);
+void           print_total_profile   (void);
+
+uint8_t        start_trace           (const char* path);
+void           add_trace_event       (const struct profile_frame* frame,
+                                      uint64_t end, char** attrs,
+                                      uint64_t bytes_in, uint64_t bytes_out);
+void           flush_trace           (void);
+void           finish_trace          (void);
+
+uint8_t        start_folded          (const char* path);
+void           add_folded_stack      (struct folded_stack** buckets,
+                                      const char* stack, uint64_t ns);
+void           add_thread_stack      (uint64_t ns);
+void           flush_folded          (void);
+void           finish_folded         (void);
+
+#endif /* PROFILE_H */
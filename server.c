@@ -0,0 +1,428 @@
+/* server.c
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ */
+#include "server.h"
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+struct memo_cache memo_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/****************************************************************************
+*                     functions for rendered documents                      *
+****************************************************************************/
+
+uint64_t get_memo_cache_size(void)
+{
+    char* env = getenv("TXTFMT_MEMO_MB");
+    long mb = (env != NULL) ? atol(env) : MEMO_CACHE_SIZE;
+    return (mb > 0) ? (uint64_t)mb << 20 : 0;
+}
+
+uint64_t get_memo_hash(const char* text, uint32_t len, uint32_t width)
+{
+    /* FNV-1a */
+    uint64_t hash = 14695981039346656037ULL ^ width;
+    for ( uint32_t i=0; i<len; i++ ) {
+        hash ^= (uint8_t)text[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+void free_memo_entry(struct memo_entry* me)
+{
+    for ( uint16_t i=0; i<me->deps_count; i++ )
+        free(me->deps[i].path);
+
+    free(me->deps);
+    free(me->input);
+    free(me->output);
+    free(me);
+}
+
+void add_lru_entry(struct memo_entry* me)
+{
+    /* the document becomes the newest one; memo_cache.lock is held */
+    me->newer = NULL;
+    me->older = memo_cache.newest;
+    if ( memo_cache.newest != NULL )
+        memo_cache.newest->newer = me;
+    else
+        memo_cache.oldest = me;
+
+    memo_cache.newest = me;
+}
+
+void remove_lru_entry(struct memo_entry* me)
+{
+    if ( me->newer != NULL )
+        me->newer->older = me->older;
+    else
+        memo_cache.newest = me->older;
+
+    if ( me->older != NULL )
+        me->older->newer = me->newer;
+    else
+        memo_cache.oldest = me->newer;
+
+    me->newer = NULL;
+    me->older = NULL;
+}
+
+void unlink_memo_entry(struct memo_entry** link)
+{
+    /* memo_cache.lock is held */
+    struct memo_entry* me = *link;
+    *link = me->next;
+    remove_lru_entry(me);
+    memo_cache.bytes -= me->input_len + me->output_len;
+    free_memo_entry(me);
+}
+
+void evict_memo_entries(uint64_t len)
+{
+    /* the tail of the LRU list goes first; memo_cache.lock is held */
+    while ( memo_cache.bytes > 0 &&
+            memo_cache.bytes + len > memo_cache.max_bytes ) {
+        struct memo_entry* oldest = memo_cache.oldest;
+        struct memo_entry** link =
+            &memo_cache.buckets[oldest->hash % MEMO_CACHE_BUCKETS];
+        while ( *link != oldest )
+            link = &(*link)->next;
+
+        unlink_memo_entry(link);
+    }
+}
+
+uint8_t is_memo_valid(const struct memo_entry* me)
+{
+    /* the files read last time are the same */
+    struct stat st;
+    for ( uint16_t i=0; i<me->deps_count; i++ ) {
+        const struct memo_dep* dep = &me->deps[i];
+        if ( stat(dep->path, &st) != 0 || st.st_dev != dep->dev ||
+             st.st_ino != dep->ino || st.st_size != dep->size ||
+             st.st_mtim.tv_sec != dep->mtime.tv_sec ||
+             st.st_mtim.tv_nsec != dep->mtime.tv_nsec )
+            return 0;
+    }
+
+    return 1;
+}
+
+char* find_memo_output(const char* text, uint32_t len, uint32_t width,
+                       uint64_t* out_len)
+{
+    /* a copy of the output; NULL if the document has to be rendered */
+    uint64_t hash = get_memo_hash(text, len, width);
+    char* output = NULL;
+    pthread_mutex_lock(&memo_cache.lock);
+    struct memo_entry** link = &memo_cache.buckets[hash % MEMO_CACHE_BUCKETS];
+    for ( ; *link != NULL; link = &(*link)->next ) {
+        struct memo_entry* me = *link;
+        if ( me->hash != hash || me->width != width || me->input_len != len ||
+             memcmp(me->input, text, len) != 0 )
+            continue;
+
+        if ( is_memo_valid(me) == 0 ) {
+            unlink_memo_entry(link);
+            break;
+        }
+
+        remove_lru_entry(me);
+        add_lru_entry(me);
+        output = malloc(me->output_len + 1);
+        is_memory_allocated(output);
+        memcpy(output, me->output, me->output_len);
+        output[me->output_len] = '\0';
+        *out_len = me->output_len;
+        break;
+    }
+
+    pthread_mutex_unlock(&memo_cache.lock);
+    return output;
+}
+
+void add_memo_output(const char* text, uint32_t len, uint32_t width,
+                     const char* output, uint64_t out_len, char** deps,
+                     uint16_t deps_count)
+{
+    uint64_t size = len + out_len;
+    if ( size > memo_cache.max_bytes )
+        return;
+
+    struct memo_entry* me = calloc(1, sizeof(struct memo_entry));
+    is_memory_allocated(me);
+    me->hash = get_memo_hash(text, len, width);
+    me->width = width;
+    me->input = malloc(len);
+    is_memory_allocated(me->input);
+    memcpy(me->input, text, len);
+    me->input_len = len;
+    me->output = malloc(out_len);
+    is_memory_allocated(me->output);
+    memcpy(me->output, output, out_len);
+    me->output_len = out_len;
+    me->deps = calloc(deps_count, sizeof(struct memo_dep));
+    is_memory_allocated(me->deps);
+    struct stat st;
+    for ( uint16_t i=0; i<deps_count; i++ ) {
+        if ( stat(deps[i], &st) != 0 ) {
+            free_memo_entry(me);
+            return;
+        }
+
+        struct memo_dep* dep = &me->deps[me->deps_count++];
+        dep->path = strdup(deps[i]);
+        is_memory_allocated(dep->path);
+        dep->dev = st.st_dev;
+        dep->ino = st.st_ino;
+        dep->size = st.st_size;
+        dep->mtime = st.st_mtim;
+    }
+
+    pthread_mutex_lock(&memo_cache.lock);
+    /* another thread may have rendered the same document */
+    uint16_t bucket = me->hash % MEMO_CACHE_BUCKETS;
+    struct memo_entry** link = &memo_cache.buckets[bucket];
+    for ( ; *link != NULL; link = &(*link)->next ) {
+        struct memo_entry* old = *link;
+        if ( old->hash == me->hash && old->width == width &&
+             old->input_len == len && memcmp(old->input, text, len) == 0 ) {
+            unlink_memo_entry(link);
+            break;
+        }
+    }
+
+    evict_memo_entries(size);
+    me->next = memo_cache.buckets[bucket];
+    memo_cache.buckets[bucket] = me;
+    add_lru_entry(me);
+    memo_cache.bytes += size;
+    pthread_mutex_unlock(&memo_cache.lock);
+}
+
+void free_memo_cache(void)
+{
+    pthread_mutex_lock(&memo_cache.lock);
+    for ( uint16_t i=0; i<MEMO_CACHE_BUCKETS; i++ ) {
+        while ( memo_cache.buckets[i] != NULL )
+            unlink_memo_entry(&memo_cache.buckets[i]);
+    }
+
+    pthread_mutex_unlock(&memo_cache.lock);
+}
+
+char* render_document(const char* text, uint32_t len, uint32_t width,
+                      uint64_t* out_len)
+{
+    /* documents with <date> or <time> are rendered every time */
+    char* output = find_memo_output(text, len, width, out_len);
+    if ( output != NULL )
+        return output;
+
+    start_file_tracking();
+    output = render_text(text, (width == 0) ? DEFAULT_DOC_WIDTH :
+                                (width > 250) ? 250 : width, out_len);
+    uint16_t deps_count = 0;
+    char** deps = stop_file_tracking(&deps_count);
+    if ( doc_uses_time == 0 )
+        add_memo_output(text, len, width, output, *out_len, deps, deps_count);
+
+    for ( uint16_t i=0; i<deps_count; i++ )
+        free(deps[i]);
+
+    free(deps);
+    return output;
+}
+
+/****************************************************************************
+*                        functions for the connections                      *
+****************************************************************************/
+
+uint8_t read_full(int fd, void* buf, uint64_t len)
+{
+    /* 0 on the end of the connection or after SERVER_TIMEOUT */
+    char* pos = buf;
+    while ( len > 0 ) {
+        ssize_t n = read(fd, pos, len);
+        if ( n <= 0 )
+            return 0;
+
+        pos += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+uint8_t write_full(int fd, const void* buf, uint64_t len)
+{
+    const char* pos = buf;
+    while ( len > 0 ) {
+        ssize_t n = send(fd, pos, len, MSG_NOSIGNAL);
+        if ( n <= 0 )
+            return 0;
+
+        pos += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+uint8_t serve_request(int fd)
+{
+    /* 0 if the connection is finished */
+    struct render_request req;
+    if ( read_full(fd, &req, sizeof(req)) == 0 )
+        return 0;
+
+    struct render_response resp = { RENDER_OK, 0 };
+    if ( req.length > MAX_RENDER_REQUEST ) {
+        resp.status = RENDER_TOO_LARGE;
+        write_full(fd, &resp, sizeof(resp));
+        return 0;
+    }
+
+    char* text = malloc((uint64_t)req.length + 1);
+    is_memory_allocated(text);
+    if ( read_full(fd, text, req.length) == 0 ) {
+        free(text);
+        return 0;
+    }
+
+    text[req.length] = '\0';
+    uint64_t out_len = 0;
+    char* output = render_document(text, req.length, req.width, &out_len);
+    free(text);
+    resp.length = out_len;
+    uint8_t sent = write_full(fd, &resp, sizeof(resp)) &&
+                   write_full(fd, output, out_len);
+    free(output);
+    return sent;
+}
+
+uint8_t set_socket_timeouts(int fd)
+{
+    /* a client that stops in the middle of a request or doesn't read the
+       answer is dropped instead of holding a render thread */
+    struct timeval timeout = { SERVER_TIMEOUT, 0 };
+    return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                      sizeof(timeout)) == 0 &&
+           setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                      sizeof(timeout)) == 0;
+}
+
+#ifdef __linux__
+void* server_thread(void* arg)
+{
+    /* one request at a time: a connection is disarmed while its request is
+       rendered and waits in epoll between the requests, a stalled one is
+       closed after SERVER_TIMEOUT; the errors of the tags go to stderr */
+    struct server* srv = arg;
+    struct epoll_event event;
+    error_file = stderr;
+    while ( 1 ) {
+        if ( epoll_wait(srv->epoll_fd, &event, 1, -1) != 1 )
+            continue;
+
+        if ( event.data.fd == srv->listen_fd ) {
+            int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if ( fd == -1 )
+                continue;
+
+            if ( set_socket_timeouts(fd) == 0 ) {
+                close(fd);
+                continue;
+            }
+
+            event.events = EPOLLIN | EPOLLONESHOT;
+            event.data.fd = fd;
+            if ( epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0 )
+                close(fd);
+
+            continue;
+        }
+
+        int fd = event.data.fd;
+        if ( serve_request(fd) == 0 ) {
+            close(fd);
+            continue;
+        }
+
+        event.events = EPOLLIN | EPOLLONESHOT;
+        if ( epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, fd, &event) != 0 )
+            close(fd);
+    }
+
+    return NULL;
+}
+
+int serve_documents(const char* socket_path)
+{
+    /* the render threads take requests from all the connections */
+    struct server srv;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ( strlen(socket_path) >= sizeof(addr.sun_path) ) {
+        printf("Error: the socket path \"%s\" is too long\n", socket_path);
+        return EXIT_FAILURE;
+    }
+
+    strcpy(addr.sun_path, socket_path);
+    srv.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC |
+                                    SOCK_NONBLOCK, 0);
+    srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if ( srv.listen_fd == -1 || srv.epoll_fd == -1 ) {
+        puts("Error: can't create a socket");
+        return EXIT_FAILURE;
+    }
+
+    unlink(socket_path);
+    struct epoll_event event = { .events = EPOLLIN };
+    event.data.fd = srv.listen_fd;
+    if ( bind(srv.listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+         listen(srv.listen_fd, SERVER_BACKLOG) != 0 ||
+         epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.listen_fd, &event) != 0 ) {
+        printf("Error: can't listen on \"%s\"\n", socket_path);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    memo_cache.max_bytes = get_memo_cache_size();
+    uint16_t threads_count = get_workers_count();
+    pthread_t threads[MAX_WORKERS];
+    for ( uint16_t i=1; i<threads_count; i++ ) {
+        if ( pthread_create(&threads[i], NULL, server_thread, &srv) != 0 )
+            exit_on_error("Error: can't start a server thread", NULL);
+    }
+
+    printf("serving on %s with %u threads, press Ctrl+C to stop\n",
+           socket_path, threads_count);
+    fflush(stdout);
+    server_thread(&srv);
+    return 0;
+}
+#else
+int serve_documents(const char* socket_path)
+{
+    puts("Error: --serve needs epoll, it is available on Linux only");
+    return EXIT_FAILURE;
+}
+#endif
@@ -0,0 +1,105 @@
+/* server.h
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ */
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "tags_lib.h"
+
+/* --serve protocol: every request is a render_request and the document,
+   every answer is a render_response and the formatted text. Numbers are in
+   the byte order of the host, both sides run on the same machine. */
+struct render_request
+{
+    uint32_t   width;         /* 0 - the default document width */
+    uint32_t   length;
+};
+
+struct render_response
+{
+    uint32_t   status;        /* RENDER_OK or RENDER_TOO_LARGE */
+    uint32_t   length;
+};
+
+#define        RENDER_OK             0
+#define        RENDER_TOO_LARGE      1
+#define        MAX_RENDER_REQUEST    (64 << 20)
+#define        SERVER_BACKLOG        128
+#define        SERVER_TIMEOUT        5     /* seconds to read or write */
+
+struct server
+{
+    int        listen_fd;
+    int        epoll_fd;
+};
+
+/* rendered documents, shared by the server threads */
+#define        MEMO_CACHE_SIZE       64    /* MB, see TXTFMT_MEMO_MB */
+#define        MEMO_CACHE_BUCKETS    1024
+
+struct memo_dep
+{
+    char*      path;
+    dev_t      dev;
+    ino_t      ino;
+    off_t      size;
+    struct timespec mtime;
+};
+
+struct memo_entry
+{
+    uint64_t   hash;
+    uint32_t   width;
+    char*      input;
+    uint32_t   input_len;
+    char*      output;
+    uint64_t   output_len;
+    struct memo_dep* deps;    /* files read by the rendering */
+    uint16_t   deps_count;
+    struct memo_entry* next;
+    struct memo_entry* newer;  /* LRU list, the newest document first */
+    struct memo_entry* older;
+};
+
+struct memo_cache
+{
+    pthread_mutex_t lock;
+    struct memo_entry* buckets[MEMO_CACHE_BUCKETS];
+    uint64_t   bytes;
+    uint64_t   max_bytes;
+    struct memo_entry* newest;
+    struct memo_entry* oldest;
+};
+
+uint64_t       get_memo_cache_size   (void);
+uint64_t       get_memo_hash         (const char* text, uint32_t len,
+                                      uint32_t width);
+void           free_memo_entry       (struct memo_entry* me);
+void           add_lru_entry         (struct memo_entry* me);
+void           remove_lru_entry      (struct memo_entry* me);
+void           unlink_memo_entry     (struct memo_entry** link);
+void           evict_memo_entries    (uint64_t len);
+uint8_t        is_memo_valid         (const struct memo_entry* me);
+char*          find_memo_output      (const char* text, uint32_t len,
+                                      uint32_t width, uint64_t* out_len);
+void           add_memo_output       (const char* text, uint32_t len,
+                                      uint32_t width, const char* output,
+                                      uint64_t out_len, char** deps,
+                                      uint16_t deps_count);
+void           free_memo_cache       (void);
+char*          render_document       (const char* text, uint32_t len,
+                                      uint32_t width, uint64_t* out_len);
+uint8_t        read_full             (int fd, void* buf, uint64_t len);
+uint8_t        write_full            (int fd, const void* buf, uint64_t len);
+uint8_t        serve_request         (int fd);
+uint8_t        set_socket_timeouts   (int fd);
+void*          server_thread         (void* arg);
+int            serve_documents       (const char* socket_path);
+
+#endif /* SERVER_H */
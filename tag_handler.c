@@ -14,18 +14,32 @@ char    tag_list[][20]                  =  { "right", "center", "p", "frame",
                                              "table", "calc", "sep", "h1", "h2",
                                              "h3", "h4", "insert", "doc_width",
                                              "default_width", "date", "time", 
-                                             "datetime"  };
+                                             "datetime", "csv", "stats",
+                                             "chart", "foreach", "set",
+                                             "if", "include", "define" };
 const int tag_count = sizeof(tag_list) / sizeof(tag_list[0]);
 char* (*tag_functions[])(char*, char**) = { right, center, p, get_framed_text,
                                             get_list, get_lines, get_histogram,
                                             get_table, calc, separator, h1, h2,
                                             h3, h4, insert, doc_width,
                                             def_width, get_date, get_time,
-                                            get_datetime };
+                                            get_datetime, get_csv, get_stats,
+                                            get_chart, foreach, set_var,
+                                            cond_block, include, define };
 
 char single_tags[][20] = { "date", "time", "datetime", "doc_width",
-                           "default_width", "sep", "lines", "insert" };
+                           "default_width", "sep", "lines", "insert",
+                           "csv", "set", "include" };
 const int single_tags_count = sizeof(single_tags) / sizeof(single_tags[0]);
+/* the content of these tags is passed to them as it is */
+char raw_tags[][20] = { "foreach", "if", "define" };
+const int raw_tags_count = sizeof(raw_tags) / sizeof(raw_tags[0]);
+__thread uint16_t tag_depth = 0;
+__thread uint16_t render_depth = 0;
+/* every thread formats its own document */
+__thread struct macro macros[MAX_MACROS];
+__thread uint8_t      macros_count = 0;
+__thread uint8_t      macro_depth = 0;
 
 
 int8_t have_attributes(char* tag)
@@ -87,10 +101,12 @@ int8_t is_valid_tag(char* tag)
         }
     }
 
+    /* macros follow the built-in tags */
+    int16_t macro = find_macro(tag_name);
     if ( tag != tag_name )
         free(tag_name);
     
-    return -1;
+    return (macro != -1) ? tag_count + macro : -1;
 }
 
 int8_t is_single_tag(char* tag)
@@ -105,12 +121,79 @@ int8_t is_single_tag(char* tag)
         }
     }
 
+    int16_t macro = find_macro(tag_name);
     if ( tag != tag_name )
         free(tag_name);
     
+    return macro != -1 && macros[macro].paired == 0;
+}
+
+int8_t is_raw_tag(char* tag)
+{
+    char* tag_name = get_tag_name(tag);
+    for ( uint8_t i=0; i<raw_tags_count; i++ ) {
+        if ( strcmp(raw_tags[i], tag_name) == 0 ) {
+            if ( tag != tag_name )
+                free(tag_name);
+
+            return 1;
+        }
+    }
+
+    if ( tag != tag_name )
+        free(tag_name);
+
     return 0;
 }
 
+uint8_t is_tag_at(const char* str, const char* tag_name)
+{
+    /* "<name>" or "<name attrs...>" */
+    uint32_t len = strlen(tag_name);
+    return str[0] == '<' && strncmp(&str[1], tag_name, len) == 0 &&
+           (str[len + 1] == '>' || str[len + 1] == ' ');
+}
+
+char* find_close_tag(char* str, const char* tag_name)
+{
+    /* the content of raw tags is not executed before, so the same tags
+       may be nested in it: <if a>...<if b>...</if>...</if> */
+    uint32_t len = strlen(tag_name);
+    uint32_t depth = 1;
+    char* pos = str;
+    while ( (pos = strchr(pos, '<')) != NULL ) {
+        if ( pos[1] == '/' && strncmp(&pos[2], tag_name, len) == 0 &&
+             pos[len + 2] == '>' ) {
+            if ( --depth == 0 )
+                return pos;
+        } else if ( is_tag_at(pos, tag_name) )
+            depth++;
+
+        pos++;
+    }
+
+    return NULL;
+}
+
+char* find_else(char* str)
+{
+    /* <else> of this <if>, not of the nested ones */
+    uint32_t depth = 0;
+    char* pos = str;
+    while ( (pos = strchr(pos, '<')) != NULL ) {
+        if ( strncmp(pos, "</if>", 5) == 0 )
+            depth--;
+        else if ( is_tag_at(pos, "if") )
+            depth++;
+        else if ( depth == 0 && strncmp(pos, "<else>", 6) == 0 )
+            return pos;
+
+        pos++;
+    }
+
+    return NULL;
+}
+
 char* get_open_tag(char* tag)
 {
     char* open_tag = (char*)calloc(strlen(tag) + 3,  sizeof(char));
@@ -146,11 +229,13 @@ char* get_tag(const char* str)
         return NULL;
 
     char* tag = NULL;
-    char* start = strchr(str, '<') + 1;
+    char* start = strchr(str, '<');
     char* end = strchr(str, '>');
     if ( start == NULL || end == NULL ) 
         return NULL;
 
+    start++;
+
     if ( end > start ) {
         if ( *start != '/' ) {
             tag = (char*)calloc(end - start + 1,  sizeof(char));
@@ -178,6 +263,13 @@ char* get_tag_content(char* str, char* tag)
     char *start = strstr(str, open_tag) +
                   sizeof(char) * strlen(open_tag);
     char *end = strstr(str, close_tag);
+    if ( is_raw_tag(tag) ) {
+        char* tag_name = get_tag_name(tag);
+        end = find_close_tag(start, tag_name);
+        if ( tag_name != tag )
+            free(tag_name);
+    }
+
     free(open_tag);
     free(close_tag);
     if ( end == NULL || end - start == 0 ) {
@@ -205,8 +297,17 @@ char* get_tag_content(char* str, char* tag)
         tag_content = tmp;
     }
 
-    if ( tag_content[strlen(tag_content) - 1] == '\n' )
-        tag_content[strlen(tag_content) - 1] = '\0';
+    size_t content_len = strlen(tag_content);
+    if ( content_len > 0 && tag_content[content_len - 1] == '\n' )
+        tag_content[--content_len] = '\0';
+
+    if ( content_len == 0 ) {
+        /* only line breaks, the same as an empty tag */
+        free(tag_content);
+        tag_content = (char *) calloc(3, sizeof(char));
+        is_memory_allocated(tag_content);
+        strcpy(tag_content, "\v");
+    }
 
     return tag_content;
 }
@@ -223,33 +324,149 @@ char* get_text_before_tag(char* str, char* tag)
     return text_before_tag;
 }
 
-char* get_text_after_tag(char* str, char* tag)
+char* find_text_after_tag(char* str, char* tag)
 {
+    /* the errors of the tag are printed here */
     char* close_tag = get_close_tag(tag);
     char* end_tag = strstr(str, close_tag);
+    if ( is_raw_tag(tag) ) {
+        char* open_tag = get_open_tag(tag);
+        char* tag_name = get_tag_name(tag);
+        char* start_tag = strstr(str, open_tag);
+        end_tag = (start_tag != NULL) ?
+                  find_close_tag(start_tag + strlen(open_tag), tag_name) :
+                  NULL;
+        if ( tag_name != tag )
+            free(tag_name);
+
+        free(open_tag);
+    }
+
     if ( end_tag == NULL ) {
         if ( is_valid_tag(tag) != -1 )
-            printf("  Error: no closing tag found for \"%s\". Ignoring\n", tag);
+            print_error("no closing tag found for \"%s\"", tag);
         else
             print_tag_error(tag);
         
         free(close_tag);
         close_tag = get_open_tag(tag);
         end_tag = strstr(str, close_tag);
+        if ( end_tag == NULL ) {
+            /* spaces before '>': "<if x >" */
+            close_tag[strlen(close_tag) - 1] = '\0';
+            end_tag = strstr(str, close_tag);
+            end_tag = (end_tag != NULL) ? strchr(end_tag, '>') : NULL;
+            if ( end_tag == NULL )
+                end_tag = &str[strlen(str)];
+
+            strcpy(close_tag, (end_tag[0] == '>') ? ">" : "");
+        }
     } else if ( is_valid_tag(tag) == -1 ) 
         print_tag_error(tag);
 
     end_tag = end_tag + sizeof(char) * strlen(close_tag);
     free(close_tag);
-    char* text_after_tag = (char*)calloc(strlen(str) - (end_tag - &str[0]) + 1,
-                                         sizeof(char));
+    return end_tag;
+}
+
+char* get_text_after_tag(char* str, char* tag)
+{
+    char* text_after_tag = strdup(find_text_after_tag(str, tag));
     is_memory_allocated(text_after_tag);
-    strcpy(text_after_tag, end_tag);
     return text_after_tag;
 }
 
 
 
+int16_t find_macro(const char* name)
+{
+    for ( uint8_t i=0; i<macros_count; i++ ) {
+        if ( strcmp(macros[i].name, name) == 0 )
+            return i;
+    }
+
+    return -1;
+}
+
+uint8_t add_macro(const char* name, const char* body)
+{
+    /* the body is compiled once; a new definition replaces the old one */
+    uint32_t len = strlen(name);
+    if ( len == 0 || len >= sizeof(macros[0].name) )
+        return 0;
+
+    for ( uint32_t i=0; i<len; i++ ) {
+        if ( !isalnum((unsigned char)name[i]) && name[i] != '_' )
+            return 0;
+    }
+
+    for ( uint8_t i=0; i<tag_count; i++ ) {
+        if ( strcmp(tag_list[i], name) == 0 )
+            return 0;
+    }
+
+    int16_t i = find_macro(name);
+    if ( i != -1 ) {
+        free_template(&macros[i].tpl);
+        free(macros[i].body);
+    } else if ( macros_count == MAX_MACROS )
+        return 0;
+    else
+        i = macros_count++;
+
+    strcpy(macros[i].name, name);
+    macros[i].body = strdup(body);
+    is_memory_allocated(macros[i].body);
+    compile_macro(macros[i].body, &macros[i].tpl);
+    macros[i].paired = 0;
+    for ( uint32_t j=0; j<macros[i].tpl.count; j++ ) {
+        if ( macros[i].tpl.parts[j].field == MACRO_CONTENT )
+            macros[i].paired = 1;
+    }
+
+    return 1;
+}
+
+void clear_macros(void)
+{
+    for ( uint8_t i=0; i<macros_count; i++ ) {
+        free_template(&macros[i].tpl);
+        free(macros[i].body);
+    }
+
+    macros_count = 0;
+}
+
+char* run_macro(uint8_t i, char* tag_content, char** attrs)
+{
+    if ( macro_depth == MAX_MACRO_DEPTH ) {
+        print_error("macro \"%s\" is nested deeper than %d levels",
+                    macros[i].name, MAX_MACRO_DEPTH);
+        char* empty = calloc(1, sizeof(char));
+        is_memory_allocated(empty);
+        return empty;
+    }
+
+    /* single tags get " " as their content */
+    const char* content = tag_content;
+    if ( strcmp(content, "\v") == 0 || strcmp(content, " ") == 0 )
+        content = "";
+
+    struct str_buf body;
+    str_buf_init(&body, strlen(macros[i].body) + strlen(content) + 64);
+    expand_macro(&macros[i].tpl, &body, content, attrs);
+    /* the content is already executed, so a body without tags filled with
+       text that has none is final and isn't scanned for tags again */
+    if ( macros[i].tpl.has_tags == 0 && strpbrk(body.data, "<>") == NULL )
+        return body.data;
+
+    macro_depth++;
+    char* result = execute_all_tags(body.data);
+    macro_depth--;
+    free(body.data);
+    return result;
+}
+
 char* execute_tag(char* tag, char* tag_content)
 {
     char* t_tag = strdup(tag);
@@ -258,7 +475,16 @@ char* execute_tag(char* tag, char* tag_content)
     
     if ( tag_i != -1 && strcmp(tag_content, "\r") != 0 ) {
         char** attr = get_tag_attributes(t_tag);
-        char* tag_result = (*tag_functions[tag_i])(tag_content, attr);
+        if ( profiling )
+            profile_enter((tag_i < tag_count) ? tag_list[tag_i] :
+                          macros[tag_i - tag_count].name, FRAME_TAG);
+
+        char* tag_result = (tag_i < tag_count) ?
+                           (*tag_functions[tag_i])(tag_content, attr) :
+                           run_macro(tag_i - tag_count, tag_content, attr);
+        if ( profiling )
+            profile_leave(attr, strlen(tag_content), strlen(tag_result));
+
         for ( uint16_t i=0; i<have_attributes(tag)-1; i++ ) {
             if ( attr[i] != NULL )
                 free(attr[i]);
@@ -275,58 +501,129 @@ char* execute_tag(char* tag, char* tag_content)
     return tag_content;
 }
 
-char* execute_nested_tags(char* str)
+char* execute_first_tag(char* str, char** tag_start, char** tag_end)
 {
+    /* NULL if there are no tags; otherwise the result of the first tag,
+       which is found between *tag_start and *tag_end in str */
+    if ( profiling )
+        profile_enter(PROFILE_PARSE, FRAME_STEP);
+
     char* tag = get_tag(str);
-    if ( tag != NULL ) {
-        char* t_tag = strdup(tag);
-        t_tag = rm_spaces_start_end(t_tag);
-
-        char* tag_content = get_tag_content(str, tag);
-        char* res = execute_nested_tags(tag_content);
-
-        char* text_before_tag = get_text_before_tag(str, tag);
-        char* text_after_tag = get_text_after_tag(str, t_tag);
-
-        char* result = NULL;
-        char* tag_result = execute_tag(tag, res);
-        uint32_t len = strlen(text_before_tag) + strlen(tag_result) + \
-                       strlen(text_after_tag) + 1;
-        result = (char*)calloc(len,  sizeof(char));
-        is_memory_allocated(result);
-        sprintf(result, "%s%s%s", text_before_tag, tag_result, text_after_tag);
-        free(text_before_tag);
-        free(tag_result);
-        free(text_after_tag);
-        free(t_tag);
-        if ( tag_content != tag_result )
-            free(tag_content);
+    if ( tag == NULL ) {
+        if ( profiling )
+            profile_leave(NULL, 0, 0);
 
-        if ( res != tag_content )
-            free(res);
-        
-        free(tag);
-        return result;
+        return NULL;
     }
 
+    char* t_tag = strdup(tag);
+    t_tag = rm_spaces_start_end(t_tag);
+
+    char* tag_content = get_tag_content(str, tag);
+    if ( profiling )
+        profile_leave(NULL, 0, strlen(tag_content));
+
+    char* res = tag_content;
+    if ( is_raw_tag(t_tag) == 0 ) {
+        tag_depth++;
+        res = execute_nested_tags(tag_content);
+        tag_depth--;
+    }
+
+    /* (parse) is counted twice for every tag: before and after its content
+       is executed */
+    if ( profiling )
+        profile_enter(PROFILE_PARSE, FRAME_STEP);
+
+    /* the tag is at the first '<', see get_tag() */
+    *tag_start = strchr(str, '<');
+    *tag_end = find_text_after_tag(str, t_tag);
+    if ( profiling )
+        profile_leave(NULL, *tag_end - str, *tag_start - str);
+
+    char* tag_result = execute_tag(tag, res);
+    free(t_tag);
+    if ( tag_content != tag_result )
+        free(tag_content);
+
+    if ( res != tag_content && res != tag_result )
+        free(res);
+
     free(tag);
-    return str;
+    return tag_result;
+}
+
+char* execute_nested_tags(char* str)
+{
+    char* tag_start = NULL;
+    char* tag_end = NULL;
+    char* tag_result = execute_first_tag(str, &tag_start, &tag_end);
+    if ( tag_result == NULL )
+        return str;
+
+    if ( profiling )
+        profile_enter(PROFILE_SPLICE, FRAME_STEP);
+
+    struct str_buf result;
+    str_buf_init(&result, (tag_start - str) + strlen(tag_result) +
+                          strlen(tag_end) + 1);
+    str_buf_append_n(&result, str, tag_start - str);
+    str_buf_append(&result, tag_result);
+    str_buf_append(&result, tag_end);
+    if ( profiling )
+        profile_leave(NULL, result.len, result.len);
+
+    free(tag_result);
+    return result.data;
 }
 
 char* execute_all_tags(char* str)
 {
-    char* result = strdup(str);
-    is_memory_allocated(result);
-    char* tmp = NULL;
-    char* tag = get_tag(result);
-    while ( tag != NULL ) {
-        tmp = strdup(result);
-        free(result);
-        result = execute_nested_tags(tmp);
-        free(tmp);
-        free(tag);
-        tag = get_tag(result);
+    /* there are no '<' and '>' before the first tag (see get_tag()), so
+       that text is final; so is a result of the tag without them, and the
+       text after it is executed in place instead of being copied; other
+       results are executed again together with the rest. Streamed tables
+       and files are kept out of the text at an offset in the result (see
+       add_table_stream()); the tags that stream never return '<' or '>' */
+    struct str_buf result;
+    str_buf_init(&result, strlen(str) + 1);
+    char* text = strdup(str);
+    is_memory_allocated(text);
+    char* pos = text;
+    char* tag_start = NULL;
+    char* tag_end = NULL;
+    char* tag_result = NULL;
+    uint16_t streams = table_streams_count;
+    render_depth++;
+    while ( (tag_result = execute_first_tag(pos, &tag_start,
+                                            &tag_end)) != NULL ) {
+        if ( profiling )
+            profile_enter(PROFILE_SPLICE, FRAME_STEP);
+
+        uint64_t len = result.len;
+        str_buf_append_n(&result, pos, tag_start - pos);
+        if ( strpbrk(tag_result, "<>") == NULL ) {
+            move_table_streams(streams, result.len);
+            str_buf_append(&result, tag_result);
+            pos = tag_end;
+        } else {
+            char* rest = calloc(strlen(tag_result) + strlen(tag_end) + 1,
+                                sizeof(char));
+            is_memory_allocated(rest);
+            sprintf(rest, "%s%s", tag_result, tag_end);
+            free(text);
+            text = pos = rest;
+        }
+
+        if ( profiling )
+            profile_leave(NULL, result.len - len, result.len - len);
+
+        free(tag_result);
+        streams = table_streams_count;
     }
 
-    return result;
-}
\ No newline at end of file
+    render_depth--;
+    str_buf_append(&result, pos);
+    free(text);
+    return result.data;
+}
@@ -14,6 +14,8 @@
 
 extern char      tag_list[][20];
 extern const int tag_count;
+extern __thread uint16_t tag_depth; /* 0 while a top level tag is executed */
+extern __thread uint16_t render_depth; /* 1 while a document is executed */
 
 int8_t  have_attributes      (char* tag);
 char**  get_tag_attributes   (char* tag);
@@ -22,6 +24,11 @@ char*   get_tag_name         (char* tag);
 
 int8_t  is_valid_tag         (char* tag);
 int8_t  is_single_tag        (char* tag);
+int8_t  is_raw_tag           (char* tag);
+
+uint8_t is_tag_at            (const char* str, const char* tag_name);
+char*   find_close_tag       (char* str, const char* tag_name);
+char*   find_else            (char* str);
 
 char*   get_open_tag         (char* tag);
 char*   get_close_tag        (char* tag);
@@ -29,9 +36,16 @@ char*   get_close_tag        (char* tag);
 char*   get_tag              (const char* str);
 char*   get_tag_content      (char* str, char* tag);
 char*   get_text_before_tag  (char* str, char* tag);
+char*   find_text_after_tag  (char* str, char* tag);
 char*   get_text_after_tag   (char* str, char* tag);
 
+int16_t find_macro           (const char* name);
+uint8_t add_macro            (const char* name, const char* body);
+void    clear_macros         (void);
+char*   run_macro            (uint8_t i, char* tag_content, char** attrs);
+
 char*   execute_tag          (char* tag, char* tag_content);
+char*   execute_first_tag    (char* str, char** tag_start, char** tag_end);
 char*   execute_nested_tags  (char* str);
 char*   execute_all_tags     (char* str);
 
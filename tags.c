@@ -16,10 +16,11 @@ char* get_date(char* str, char** attrs)
 {
     char* date = calloc(11, sizeof(char));
     is_memory_allocated(date);
-    time_t current_time = time(NULL);
-    struct tm *local_time = localtime(&current_time);
-    sprintf(date, "%02d.%02d.%d", local_time->tm_mday, local_time->tm_mon + 1,
-            local_time->tm_year + 1900);
+    time_t current_time = get_doc_time();
+    struct tm local_time;
+    localtime_r(&current_time, &local_time);
+    sprintf(date, "%02d.%02d.%d", local_time.tm_mday, local_time.tm_mon + 1,
+            local_time.tm_year + 1900);
     return date;
 }
 
@@ -27,10 +28,11 @@ char* get_time(char* str, char** attrs)
 {
     char* t = calloc(9, sizeof(char));
     is_memory_allocated(t);
-    time_t current_time = time(NULL);
-    struct tm *local_time = localtime(&current_time);
-    sprintf(t, "%02d:%02d:%02d", local_time->tm_hour, local_time->tm_min,
-            local_time->tm_sec);
+    time_t current_time = get_doc_time();
+    struct tm local_time;
+    localtime_r(&current_time, &local_time);
+    sprintf(t, "%02d:%02d:%02d", local_time.tm_hour, local_time.tm_min,
+            local_time.tm_sec);
     return t;
 }
 
@@ -150,121 +152,126 @@ char* p(char* str, char** attrs)
         tmp_str = strdup(str);
     
     char** lines = split('\n', tmp_str);
-    uint16_t lines_count = get_elements_count('\n', tmp_str);
-    uint32_t len = strlen(tmp_str) + lines_count * 2 + 3;
-    char* pr = calloc(len, sizeof(char));
-    is_memory_allocated(p);
-    for ( uint16_t i=0; i<lines_count; i++ ) {
+    uint32_t lines_count = get_elements_count('\n', tmp_str);
+    struct str_buf pr;
+    str_buf_init(&pr, strlen(tmp_str) + (uint64_t)lines_count * 3 + 3);
+    for ( uint32_t i=0; i<lines_count; i++ ) {
         if ( attrs == NULL ) {
-            strcat(pr, "  ");
-            strcat(pr, lines[i]);
+            str_buf_append_n(&pr, "  ", 2);
+            str_buf_append(&pr, lines[i]);
         } else {
-            strcat(pr, lines[i]);
-            strcat(pr, "  ");
+            str_buf_append(&pr, lines[i]);
+            str_buf_append_n(&pr, "  ", 2);
         }
         
-        strcat(pr, "\n");
+        str_buf_append_n(&pr, "\n", 1);
         free(lines[i]);
     }
 
     free(tmp_str);
     free(lines);
-    strcat(pr, "\n");
-    return pr;
+    str_buf_append_n(&pr, "\n", 1);
+    return pr.data;
 }
 
 char* get_framed_text(char* str, char** attrs)
 {
     char** lines = split('\n', str);
-    uint16_t lines_count = get_elements_count('\n', str);
-    uint16_t max_line = get_max_len(lines, lines_count);
-    uint32_t len = (max_line + 11) * (lines_count + 2);
-    char* framed_text = calloc(len, sizeof(char));
-    is_memory_allocated(framed_text);
-
-    for ( uint16_t i=0; i<lines_count; i++ )
+    uint32_t lines_count = get_elements_count('\n', str);
+    uint32_t max_line = get_max_len(lines, lines_count);
+    for ( uint32_t i=0; i<lines_count; i++ )
         free(lines[i]);
     
     free(lines);
 
+    /* DOC_WIDTH is never less than 10, so short lines get a wider frame */
     uint8_t doc_width_bak = DOC_WIDTH;
     set_doc_width(max_line + 2);
+    uint32_t border = (DOC_WIDTH > max_line + 2) ? DOC_WIDTH - 2u : max_line;
+    struct str_buf framed_text;
+    str_buf_init(&framed_text, (uint64_t)(border + 10) * (lines_count + 2));
     char* tmp_str = center(str, NULL);
     lines = split('\n', tmp_str);
     free(tmp_str);
-    tmp_str = get_str_from_sym('=', max_line);
-    strcat(framed_text, " .+-");
-    strcat(framed_text, tmp_str);
-    strcat(framed_text, "-+. \n");
-    char* al = NULL;
-    for ( uint16_t i=0; i<lines_count; i++ ) {
-        strcat(framed_text, " ||");
-        strcat(framed_text, lines[i]);
-        al = get_str_from_sym(' ', DOC_WIDTH - strlen(lines[i]));
-        strcat(framed_text, al);
-        free(al);
-        strcat(framed_text, "|| \n");
+    str_buf_append(&framed_text, " .+-");
+    str_buf_append_sym(&framed_text, '=', border);
+    str_buf_append(&framed_text, "-+. \n");
+    for ( uint32_t i=0; i<lines_count; i++ ) {
+        uint32_t line_len = strlen(lines[i]);
+        str_buf_append(&framed_text, " ||");
+        str_buf_append_n(&framed_text, lines[i], line_len);
+        str_buf_append_sym(&framed_text, ' ', (line_len < DOC_WIDTH) ?
+                                              DOC_WIDTH - line_len : 0);
+        str_buf_append(&framed_text, "|| \n");
         free(lines[i]);
     }
 
     set_doc_width(doc_width_bak);
     free(lines);
 
-    strcat(framed_text, " '+-");
-    strcat(framed_text, tmp_str);
-    free(tmp_str);
-    strcat(framed_text, "-+' ");
-    return framed_text;
+    str_buf_append(&framed_text, " '+-");
+    str_buf_append_sym(&framed_text, '=', border);
+    str_buf_append(&framed_text, "-+' ");
+    return framed_text.data;
 }
 
 char* get_list(char* str, char** attrs)
 {
+    /* sort [desc]: numbers by value, other items as text;
+       the marker is the first other attribute */
     char** items = split('\n', str);
-    uint16_t items_count = get_elements_count('\n', str);
-    uint16_t align = 0;
+    uint32_t items_count = get_elements_count('\n', str);
+    uint8_t sort = in_str_array(attrs, "sort");
+    uint8_t desc = sort && in_str_array(attrs, "desc");
+    char marker = '\0';
+    if ( attrs != NULL ) {
+        for ( uint16_t i=0; attrs[i] != NULL; i++ ) {
+            if ( strcmp(attrs[i], "sort") != 0 &&
+                 ( desc == 0 || strcmp(attrs[i], "desc") != 0 ) ) {
+                marker = attrs[i][0];
+                break;
+            }
+        }
+    }
 
-    if ( attrs == NULL )
-        align = get_number_len(items_count);
+    uint32_t* order = NULL;
+    if ( sort )
+        order = sort_lines(items, items_count, desc);
 
-    uint16_t len = strlen(str) + items_count * (align + 4);
-    char* lst = calloc(len, sizeof(char));
-    is_memory_allocated(lst);
+    uint16_t align = get_number_len(items_count);
+    struct str_buf lst;
+    str_buf_init(&lst, strlen(str) + (uint64_t)items_count * (align + 4) + 1);
 
-    for ( uint16_t i=0; i<items_count; i++ ) {
-        uint16_t mrk_len = align + 4;
-        char* mrk_str = calloc(mrk_len, sizeof(char));
-        is_memory_allocated(mrk_str);
-        if ( attrs == NULL ) {
-            char* al = get_str_from_sym(' ', align - get_number_len(i+1));
-            sprintf(mrk_str, " %d) ", i + 1);
+    for ( uint32_t i=0; i<items_count; i++ ) {
+        char* item = items[(order != NULL) ? order[i] : i];
+        str_buf_reserve(&lst, align + 4 + strlen(item));
+        if ( marker == '\0' ) {
             /*
              n) xxxx
             nn) xxxx
             */
-            char* tmp_mrk_str = calloc(mrk_len, sizeof(char));
-            sprintf(tmp_mrk_str, "%s%s", al, mrk_str);
-            strcpy(mrk_str, tmp_mrk_str);
-            free(tmp_mrk_str);
-            /*
-            n)  xxxx
-            nn) xxxx
-            strcat(mrk_str, al); */
-            free(al);
-        } else
-            sprintf(mrk_str, " %c ", attrs[0][0]);
-        
-        strcat(lst, mrk_str);
-        free(mrk_str);
-        strcat(lst, items[i]);
-        if ( i != items_count - 1 ) 
-            strcat(lst, "\n");
+            char mrk_str[NUMBER_STR_MAX];
+            for ( uint16_t j=get_number_len(i + 1); j<align; j++ )
+                str_buf_append_n(&lst, " ", 1);
+
+            sprintf(mrk_str, " %u) ", i + 1);
+            str_buf_append(&lst, mrk_str);
+        } else {
+            char mrk_str[4] = { ' ', marker, ' ', '\0' };
+            str_buf_append(&lst, mrk_str);
+        }
+
+        str_buf_append(&lst, item);
+        if ( i != items_count - 1 )
+            str_buf_append(&lst, "\n");
     }
     /* Cleaning */
-    for ( uint16_t i=0; i<items_count; i++ )
+    for ( uint32_t i=0; i<items_count; i++ )
         free(items[i]);
-    
+
     free(items);
-    return lst;
+    free(order);
+    return lst.data;
 }
 
 char* get_lines(char* str, char** attrs)
@@ -291,58 +298,45 @@ char* get_lines(char* str, char** attrs)
 char* calc(char* str, char** attrs)
 {
     char** expressions = split('\n', str);
-    uint16_t expr_count = get_elements_count('\n', str);
-    uint16_t res_len = 0;
-    char* result_str = NULL;
-    char* tmp = NULL;
-    for ( uint16_t i=0; i<expr_count; i++ ) {
-        tmp = calloc(1000, sizeof(char));
-        is_memory_allocated(tmp);
-        int error;
-        double result = te_interp(expressions[i], &error);
-        if ( attrs == NULL ) {
-            if ( error ) {
-                sprintf(tmp, "error");
-            } else {
-                sprintf(tmp, "%g", result);
-            }
-        } else {
-            if ( error ) {
-                sprintf(tmp, "%s = error", expressions[i]);
-            } else {
-                sprintf(tmp, "%s = %g", expressions[i], result);
-            }
+    uint32_t expr_count = get_elements_count('\n', str);
+    double*  results = calloc(expr_count + 1, sizeof(double));
+    is_memory_allocated(results);
+    uint8_t* ok = calloc(expr_count + 1, sizeof(uint8_t));
+    is_memory_allocated(ok);
+    calc_expressions(expressions, expr_count, results, ok);
+
+    /* number format attributes don't turn on printing of expressions */
+    struct num_format fmt;
+    uint8_t fmt_attrs = get_num_format(attrs, &fmt);
+    uint8_t show_expr = (attrs != NULL && get_arr_size(attrs) > fmt_attrs);
+
+    struct str_buf result;
+    str_buf_init(&result, strlen(str) + expr_count * (uint64_t)16);
+    for ( uint32_t i=0; i<expr_count; i++ ) {
+        if ( show_expr ) {
+            str_buf_append(&result, expressions[i]);
+            str_buf_append(&result, " = ");
         }
 
-        uint16_t len = strlen(tmp) + 1;
-        res_len += len;
-        free(expressions[i]);
-        expressions[i] = calloc(len, sizeof(char));
-        is_memory_allocated(expressions[i]);
-        strcpy(expressions[i], tmp);
-        free(tmp);
-    }
+        if ( ok[i] )
+            str_buf_append_number(&result, results[i], &fmt);
+        else
+            str_buf_append(&result, "error");
 
-    result_str = calloc(res_len, sizeof(char));
-    is_memory_allocated(result_str);
-    for ( uint16_t i=0; i<expr_count; i++ ) {
-        strcat(result_str, expressions[i]);
         if ( i < expr_count - 1 )
-            strcat(result_str, "\n");
+            str_buf_append(&result, "\n");
         
         free(expressions[i]);
     }
 
     free(expressions);
-    return result_str;
+    free(results);
+    free(ok);
+    return result.data;
 }
 
 char* get_table(char* str, char** attrs)
 {
-    uint16_t  rows_count   = get_rows_count(str);
-    uint16_t* cells_in_row = get_cells_count(str);
-    char***   table_data   = get_table_data(str);
-
     uint8_t nb = in_str_array(attrs, "nb");/* no border */
     uint8_t nc = in_str_array(attrs, "nc");/* no calculations */
     uint8_t na = in_str_array(attrs, "na");/*don't align numbers to the right*/
@@ -350,142 +344,238 @@ char* get_table(char* str, char** attrs)
     if ( nb == 1 )
         na = 1;
 
+    /* large tables are read from a file in two passes, without calculations */
+    char* src = get_attr_value(attrs, "src");
+    if ( src != NULL ) {
+        /* the rows aren't kept in memory, only the layout applies */
+        struct num_format fmt;
+        if ( get_num_format(attrs, &fmt) > 0 )
+            print_error("rt, prec and ts don't apply to a table with src=");
+
+        if ( get_attr_value(attrs, "sort") != NULL )
+            print_error("sort= doesn't apply to a table with src=");
+
+        if ( get_attr_value(attrs, "join") != NULL )
+            print_error("join= doesn't apply to a table with src=");
+
+        return get_streamed_table(src, nb, na);
+    }
+
+    uint32_t  rows_count   = get_rows_count(str);
+    uint16_t* cells_in_row = get_cells_count(str);
+    struct table_cell** table_data = get_table_data(str);
+
+    struct num_format fmt;
+    get_num_format(attrs, &fmt);
+    struct table_sort sort;
+    struct table_join join;
+    uint8_t sorted = get_table_sort(attrs, &sort);
+    uint8_t joined = get_table_join(attrs, &join);
+    if ( sorted == 0 && joined == 0 )
+        return render_table(table_data, rows_count, cells_in_row, nb, na,
+                            (nc == 0) ? &fmt : NULL);
+
+    /* rows are joined and sorted after the calculations, so cell
+       references still point to the rows they were written for */
     if ( nc == 0 )
-        calc_in_table(table_data, rows_count, cells_in_row);
+        calc_in_table(table_data, rows_count, cells_in_row, &fmt);
 
-    align_to_columns(table_data, rows_count, cells_in_row, na);
-    uint16_t* rows_len     = get_rows_len(table_data, rows_count, cells_in_row);
-    uint16_t  max_row_len  = get_max_row_len(table_data, rows_count,
-                                             cells_in_row);
-    
-    if ( max_row_len < DOC_WIDTH - 2 )
-        max_row_len = DOC_WIDTH - 2;
+    if ( joined )
+        table_data = join_tables(table_data, &rows_count, &cells_in_row,
+                                 &join);
 
-    char* table = calloc(rows_count * (max_row_len + 3) + 1, sizeof(char));
-    is_memory_allocated(table);
+    if ( sorted )
+        sort_table(table_data, rows_count, cells_in_row, &sort);
 
-    for ( uint16_t i=0; i<rows_count; i++ ) {
-        if ( nb == 0 )
-            strcat(table, "|");
-        
-        uint16_t* cells_len = get_cells_len(table_data[i], cells_in_row[i]);
-        uint16_t  align     = max_row_len - rows_len[i];
-
-        while ( align > 0 ) {
-            uint16_t min_cell_i = get_min_index(cells_len, cells_in_row[i]);
-            char* al_str = calloc(strlen(table_data[i][min_cell_i]) + 2,
-                                  sizeof(char));
-            is_memory_allocated(al_str);
-            if ( is_number(table_data[i][min_cell_i], 2) && na == 0 ) {
-                strcat(al_str, " ");
-                strcat(al_str, table_data[i][min_cell_i]);
-            } else {
-                strcpy(al_str, table_data[i][min_cell_i]);
-                strcat(al_str, " ");
-            }
+    return render_table(table_data, rows_count, cells_in_row, nb, na, NULL);
+}
 
-            free(table_data[i][min_cell_i]);
-            table_data[i][min_cell_i] = al_str;
-            cells_len[min_cell_i]++;
-            align--;
-        }
+char* get_histogram(char* str, char** attrs)
+{
+    char  sym  = get_histogram_symbol(attrs);
+    char* bins = get_attr_value(attrs, "bins");
+    char* src  = get_attr_value(attrs, "src");
+    char* file_content = NULL;
+    uint64_t size = 0;
+
+    if ( bins != NULL ) {
+        /* raw samples, inline or from a file */
+        if ( src == NULL )
+            return get_binned_histogram(str, strlen(str), bins, sym);
+
+        char* data = map_file(src, &size);
+        if ( data == NULL )
+            return get_binned_histogram("", 0, bins, sym);
+
+        char* result = get_binned_histogram(data, size, bins, sym);
+        unmap_file(data, size);
+        return result;
+    }
 
-        for ( uint16_t j=0; j<cells_in_row[i]; j++ ) {
-            strcat(table, table_data[i][j]);
-            if ( nb == 0 ) {
-                strcat(table, "|");
-            } else {
-                strcat(table, " ");
-            }
-        }
+    if ( src != NULL ) {
+        file_content = get_file_content(src);
+        if ( file_content != NULL )
+            str = file_content;
+    }
+
+    uint32_t lines_count = get_elements_count('\n', str);
+    char** names = calloc(lines_count, sizeof(char*));
+    is_memory_allocated(names);
+    char** values = calloc(lines_count, sizeof(char*));
+    is_memory_allocated(values);
+    double* numbers = calloc(lines_count, sizeof(double));
+    is_memory_allocated(numbers);
+    get_histogram_data(str, names, values, numbers);
+    free(file_content);
 
-        strcat(table, "\n");
-        free(cells_len);
+    return render_histogram(names, values, numbers, lines_count, sym);
+}
+
+char* get_chart(char* str, char** attrs)
+{
+    /* a series of any length reduced to the width of the document */
+    char* src = get_attr_value(attrs, "src");
+    char* sym_attr = get_attr_value(attrs, "sym");
+    char* height_attr = get_attr_value(attrs, "height");
+    uint8_t bars = in_str_array(attrs, "bar");
+    char sym = (sym_attr != NULL && sym_attr[0] != '\0') ? sym_attr[0]
+                                                        : ((bars) ? '#' : '*');
+    uint16_t height = CHART_HEIGHT;
+    if ( height_attr != NULL ) {
+        if ( is_number(height_attr, 0) && atoi(height_attr) > 1 &&
+             atoi(height_attr) <= MAX_CHART_HEIGHT )
+            height = atoi(height_attr);
+        else
+            print_error("invalid chart height \"%s\"", height_attr);
     }
 
-    char* result = (nb == 0) ? add_table_border(table) : table;
-    /* Cleaning */
-    if ( nb == 0 )
-        free(table);
-    
-    for ( uint16_t i=0; i<rows_count; i++ ) {
-        for ( uint16_t j=0; j<cells_in_row[i]; j++ )
-            free(table_data[i][j]);
-        
-        free(table_data[i]);
+    struct num_format fmt;
+    get_num_format(attrs, &fmt);
+
+    struct chart_series cs;
+    uint64_t size = 0;
+    char* data = NULL;
+    if ( src != NULL ) {
+        data = map_file(src, &size);
+        get_chart_series((data != NULL) ? data : "", size, &cs);
+        if ( data != NULL )
+            unmap_file(data, size);
+    } else
+        get_chart_series(str, strlen(str), &cs);
+
+    if ( cs.invalid > 0 )
+        print_error("%lu chart values are not numbers",
+                    (unsigned long)cs.invalid);
+
+    if ( cs.samples == 0 ) {
+        print_error("the chart has no values");
+        free(cs.buckets);
+        char* empty = calloc(1, sizeof(char));
+        is_memory_allocated(empty);
+        return empty;
     }
 
-    free(table_data);
-    free(rows_len);
-    free(cells_in_row);
+    return render_chart(&cs, height, bars, sym, &fmt);
+}
 
+char* get_stats(char* str, char** attrs)
+{
+    /* count, sum, mean, stddev, variance, min, quantiles and max */
+    uint8_t nb = in_str_array(attrs, "nb");
+    char* src = get_attr_value(attrs, "src");
+    char* quantiles = get_attr_value(attrs, "p");
+    struct num_format fmt;
+    get_num_format(attrs, &fmt);
+
+    if ( src == NULL )
+        return get_stats_table(str, strlen(str), quantiles, nb, &fmt);
+
+    uint64_t size = 0;
+    char* data = map_file(src, &size);
+    if ( data == NULL )
+        return get_stats_table("", 0, quantiles, nb, &fmt);
+
+    char* result = get_stats_table(data, size, quantiles, nb, &fmt);
+    unmap_file(data, size);
     return result;
 }
 
-char* get_histogram(char* str, char** attrs)
+
+/***************************************************************************
+* Conditions
+***************************************************************************/
+char* set_var(char* str, char** attrs)
 {
-    char sym = '#';
+    /* <set name=expression>, earlier variables can be used */
+    char* def = join_attrs(attrs, 0);
+    char* expr = strchr(def, '=');
+    double value;
+    if ( expr == NULL )
+        print_error("no value for the variable \"%s\"", def);
+    else {
+        *expr++ = '\0';
+        if ( eval_doc_expr(expr, &value) == 0 )
+            print_error("invalid expression \"%s\"", expr);
+        else if ( set_doc_var(def, value) == 0 )
+            print_error("invalid variable \"%s\"", def);
+    }
 
-    if ( attrs != NULL ) {
-        if ( attrs[0] != NULL )
-            sym = attrs[0][0];
+    free(def);
+    char* empty = calloc(1, sizeof(char));
+    is_memory_allocated(empty);
+    return empty;
+}
+
+char* cond_block(char* str, char** attrs)
+{
+    /* the content is not executed before, so the tags of the skipped branch
+       are never run */
+    char* expr = join_attrs(attrs, 0);
+    double value = 0;
+    if ( eval_doc_expr(expr, &value) == 0 ) {
+        print_error("invalid condition \"%s\"", expr);
+        value = 0;
     }
 
-    uint16_t lines_count = get_elements_count('\n', str);
-    char** names = calloc(lines_count, sizeof(char*));
-    is_memory_allocated(names);
-    char** values = calloc(lines_count, sizeof(char*));
-    is_memory_allocated(values);
-    get_histogram_data(str, names, values);
-
-    uint32_t len = (DOC_WIDTH + 1) * lines_count;
-    char* histogram = calloc(len, sizeof(char));
-    is_memory_allocated(histogram);
-
-    char* tmp = NULL;
-    uint16_t max_name = get_max_len(names, lines_count);
-    double max_value = get_max_value(values, lines_count);
-    uint16_t max_value_len = get_max_len(values, lines_count);
-    uint16_t hist_width = DOC_WIDTH - max_name - max_value_len - 8;
-    double hist_sym = max_value / (double)(hist_width);
-
-    for ( uint16_t i=0; i<lines_count; i++ ) {
-        if ( strcmp(values[i], " ") != 0 ) {
-            char* al = get_str_from_sym(' ', max_name - strlen(names[i]));
-            tmp = calloc(DOC_WIDTH + 1, sizeof(char));
-            sprintf(tmp, " %s%s | ", al, names[i]);
-            free(al);
-            double v = 0;
-            char* tmp2 = calloc(strlen(values[i]) + 5, sizeof(char));
-            sprintf(tmp2, " | %s ", values[i]);
-            if ( is_number(values[i], 1) == 1 )
-                v = strtod(values[i], NULL);
-            
-            uint16_t hist_len = (uint16_t)round(v / (double)hist_sym);
-            char* h = get_str_from_sym(sym, hist_len);
-            strcat(tmp, h);
-            free(h);
-            h = get_str_from_sym(' ', hist_width - hist_len);
-            strcat(tmp, h);
-            strcat(tmp, tmp2);
-
-            free(h);
-            free(tmp2);
-        } else
-            strcat(histogram, "\n");
-        
-        strcat(histogram, tmp);
-        free(tmp);
-        free(names[i]);
-        free(values[i]);
-        
-        if ( i < lines_count - 1 )
-            strcat(histogram, "\n");
+    free(expr);
+    char* body = (strcmp(str, "\v") == 0) ? "" : str;
+    char* else_tag = find_else(body);
+    char* start = body;
+    char* end = (else_tag != NULL) ? else_tag : body + strlen(body);
+    if ( value == 0 ) {
+        start = (else_tag != NULL) ? else_tag + strlen("<else>") : end;
+        end = body + strlen(body);
     }
 
-    free(names);
-    free(values);
-    return histogram;
+    if ( start < end && *start == '\n' )
+        start++;
+
+    if ( start < end && end[-1] == '\n' )
+        end--;
+
+    char* branch = calloc(end - start + 1, sizeof(char));
+    is_memory_allocated(branch);
+    memcpy(branch, start, end - start);
+    char* result = execute_all_tags(branch);
+    free(branch);
+    return result;
+}
+
+
+/***************************************************************************
+* Macros
+***************************************************************************/
+char* define(char* str, char** attrs)
+{
+    /* <define name>body</define>; the body is not executed here */
+    if ( attrs == NULL )
+        puts("  Error defining a macro: name not specified");
+    else if ( add_macro(attrs[0], (strcmp(str, "\v") == 0) ? "" : str) == 0 )
+        print_error("can't define the macro \"%s\"", attrs[0]);
+
+    char* empty = calloc(1, sizeof(char));
+    is_memory_allocated(empty);
+    return empty;
 }
 
 
@@ -495,44 +585,171 @@ char* get_histogram(char* str, char** attrs)
 char* insert(char* str, char** attrs)
 {
     char* inserting_text = NULL;
-    uint64_t ins_len = 0;
     if ( attrs != NULL ) {
+        /* big files at the top level are copied by write_text(),
+           the others are read and escaped once, see get_cached_file() */
         uint16_t files_count = get_arr_size(attrs);
-        char** file_contents = calloc(files_count, sizeof(char*));
-        is_memory_allocated(file_contents);
+        struct str_buf result;
+        str_buf_init(&result, 256);
+        str_buf_append(&result, "\n");
         for ( uint16_t i=0; i<files_count; i++ ) {
-            if ( attrs[i] != NULL ) {
-                file_contents[i] = get_file_content(attrs[i]);
-                if ( file_contents[i] != NULL ) {
-                    change_symbols('<', '\f', file_contents[i]);
-                    change_symbols('>', '\a', file_contents[i]);
-                    ins_len += strlen(file_contents[i]);
-                }
-            } else 
-                file_contents[i] = NULL;
-        }
-
-        ins_len += files_count * 3;
-        inserting_text = calloc(ins_len, sizeof(char));
-        is_memory_allocated(inserting_text);
-        strcat(inserting_text, "\n");
-
-        for ( uint16_t i=0; i<files_count; i++ ) {
-            if ( file_contents[i] != NULL ) {
-                strcat(inserting_text, file_contents[i]);
-                strcat(inserting_text, "\n");
-                free(file_contents[i]);
+            struct table_stream* ts = open_file_stream(attrs[i]);
+            struct cached_file* cf = NULL;
+            if ( ts != NULL ) {
+                add_table_stream(ts, result.len);
+                str_buf_append(&result, "\n");
+            } else if ( (cf = get_cached_file(attrs[i], 1)) != NULL ) {
+                str_buf_append_n(&result, cf->text, cf->len);
+                str_buf_append(&result, "\n");
+                release_cached_file(cf);
             }
 
-            strcat(inserting_text, "\n");
+            str_buf_append(&result, "\n");
         }
 
-        free(file_contents);
+        inserting_text = result.data;
     } else {
-        puts("  Error inserting txt: file not specified");
+        print_error("no file to insert");
         inserting_text = calloc(2, sizeof(char));
         strcpy(inserting_text, "\n");
     }
     
     return inserting_text;
 }
+
+char* include(char* str, char** attrs)
+{
+    /* the fragment is formatted as a part of the document; only reading
+       its text is saved by the cache of inserted files, the tags are
+       executed on every include as they depend on the width, variables
+       and macros of the document at this point */
+    if ( attrs == NULL ) {
+        print_error("no fragment to include");
+        char* empty = calloc(1, sizeof(char));
+        is_memory_allocated(empty);
+        return empty;
+    }
+
+    struct cached_file* cf = get_cached_file(attrs[0], 0);
+    char* result = NULL;
+    if ( cf != NULL && push_include(cf) ) {
+        result = execute_all_tags(cf->text);
+        pop_include();
+    }
+
+    if ( cf != NULL )
+        release_cached_file(cf);
+
+    if ( result == NULL ) {
+        result = calloc(1, sizeof(char));
+        is_memory_allocated(result);
+    }
+
+    return result;
+}
+
+char* get_csv(char* str, char** attrs)
+{
+    if ( attrs == NULL || strchr(attrs[0], '=') != NULL ) {
+        print_error("no csv file to read");
+        char* empty = calloc(1, sizeof(char));
+        is_memory_allocated(empty);
+        return empty;
+    }
+
+    char* filename = attrs[0];
+    char  delim = get_csv_delim(attrs, filename);
+    uint64_t size;
+    char* data = map_file(filename, &size);
+    if ( data == NULL ) {
+        char* empty = calloc(1, sizeof(char));
+        is_memory_allocated(empty);
+        return empty;
+    }
+
+    struct csv_data csv;
+    parse_csv(data, size, delim, &csv);
+    char* result = NULL;
+    if ( in_str_array(attrs, "histogram") ) {
+        /* column numbers start from 1 */
+        char* sym    = get_attr_value(attrs, "sym");
+        char* names  = get_attr_value(attrs, "names");
+        char* values = get_attr_value(attrs, "values");
+        uint16_t name_col  = (names  != NULL && atoi(names)  > 0)
+                             ? atoi(names)  - 1 : 0;
+        uint16_t value_col = (values != NULL && atoi(values) > 0)
+                             ? atoi(values) - 1 : 1;
+        result = csv_to_histogram(data, &csv, in_str_array(attrs, "hdr"),
+                                  name_col, value_col,
+                                  (sym != NULL && sym[0] != '\0') ? sym[0]
+                                                                   : '#');
+    } else {
+        uint8_t nb = in_str_array(attrs, "nb");
+        uint8_t na = in_str_array(attrs, "na") || nb;
+        result = csv_to_table(data, &csv, nb, na);
+    }
+
+    free_csv_data(&csv);
+    unmap_file(data, size);
+    return result;
+}
+
+char* foreach(char* str, char** attrs)
+{
+    /* the content is not executed before; it is compiled once and then
+       filled and executed for every record of a CSV file */
+    if ( attrs == NULL || strchr(attrs[0], '=') != NULL ) {
+        print_error("no data file to read");
+        char* empty = calloc(1, sizeof(char));
+        is_memory_allocated(empty);
+        return empty;
+    }
+
+    uint64_t size;
+    char* data = map_file(attrs[0], &size);
+    if ( data == NULL ) {
+        char* empty = calloc(1, sizeof(char));
+        is_memory_allocated(empty);
+        return empty;
+    }
+
+    struct csv_data csv;
+    parse_csv(data, size, get_csv_delim(attrs, attrs[0]), &csv);
+    uint8_t hdr = in_str_array(attrs, "hdr") && csv.rows_count > 0;
+    uint16_t names_count = 0;
+    char** names = (hdr) ? get_csv_header(data, &csv, &names_count) : NULL;
+
+    struct template tpl;
+    compile_template((strcmp(str, "\v") == 0) ? "" : str, names, names_count,
+                     &tpl);
+    struct str_buf result, record;
+    str_buf_init(&result, size + 1);
+    str_buf_init(&record, 256);
+    for ( uint32_t i=hdr; i<csv.rows_count; i++ ) {
+        record.len = 0;
+        record.data[0] = '\0';
+        expand_template(&tpl, &record, data, &csv, i, i - hdr + 1);
+        if ( i > hdr )
+            str_buf_append(&result, "\n");
+
+        if ( tpl.has_tags ) {
+            /* nested tags see the record as their whole document */
+            tag_depth++;
+            char* done = execute_all_tags(record.data);
+            tag_depth--;
+            str_buf_append(&result, done);
+            free(done);
+        } else
+            str_buf_append_n(&result, record.data, record.len);
+    }
+
+    for ( uint16_t i=0; i<names_count; i++ )
+        free(names[i]);
+
+    free(names);
+    free(record.data);
+    free_template(&tpl);
+    free_csv_data(&csv);
+    unmap_file(data, size);
+    return result.data;
+}
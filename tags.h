@@ -40,9 +40,21 @@ char*  get_lines       (char* str, char** attrs);
 char*  calc            (char* str, char** attrs);
 char*  get_table       (char* str, char** attrs);
 char*  get_histogram   (char* str, char** attrs);
+char*  get_stats       (char* str, char** attrs);
+char*  get_chart       (char* str, char** attrs);
+
+/* conditions */
+char*  set_var         (char* str, char** attrs);
+char*  cond_block      (char* str, char** attrs);
+
+/* macros */
+char*  define          (char* str, char** attrs);
 
 /* files */
 char*  insert          (char* str, char** attrs);
+char*  include         (char* str, char** attrs);
+char*  get_csv         (char* str, char** attrs);
+char*  foreach         (char* str, char** attrs);
 
 
 #endif /* TAGS_H */
@@ -9,7 +9,8 @@
  */
 #include "tags_lib.h"
 
-uint8_t DOC_WIDTH = DEFAULT_DOC_WIDTH;
+__thread uint8_t DOC_WIDTH = DEFAULT_DOC_WIDTH;
+__thread FILE*   error_file = NULL;  /* errors of the tags, NULL - stdout */
 /***************************************************************************
 * functions for working with errors
 ***************************************************************************/
@@ -23,6 +24,9 @@ void exit_on_error(char* msg, void* ptr)
 
 void is_memory_allocated(void* mem_ptr)
 {
+    if ( profiling )
+        profile_allocs++;
+
     exit_on_error("Memory allocation error\n", mem_ptr);
 }
 
@@ -33,13 +37,30 @@ void is_directory_opened(void* dir_ptr)
 
 void print_file_error(char* filename)
 {
-    printf("  Error opening file \"%s\"\n", filename);
+    print_error("can't open file \"%s\"", filename);
+}
+
+void print_error(const char* format, ...)
+{
+    /* "  Error: <message>. Ignoring" for a tag that can't be executed */
+    FILE* file = (error_file != NULL) ? error_file : stdout;
+    va_list args;
+    va_start(args, format);
+    fputs("  Error: ", file);
+    vfprintf(file, format, args);
+    fputs(". Ignoring\n", file);
+    va_end(args);
+}
+
+void print_cell_error(char* cell)
+{
+    print_error("circular reference in table cell \"%s\"", cell);
 }
 
 void print_tag_error(char* tag)
 {
     char* tag_name = get_tag_name(tag);
-    printf("  Error: invalid tag \"%s\". Ignoring\n", tag_name);
+    print_error("invalid tag \"%s\"", tag_name);
     if ( tag_name != tag )
         free(tag_name);
 }
@@ -91,9 +112,46 @@ char** get_files_in_dir(char* dirname, char* file_extension)
     return  file_names;
 }
 
+/* set by txtfmt_render(), see struct txtfmt_options */
+__thread const char* const* doc_paths = NULL;
+__thread uint16_t           doc_paths_count = 0;
+
+void set_doc_paths(const char* const* paths, uint16_t count)
+{
+    doc_paths = paths;
+    doc_paths_count = count;
+}
+
+char* find_doc_file(char* filename)
+{
+    /* a relative name that is not in the current directory is looked up
+       in the document paths; the caller frees a result other than
+       filename */
+    if ( doc_paths_count == 0 || filename[0] == '/' ||
+         access(filename, F_OK) == 0 )
+        return filename;
+
+    for ( uint16_t i=0; i<doc_paths_count; i++ ) {
+        char* path = calloc(strlen(doc_paths[i]) + strlen(filename) + 2,
+                            sizeof(char));
+        is_memory_allocated(path);
+        sprintf(path, "%s/%s", doc_paths[i], filename);
+        if ( access(path, F_OK) == 0 )
+            return path;
+
+        free(path);
+    }
+
+    return filename;
+}
+
 char* get_file_content(char* filename)
 {
-    FILE *file = fopen(filename, "r");
+    char* path = find_doc_file(filename);
+    FILE *file = fopen(path, "r");
+    if ( path != filename )
+        free(path);
+
     if ( file == NULL ) {
         print_file_error(filename);
         return NULL;
@@ -125,6 +183,350 @@ void write_to_file(char* filename, char* str)
     fclose(file);
 }
 
+char* map_file(char* filename, uint64_t* size)
+{
+    /* read-only view of the whole file, NULL if it can't be opened */
+    *size = 0;
+    char* path = find_doc_file(filename);
+    note_used_file(path);
+    int fd = open(path, O_RDONLY);
+    if ( path != filename )
+        free(path);
+
+    if ( fd == -1 ) {
+        print_file_error(filename);
+        return NULL;
+    }
+
+    struct stat st;
+    char* data = NULL;
+    if ( fstat(fd, &st) == 0 && st.st_size > 0 ) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if ( data == MAP_FAILED ) {
+            print_file_error(filename);
+            data = NULL;
+        } else {
+            *size = st.st_size;
+            madvise(data, *size, MADV_SEQUENTIAL);
+        }
+    } else {
+        /* an empty file can't be mapped */
+        data = calloc(1, sizeof(char));
+        is_memory_allocated(data);
+    }
+
+    close(fd);
+    return data;
+}
+
+void unmap_file(char* data, uint64_t size)
+{
+    if ( size > 0 )
+        munmap(data, size);
+    else
+        free(data);
+}
+
+/* every thread formats its own document */
+__thread char**  used_files = NULL;
+__thread uint16_t used_files_count = 0;
+__thread uint8_t  tracking_files = 0;
+
+char* get_full_path(const char* filename)
+{
+    /* the real path of the directory and the name; the file itself may be
+       missing or replaced later */
+    const char* slash = strrchr(filename, '/');
+    char* dir = (slash == NULL) ? strdup(".") :
+                strndup(filename, (slash == filename) ? 1 : slash - filename);
+    is_memory_allocated(dir);
+    const char* name = (slash == NULL) ? filename : slash + 1;
+    char* real_dir = realpath(dir, NULL);
+    const char* base = (real_dir != NULL) ? real_dir : dir;
+    char* path = calloc(strlen(base) + strlen(name) + 2, sizeof(char));
+    is_memory_allocated(path);
+    sprintf(path, "%s/%s", strcmp(base, "/") == 0 ? "" : base, name);
+    free(real_dir);
+    free(dir);
+    return path;
+}
+
+void start_file_tracking(void)
+{
+    used_files = calloc(MAX_USED_FILES, sizeof(char*));
+    is_memory_allocated(used_files);
+    used_files_count = 0;
+    tracking_files = 1;
+}
+
+void note_used_file(const char* filename)
+{
+    if ( tracking_files == 0 || used_files_count == MAX_USED_FILES )
+        return;
+
+    char* path = get_full_path(filename);
+    for ( uint16_t i=0; i<used_files_count; i++ ) {
+        if ( strcmp(used_files[i], path) == 0 ) {
+            free(path);
+            return;
+        }
+    }
+
+    used_files[used_files_count++] = path;
+}
+
+char** stop_file_tracking(uint16_t* count)
+{
+    /* the caller frees the paths and the array */
+    char** files = used_files;
+    *count = used_files_count;
+    used_files = NULL;
+    used_files_count = 0;
+    tracking_files = 0;
+    return files;
+}
+
+/* shared by the worker threads of --merge, see struct insert_cache */
+struct insert_cache insert_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+uint64_t get_insert_cache_size(void)
+{
+    char* env = getenv("TXTFMT_CACHE_MB");
+    long mb = (env != NULL) ? atol(env) : INSERT_CACHE_SIZE;
+    return (mb > 0) ? (uint64_t)mb << 20 : 0;
+}
+
+void free_cached_file(struct cached_file* cf)
+{
+    free(cf->path);
+    free(cf->text);
+    free(cf);
+}
+
+void add_lru_file(struct cached_file* cf)
+{
+    /* the file becomes the newest one; insert_cache.lock is held */
+    cf->newer = NULL;
+    cf->older = insert_cache.newest;
+    if ( insert_cache.newest != NULL )
+        insert_cache.newest->newer = cf;
+    else
+        insert_cache.oldest = cf;
+
+    insert_cache.newest = cf;
+}
+
+void remove_lru_file(struct cached_file* cf)
+{
+    if ( cf->newer != NULL )
+        cf->newer->older = cf->older;
+    else
+        insert_cache.newest = cf->older;
+
+    if ( cf->older != NULL )
+        cf->older->newer = cf->newer;
+    else
+        insert_cache.oldest = cf->newer;
+
+    cf->newer = NULL;
+    cf->older = NULL;
+}
+
+void unlink_cached_file(struct cached_file** link)
+{
+    /* insert_cache.lock is held; the text may still be in use */
+    struct cached_file* cf = *link;
+    *link = cf->next;
+    remove_lru_file(cf);
+    insert_cache.bytes -= cf->len;
+    if ( cf->refs == 0 )
+        free_cached_file(cf);
+    else
+        cf->unlinked = 1;
+}
+
+uint8_t evict_cached_files(uint64_t len)
+{
+    /* the tail of the LRU list goes first; insert_cache.lock is held */
+    if ( len > insert_cache.max_bytes )
+        return 0;
+
+    while ( insert_cache.bytes + len > insert_cache.max_bytes ) {
+        struct cached_file* oldest = insert_cache.oldest;
+        unlink_cached_file(find_cached_file(oldest->path, oldest->escaped,
+                                            oldest->bucket));
+    }
+
+    return 1;
+}
+
+struct cached_file** find_cached_file(const char* filename, uint8_t escaped,
+                                      uint32_t bucket)
+{
+    struct cached_file** link = &insert_cache.buckets[bucket];
+    for ( ; *link != NULL; link = &(*link)->next ) {
+        if ( (*link)->escaped == escaped &&
+             strcmp((*link)->path, filename) == 0 )
+            return link;
+    }
+
+    return NULL;
+}
+
+uint8_t is_same_file(const struct cached_file* cf, const struct stat* st)
+{
+    return cf->dev == st->st_dev && cf->ino == st->st_ino &&
+           cf->size == st->st_size &&
+           cf->mtime.tv_sec == st->st_mtim.tv_sec &&
+           cf->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+struct cached_file* load_cached_file(char* filename, uint8_t escaped,
+                                     const struct stat* st)
+{
+    char* text = get_file_content(filename);
+    if ( text == NULL )
+        return NULL;
+
+    if ( escaped ) {
+        change_symbols('<', '\f', text);
+        change_symbols('>', '\a', text);
+    }
+
+    struct cached_file* cf = calloc(1, sizeof(struct cached_file));
+    is_memory_allocated(cf);
+    cf->path = strdup(filename);
+    is_memory_allocated(cf->path);
+    cf->escaped = escaped;
+    cf->dev = st->st_dev;
+    cf->ino = st->st_ino;
+    cf->mtime = st->st_mtim;
+    cf->size = st->st_size;
+    cf->text = text;
+    cf->len = strlen(text);
+    cf->refs = 1;
+    return cf;
+}
+
+struct cached_file* get_cached_file(char* filename, uint8_t escaped)
+{
+    /* the caller releases the file with release_cached_file() */
+    char* path = find_doc_file(filename);
+    struct cached_file* cf = get_cached_path(path, escaped);
+    if ( path != filename )
+        free(path);
+
+    return cf;
+}
+
+struct cached_file* get_cached_path(char* filename, uint8_t escaped)
+{
+    note_used_file(filename);
+    struct stat st;
+    if ( stat(filename, &st) != 0 ) {
+        print_file_error(filename);
+        return NULL;
+    }
+
+    uint32_t bucket = hash_key(filename, strlen(filename)) %
+                      INSERT_CACHE_BUCKETS;
+    pthread_mutex_lock(&insert_cache.lock);
+    if ( insert_cache.ready == 0 ) {
+        insert_cache.max_bytes = get_insert_cache_size();
+        insert_cache.ready = 1;
+    }
+
+    struct cached_file** link = find_cached_file(filename, escaped, bucket);
+    if ( link != NULL && is_same_file(*link, &st) ) {
+        struct cached_file* cf = *link;
+        cf->refs++;
+        remove_lru_file(cf);
+        add_lru_file(cf);
+        pthread_mutex_unlock(&insert_cache.lock);
+        return cf;
+    }
+
+    pthread_mutex_unlock(&insert_cache.lock);
+
+    /* the file is read without the lock */
+    struct cached_file* cf = load_cached_file(filename, escaped, &st);
+    if ( cf == NULL )
+        return NULL;
+
+    pthread_mutex_lock(&insert_cache.lock);
+    link = find_cached_file(filename, escaped, bucket);
+    if ( link != NULL && is_same_file(*link, &st) ) {
+        /* another thread has read it at the same time */
+        free_cached_file(cf);
+        cf = *link;
+        cf->refs++;
+        remove_lru_file(cf);
+        add_lru_file(cf);
+    } else {
+        if ( link != NULL )
+            unlink_cached_file(link);
+
+        if ( evict_cached_files(cf->len) ) {
+            cf->bucket = bucket;
+            cf->next = insert_cache.buckets[bucket];
+            insert_cache.buckets[bucket] = cf;
+            insert_cache.bytes += cf->len;
+            add_lru_file(cf);
+        } else
+            cf->unlinked = 1;
+    }
+
+    pthread_mutex_unlock(&insert_cache.lock);
+    return cf;
+}
+
+void release_cached_file(struct cached_file* cf)
+{
+    pthread_mutex_lock(&insert_cache.lock);
+    if ( --cf->refs == 0 && cf->unlinked )
+        free_cached_file(cf);
+
+    pthread_mutex_unlock(&insert_cache.lock);
+}
+
+void free_insert_cache(void)
+{
+    for ( uint32_t i=0; i<INSERT_CACHE_BUCKETS; i++ ) {
+        while ( insert_cache.buckets[i] != NULL )
+            unlink_cached_file(&insert_cache.buckets[i]);
+    }
+}
+
+/* fragments being included by this thread, the outermost first */
+__thread struct include_frame include_stack[MAX_INCLUDE_DEPTH];
+__thread uint8_t              include_depth = 0;
+
+uint8_t push_include(const struct cached_file* cf)
+{
+    if ( include_depth == MAX_INCLUDE_DEPTH ) {
+        print_error("\"%s\" is included deeper than %d levels", cf->path,
+                    MAX_INCLUDE_DEPTH);
+        return 0;
+    }
+
+    for ( uint8_t i=0; i<include_depth; i++ ) {
+        if ( include_stack[i].dev == cf->dev &&
+             include_stack[i].ino == cf->ino ) {
+            print_error("\"%s\" includes itself", cf->path);
+            return 0;
+        }
+    }
+
+    include_stack[include_depth].dev = cf->dev;
+    include_stack[include_depth++].ino = cf->ino;
+    return 1;
+}
+
+void pop_include(void)
+{
+    include_depth--;
+}
+
 char* change_file_extension(char* filename, char* extension)
 {
     char* result = calloc(strlen(filename) + strlen(extension)+1, sizeof(char));
@@ -142,17 +544,18 @@ char* change_file_extension(char* filename, char* extension)
 /***************************************************************************
 * functions for working with strings
 ***************************************************************************/
-uint16_t get_elements_count(char sym, char* str)
+uint32_t get_elements_count(char sym, char* str)
 {
-    uint16_t count = 0;
+    uint32_t count = 0;
     char* delims = calloc(3,  sizeof(char));
     is_memory_allocated(delims);
     sprintf(delims, "%c", sym);
     char* temp_str = strdup(str);
-    char* token = strtok(temp_str, delims);
+    char* save = NULL;
+    char* token = strtok_r(temp_str, delims, &save);
     while ( token != NULL ) {
         count++;
-        token = strtok(NULL, delims);
+        token = strtok_r(NULL, delims, &save);
     }
 
     free(delims);
@@ -165,17 +568,18 @@ char** split(char sym, char* str)
     char* delims = calloc(3, sizeof(char));
     is_memory_allocated(delims);
     sprintf(delims, "%c", sym);
-    uint16_t count = get_elements_count(sym, str);
+    uint32_t count = get_elements_count(sym, str);
     char** elements = (char**)calloc(count, sizeof(char*));
     is_memory_allocated(elements);
     char* temp_str = strdup(str);
     count = 0;
-    char* token = strtok(temp_str, delims);
+    char* save = NULL;
+    char* token = strtok_r(temp_str, delims, &save);
     while ( token != NULL ) {
         elements[count] = strdup(token);
         is_memory_allocated(elements[count]);
         count++;
-        token = strtok(NULL, delims);
+        token = strtok_r(NULL, delims, &save);
     }
 
     free(delims);
@@ -187,22 +591,14 @@ char* get_str_from_sym(char sym, uint16_t count)
 {
     char* str = calloc(count + 1, sizeof(char));
     is_memory_allocated(str);
-    char* symbol = calloc(2, sizeof(char));
-    is_memory_allocated(symbol);
-    sprintf(symbol, "%c", sym);
-    for ( uint16_t i=0; i<count; i++ )
-        strcat(str, symbol);
-    
-    free(symbol);
+    memset(str, sym, count);
     return str;
 }
 
 void change_symbols(char from, char to, char* str)
 {
-    for ( uint64_t i=0; i<strlen(str); i++ ) {
-        if ( str[i] == from )
-            str[i] = to;
-    }
+    while ( (str = strchr(str, from)) != NULL )
+        *str++ = to;
 }
 
 uint8_t is_number(char* str, uint8_t mode)
@@ -229,13 +625,93 @@ uint8_t is_number(char* str, uint8_t mode)
     return result;
 }
 
-uint16_t get_number_len(uint16_t number)
+uint8_t parse_number(const char* str, uint64_t len, double* value)
+{
+    /* one pass: ',' and '.' are decimal points, spaces are skipped */
+    static const double pow10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,
+                                    1e7,  1e8,  1e9,  1e10, 1e11, 1e12, 1e13,
+                                    1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+                                    1e21, 1e22 };
+    uint64_t mantissa = 0;
+    int32_t  exp10    = 0;
+    uint8_t  digits   = 0;  /* significant digits in the mantissa */
+    uint8_t  dropped  = 0;  /* nonzero digits that didn't fit */
+    uint8_t  point    = 0;
+    uint8_t  sign     = 0;
+    uint8_t  negative = 0;
+    uint8_t  valid    = 1;
+    uint8_t  any      = 0;
+    if ( len == 0 || str[0] == '\n' )
+        return PARSE_NOT_NUMBER;
+
+    for ( uint64_t i=0; i<len; i++ ) {
+        char c = str[i];
+        if ( (uint8_t)(c - '0') < 10 ) {
+            any = 1;
+            if ( digits < 19 ) {
+                mantissa = mantissa * 10 + (c - '0');
+                if ( mantissa != 0 )
+                    digits++;
+
+                if ( point )
+                    exp10--;
+            } else {
+                if ( !point )
+                    exp10++;
+
+                dropped |= (c != '0');
+            }
+        } else if ( c == '.' || c == ',' ) {
+            valid &= !point;
+            point = 1;
+        } else if ( c == '-' ) {
+            valid &= !(sign || any || point);
+            sign = 1;
+            negative = 1;
+        } else if ( c != ' ' )
+            return PARSE_NOT_NUMBER;
+    }
+
+    if ( !valid || !any )
+        return PARSE_NUMBER_LIKE;
+
+    if ( mantissa == 0 ) {
+        *value = (negative) ? -0.0 : 0.0;
+        return PARSE_NUMBER;
+    }
+
+    if ( !dropped && mantissa < (1ULL << 53) && exp10 >= -22 && exp10 <= 22 ) {
+        /* both operands are exact, so the result is correctly rounded */
+        *value = (exp10 < 0) ? (double)mantissa / pow10[-exp10]
+                             : (double)mantissa * pow10[exp10];
+    } else {
+        /* long numbers: strtod over the digits without spaces */
+        char* tmp = calloc(len + 1, sizeof(char));
+        is_memory_allocated(tmp);
+        uint64_t n = 0;
+        for ( uint64_t i=0; i<len; i++ ) {
+            if ( str[i] != ' ' && str[i] != '-' )
+                tmp[n++] = (str[i] == ',') ? '.' : str[i];
+        }
+
+        *value = strtod(tmp, NULL);
+        free(tmp);
+    }
+
+    if ( negative )
+        *value = -*value;
+
+    return PARSE_NUMBER;
+}
+
+uint16_t get_number_len(uint32_t number)
 {
-    char* num_str = calloc(20, sizeof(char));
-    is_memory_allocated(num_str);
-    sprintf(num_str, "%d", number);
-    uint16_t len = strlen(num_str);
-    free(num_str);
+    uint16_t len = 1;
+    while ( number >= 10 ) {
+        number /= 10;
+        len++;
+    }
+
     return len;
 }
 
@@ -268,9 +744,9 @@ char* rm_spaces_start_end(char* str)
         }
     }
 
-    for ( uint64_t i=strlen(str)-1; i>=0; i-- ) {
-        if ( str[i] != ' ' ) {
-            end = i;
+    for ( uint64_t i=strlen(str); i>0; i-- ) {
+        if ( str[i - 1] != ' ' ) {
+            end = i - 1;
             break;
         }
     }
@@ -286,485 +762,4152 @@ char* rm_spaces_start_end(char* str)
 
 
 /***************************************************************************
-* functions for Text Formatting
+* functions for working with string buffers
 ***************************************************************************/
-void set_doc_width(uint8_t width)
+void str_buf_init(struct str_buf* sb, uint64_t cap)
 {
-    if ( width < 10 ) {
-        printf("  Error: Document width cannot be less than 10 characters\n");
-        DOC_WIDTH = 10;
-    } else if ( width > 200 ) {
-        printf("  Error: Document width cannot be more than 250 characters\n");
-        DOC_WIDTH = 250;
-    } else {
-        DOC_WIDTH = width;
-    }
+    sb->cap  = (cap < 16) ? 16 : cap;
+    sb->len  = 0;
+    sb->data = calloc(sb->cap, sizeof(char));
+    is_memory_allocated(sb->data);
+}
+
+void str_buf_reserve(struct str_buf* sb, uint64_t extra)
+{
+    if ( sb->len + extra + 1 <= sb->cap )
+        return;
+
+    while ( sb->len + extra + 1 > sb->cap )
+        sb->cap *= 2;
+
+    sb->data = realloc(sb->data, sb->cap);
+    is_memory_allocated(sb->data);
+}
+
+void str_buf_append_n(struct str_buf* sb, const char* str, uint64_t n)
+{
+    str_buf_reserve(sb, n);
+    memcpy(&sb->data[sb->len], str, n);
+    sb->len += n;
+    sb->data[sb->len] = '\0';
+}
+
+void str_buf_append(struct str_buf* sb, const char* str)
+{
+    str_buf_append_n(sb, str, strlen(str));
+}
+
+void str_buf_append_sym(struct str_buf* sb, char sym, uint64_t count)
+{
+    str_buf_reserve(sb, count);
+    memset(&sb->data[sb->len], sym, count);
+    sb->len += count;
+    sb->data[sb->len] = '\0';
+}
+
+void str_buf_append_number(struct str_buf* sb, double value,
+                           const struct num_format* fmt)
+{
+    /* the number is written straight into the buffer */
+    str_buf_reserve(sb, NUMBER_STR_MAX);
+    sb->len += format_number(value, fmt, &sb->data[sb->len]);
+    sb->data[sb->len] = '\0';
 }
 
 
 /***************************************************************************
-* functions for working with arrays
+* functions for working with numbers
 ***************************************************************************/
-uint16_t get_arr_size(char** str_arr)
+/* Exact decimal digits of a double. The value is kept as a fraction r/s of
+   big integers, so the digits do not depend on the C library or the locale
+   and every digit is correct (Steele & White, Burger & Dybvig). */
+void bignum_set(struct bignum* b, uint64_t value)
 {
-    uint16_t count = 0;
-    while ( str_arr[count] != NULL )
-        count++;
-    
-    return count;
+    b->words[0] = (uint32_t)value;
+    b->words[1] = (uint32_t)(value >> 32);
+    b->len = (b->words[1] != 0) ? 2 : (b->words[0] != 0);
 }
 
-uint8_t in_str_array(char** arr, char* value)
+void bignum_mul(struct bignum* b, uint32_t factor)
 {
-    if ( arr == NULL )
-        return 0;
-
-    uint16_t arr_size = get_arr_size(arr);
-    for ( uint16_t i=0; i<arr_size; i++ ) {
-        if ( strcmp(arr[i], value) == 0 )
-            return 1;
+    uint64_t carry = 0;
+    for ( uint16_t i=0; i<b->len; i++ ) {
+        carry += (uint64_t)b->words[i] * factor;
+        b->words[i] = (uint32_t)carry;
+        carry >>= 32;
     }
 
-    return 0;
+    if ( carry != 0 )
+        b->words[b->len++] = (uint32_t)carry;
 }
 
-uint32_t get_max_len(char** str_arr, uint32_t arr_size)
+void bignum_mul_pow10(struct bignum* b, uint16_t power)
 {
-    uint32_t max_len = strlen(str_arr[0]);
-    for ( uint32_t i=0; i<arr_size; i++ ) {
-        if ( max_len < strlen(str_arr[i]) )
-            max_len = strlen(str_arr[i]);
-    }
+    for ( ; power >= 9; power -= 9 )
+        bignum_mul(b, 1000000000);
 
-    return max_len;
+    static const uint32_t pow10[] = { 1, 10, 100, 1000, 10000, 100000,
+                                      1000000, 10000000, 100000000 };
+    if ( power > 0 )
+        bignum_mul(b, pow10[power]);
 }
 
-uint16_t get_max(const uint16_t* arr, uint16_t size)
+void bignum_shift(struct bignum* b, uint16_t bits)
 {
-    uint16_t max = arr[0];
-    for ( uint16_t i=1; i<size; i++ ) {
-        if ( max < arr[i] )
-            max = arr[i];
+    uint16_t words = bits / 32;
+    bits %= 32;
+    if ( b->len == 0 )
+        return;
+
+    if ( bits != 0 ) {
+        b->words[b->len] = 0;
+        for ( int32_t i=b->len; i>0; i-- )
+            b->words[i] = (b->words[i] << bits)
+                          | (b->words[i - 1] >> (32 - bits));
+
+        b->words[0] <<= bits;
+        if ( b->words[b->len] != 0 )
+            b->len++;
     }
 
-    return max;
+    if ( words != 0 ) {
+        memmove(&b->words[words], &b->words[0], b->len * sizeof(uint32_t));
+        memset(&b->words[0], 0, words * sizeof(uint32_t));
+        b->len += words;
+    }
 }
 
-uint16_t get_min(const uint16_t* arr, uint16_t size)
+int8_t bignum_cmp(const struct bignum* a, const struct bignum* b)
 {
-    uint16_t min = arr[0];
-    for ( uint16_t i=1; i<size; i++ ) {
-        if ( min > arr[i] )
-            min = arr[i];
+    if ( a->len != b->len )
+        return (a->len > b->len) ? 1 : -1;
+
+    for ( int32_t i=a->len-1; i>=0; i-- ) {
+        if ( a->words[i] != b->words[i] )
+            return (a->words[i] > b->words[i]) ? 1 : -1;
     }
 
-    return min;
+    return 0;
 }
 
-int32_t get_index(const uint16_t* arr, uint16_t size, uint16_t value)
+void bignum_add(struct bignum* res, const struct bignum* a,
+                const struct bignum* b)
 {
-    int32_t index = -1;
-    for ( uint16_t i=0; i<size; i++ ) {
-        if ( value == arr[i] )
-            index = i;
+    uint16_t len = (a->len > b->len) ? a->len : b->len;
+    uint64_t carry = 0;
+    for ( uint16_t i=0; i<len; i++ ) {
+        carry += (uint64_t)((i < a->len) ? a->words[i] : 0)
+                 + ((i < b->len) ? b->words[i] : 0);
+        res->words[i] = (uint32_t)carry;
+        carry >>= 32;
     }
 
-    return index;
+    res->len = len;
+    if ( carry != 0 )
+        res->words[res->len++] = (uint32_t)carry;
 }
 
-uint16_t get_min_index(const uint16_t* arr, uint16_t size)
+/* a -= b, a >= b */
+void bignum_sub(struct bignum* a, const struct bignum* b)
 {
-    uint16_t min = get_min(arr, size);
-    uint16_t index = get_index(arr, size, min);
-    return index;
-}
+    int64_t borrow = 0;
+    for ( uint16_t i=0; i<a->len; i++ ) {
+        borrow += (int64_t)a->words[i] - ((i < b->len) ? b->words[i] : 0);
+        a->words[i] = (uint32_t)borrow;
+        borrow >>= 32;
+    }
 
+    while ( a->len > 0 && a->words[a->len - 1] == 0 )
+        a->len--;
+}
 
-/***************************************************************************
-* Basic functions for some tags
-***************************************************************************/
-char* get_aligned_text(char* str, char** attrs)
+/* next digit of r/s, r becomes the remainder */
+uint8_t bignum_next_digit(struct bignum* r, const struct bignum* s)
 {
-    char** lines = split('\n', str);
-    uint32_t lines_count = get_elements_count('\n', str);
-    uint32_t max_line = get_max_len(lines, lines_count);
-    uint32_t len = (max_line > DOC_WIDTH) ? max_line : DOC_WIDTH;
-    len = (len + 1) * lines_count;
-    char* aligned = calloc(len, sizeof(char));
-    is_memory_allocated(aligned);
-    for ( uint32_t i=0; i<lines_count; i++ ) {
-        uint16_t spaces = (strlen(lines[i]) > DOC_WIDTH) ? 0 \
-            : DOC_WIDTH - strlen(lines[i]);
-        if ( attrs == NULL )
-            spaces /= 2;
-        
-        char* al = get_str_from_sym(' ', spaces);
-        strcat(aligned, al);
-        free(al);
-        strcat(aligned, lines[i]);
-        spaces = DOC_WIDTH - strlen(lines[i]) - spaces;
-        al = get_str_from_sym(' ', spaces);
-        strcat(aligned, al);
-        free(lines[i]);
-        free(al);
-        if ( i < lines_count - 1 )
-            strcat(aligned, "\n");
+    uint8_t d = 0;
+    bignum_mul(r, 10);
+    while ( bignum_cmp(r, s) >= 0 ) {
+        bignum_sub(r, s);
+        d++;
     }
 
-    free(lines);
-    return aligned;
+    return d;
+}
+
+/* Grisu3 (Loitsch): the value and its neighbours are scaled by a cached
+   power of ten into 64-bit integers. That gives the digits of almost every
+   double with a few multiplications, and tells when the error of the
+   scaling could change them; then get_digits() uses the big integers. */
+struct diy_fp diy_fp_mul(struct diy_fp a, struct diy_fp b)
+{
+    /* the upper 64 bits of the product, rounded */
+    uint64_t a_hi = a.f >> 32, a_lo = a.f & 0xffffffff;
+    uint64_t b_hi = b.f >> 32, b_lo = b.f & 0xffffffff;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t mid = ((a_lo * b_lo) >> 32) + (hi_lo & 0xffffffff)
+                   + (lo_hi & 0xffffffff) + (1U << 31);
+    struct diy_fp res = { a_hi * b_hi + (hi_lo >> 32) + (lo_hi >> 32)
+                          + (mid >> 32), a.e + b.e + 64 };
+    return res;
+}
+
+struct diy_fp diy_fp_normalize(struct diy_fp a)
+{
+    while ( (a.f & (1ULL << 63)) == 0 ) {
+        a.f <<= 1;
+        a.e--;
+    }
+
+    return a;
+}
+
+struct diy_fp get_cached_pow10(int16_t min_e, int16_t* exp10)
+{
+    /* 10^exp10 for exp10 = -348, -340 ... 340 with 64-bit significands;
+       min_e is the smallest binary exponent the power may have */
+    static const struct { uint64_t f; int16_t e; int16_t exp10; } pow10[] = {
+    { 0xfa8fd5a0081c0288, -1220, -348 }, { 0xbaaee17fa23ebf76, -1193, -340 },
+    { 0x8b16fb203055ac76, -1166, -332 }, { 0xcf42894a5dce35ea, -1140, -324 },
+    { 0x9a6bb0aa55653b2d, -1113, -316 }, { 0xe61acf033d1a45df, -1087, -308 },
+    { 0xab70fe17c79ac6ca, -1060, -300 }, { 0xff77b1fcbebcdc4f, -1034, -292 },
+    { 0xbe5691ef416bd60c, -1007, -284 }, { 0x8dd01fad907ffc3c,  -980, -276 },
+    { 0xd3515c2831559a83,  -954, -268 }, { 0x9d71ac8fada6c9b5,  -927, -260 },
+    { 0xea9c227723ee8bcb,  -901, -252 }, { 0xaecc49914078536d,  -874, -244 },
+    { 0x823c12795db6ce57,  -847, -236 }, { 0xc21094364dfb5637,  -821, -228 },
+    { 0x9096ea6f3848984f,  -794, -220 }, { 0xd77485cb25823ac7,  -768, -212 },
+    { 0xa086cfcd97bf97f4,  -741, -204 }, { 0xef340a98172aace5,  -715, -196 },
+    { 0xb23867fb2a35b28e,  -688, -188 }, { 0x84c8d4dfd2c63f3b,  -661, -180 },
+    { 0xc5dd44271ad3cdba,  -635, -172 }, { 0x936b9fcebb25c996,  -608, -164 },
+    { 0xdbac6c247d62a584,  -582, -156 }, { 0xa3ab66580d5fdaf6,  -555, -148 },
+    { 0xf3e2f893dec3f126,  -529, -140 }, { 0xb5b5ada8aaff80b8,  -502, -132 },
+    { 0x87625f056c7c4a8b,  -475, -124 }, { 0xc9bcff6034c13053,  -449, -116 },
+    { 0x964e858c91ba2655,  -422, -108 }, { 0xdff9772470297ebd,  -396, -100 },
+    { 0xa6dfbd9fb8e5b88f,  -369,  -92 }, { 0xf8a95fcf88747d94,  -343,  -84 },
+    { 0xb94470938fa89bcf,  -316,  -76 }, { 0x8a08f0f8bf0f156b,  -289,  -68 },
+    { 0xcdb02555653131b6,  -263,  -60 }, { 0x993fe2c6d07b7fac,  -236,  -52 },
+    { 0xe45c10c42a2b3b06,  -210,  -44 }, { 0xaa242499697392d3,  -183,  -36 },
+    { 0xfd87b5f28300ca0e,  -157,  -28 }, { 0xbce5086492111aeb,  -130,  -20 },
+    { 0x8cbccc096f5088cc,  -103,  -12 }, { 0xd1b71758e219652c,   -77,   -4 },
+    { 0x9c40000000000000,   -50,    4 }, { 0xe8d4a51000000000,   -24,   12 },
+    { 0xad78ebc5ac620000,     3,   20 }, { 0x813f3978f8940984,    30,   28 },
+    { 0xc097ce7bc90715b3,    56,   36 }, { 0x8f7e32ce7bea5c70,    83,   44 },
+    { 0xd5d238a4abe98068,   109,   52 }, { 0x9f4f2726179a2245,   136,   60 },
+    { 0xed63a231d4c4fb27,   162,   68 }, { 0xb0de65388cc8ada8,   189,   76 },
+    { 0x83c7088e1aab65db,   216,   84 }, { 0xc45d1df942711d9a,   242,   92 },
+    { 0x924d692ca61be758,   269,  100 }, { 0xda01ee641a708dea,   295,  108 },
+    { 0xa26da3999aef774a,   322,  116 }, { 0xf209787bb47d6b85,   348,  124 },
+    { 0xb454e4a179dd1877,   375,  132 }, { 0x865b86925b9bc5c2,   402,  140 },
+    { 0xc83553c5c8965d3d,   428,  148 }, { 0x952ab45cfa97a0b3,   455,  156 },
+    { 0xde469fbd99a05fe3,   481,  164 }, { 0xa59bc234db398c25,   508,  172 },
+    { 0xf6c69a72a3989f5c,   534,  180 }, { 0xb7dcbf5354e9bece,   561,  188 },
+    { 0x88fcf317f22241e2,   588,  196 }, { 0xcc20ce9bd35c78a5,   614,  204 },
+    { 0x98165af37b2153df,   641,  212 }, { 0xe2a0b5dc971f303a,   667,  220 },
+    { 0xa8d9d1535ce3b396,   694,  228 }, { 0xfb9b7cd9a4a7443c,   720,  236 },
+    { 0xbb764c4ca7a44410,   747,  244 }, { 0x8bab8eefb6409c1a,   774,  252 },
+    { 0xd01fef10a657842c,   800,  260 }, { 0x9b10a4e5e9913129,   827,  268 },
+    { 0xe7109bfba19c0c9d,   853,  276 }, { 0xac2820d9623bf429,   880,  284 },
+    { 0x80444b5e7aa7cf85,   907,  292 }, { 0xbf21e44003acdd2d,   933,  300 },
+    { 0x8e679c2f5e44ff8f,   960,  308 }, { 0xd433179d9c8cb841,   986,  316 },
+    { 0x9e19db92b4e31ba9,  1013,  324 }, { 0xeb96bf6ebadf77d9,  1039,  332 },
+    { 0xaf87023b9bf0ee6b,  1066,  340 }
+    };
+
+    int16_t k = (int16_t)ceil((min_e + 63) * 0.30102999566398114);
+    uint16_t i = (348 + k - 1) / 8 + 1;
+    struct diy_fp res = { pow10[i].f, pow10[i].e };
+    *exp10 = pow10[i].exp10;
+    return res;
+}
+
+uint8_t round_weed(char* digits, uint8_t n, uint64_t dist, uint64_t delta,
+                   uint64_t rest, uint64_t ten_kappa, uint64_t unit)
+{
+    /* moves the last digit towards the value (dist is from the upper
+       bound), 0 if the error of unit units could change the result */
+    uint64_t small_dist = dist - unit;
+    uint64_t big_dist = dist + unit;
+    while ( rest < small_dist && delta - rest >= ten_kappa
+            && (rest + ten_kappa < small_dist
+                || small_dist - rest >= rest + ten_kappa - small_dist) ) {
+        digits[n - 1]--;
+        rest += ten_kappa;
+    }
+
+    if ( rest < big_dist && delta - rest >= ten_kappa
+         && (rest + ten_kappa < big_dist
+             || big_dist - rest > rest + ten_kappa - big_dist) )
+        return 0;
+
+    return 2 * unit <= rest && rest <= delta - 4 * unit;
+}
+
+uint8_t round_weed_counted(char* digits, uint8_t n, uint64_t rest,
+                           uint64_t ten_kappa, uint64_t unit, int16_t* kappa)
+{
+    /* rounds the last digit by the rest, 0 if the error could change it
+       (exact halves too, they are rounded to even by the big integers) */
+    if ( unit >= ten_kappa || ten_kappa - unit <= unit )
+        return 0;
+
+    if ( ten_kappa - rest > rest && ten_kappa - 2 * rest >= 2 * unit )
+        return 1;
+
+    if ( rest > unit && ten_kappa - (rest - unit) <= rest - unit ) {
+        digits[n - 1]++;
+        for ( uint8_t i=n-1; i>0 && digits[i] == '0' + 10; i-- ) {
+            digits[i] = '0';
+            digits[i - 1]++;
+        }
+
+        if ( digits[0] == '0' + 10 ) {
+            /* 999 -> 100, one more digit before the point */
+            digits[0] = '1';
+            (*kappa)++;
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+void get_grisu_parts(double value, struct diy_fp* w, struct diy_fp* low,
+                     struct diy_fp* high, int16_t* mk)
+{
+    /* w = value * 10^mk; low and high are the middles between the value
+       and its neighbours, scaled the same way, when they are wanted */
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    struct diy_fp v = { bits & ((1ULL << 52) - 1), (bits >> 52) & 0x7ff };
+    uint8_t boundary = (v.f == 0 && v.e > 1);
+    if ( v.e == 0 )
+        v.e = -1074;
+    else {
+        v.f |= 1ULL << 52;
+        v.e -= 1075;
+    }
+
+    *w = diy_fp_normalize(v);
+    struct diy_fp c = get_cached_pow10(GRISU_MIN_EXPONENT - (w->e + 64), mk);
+    *w = diy_fp_mul(*w, c);
+    if ( low == NULL )
+        return;
+
+    struct diy_fp plus = { (v.f << 1) + 1, v.e - 1 };
+    plus = diy_fp_normalize(plus);
+    struct diy_fp minus = { (v.f << 1) - 1, v.e - 1 };
+    if ( boundary ) {
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    }
+
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    *low = diy_fp_mul(minus, c);
+    *high = diy_fp_mul(plus, c);
+}
+
+uint32_t get_first_divisor(uint32_t integrals, int16_t* kappa)
+{
+    /* the biggest power of ten not above integrals, kappa - its digits */
+    uint32_t divisor = 1;
+    *kappa = 1;
+    while ( *kappa < 10 && integrals / divisor >= 10 ) {
+        divisor *= 10;
+        (*kappa)++;
+    }
+
+    return divisor;
+}
+
+uint8_t grisu_shortest(double value, char* digits, int16_t* exp10)
+{
+    struct diy_fp w, low, high;
+    int16_t mk;
+    get_grisu_parts(value, &w, &low, &high, &mk);
+
+    /* digits of the upper bound until the rest is inside the interval,
+       which is widened by the error of the scaling (unit) */
+    uint64_t unit = 1;
+    uint64_t too_high = high.f + unit;
+    uint64_t delta = too_high - (low.f - unit);
+    uint64_t dist = too_high - w.f;
+    uint16_t one_e = -w.e;
+    uint64_t one = 1ULL << one_e;
+    uint32_t integrals = too_high >> one_e;
+    uint64_t fractionals = too_high & (one - 1);
+    int16_t  kappa;
+    uint32_t divisor = get_first_divisor(integrals, &kappa);
+    uint8_t n = 0;
+    while ( kappa > 0 ) {
+        digits[n++] = '0' + integrals / divisor;
+        integrals %= divisor;
+        kappa--;
+        uint64_t rest = ((uint64_t)integrals << one_e) + fractionals;
+        if ( rest < delta ) {
+            *exp10 = n + kappa - mk;
+            return round_weed(digits, n, dist, delta, rest,
+                              (uint64_t)divisor << one_e, unit) ? n : 0;
+        }
+
+        divisor /= 10;
+    }
+
+    while ( 1 ) {
+        fractionals *= 10;
+        unit *= 10;
+        delta *= 10;
+        digits[n++] = '0' + (fractionals >> one_e);
+        fractionals &= one - 1;
+        kappa--;
+        if ( fractionals < delta ) {
+            *exp10 = n + kappa - mk;
+            return round_weed(digits, n, dist * unit, delta, fractionals,
+                              one, unit) ? n : 0;
+        }
+    }
+}
+
+uint8_t grisu_counted(double value, uint8_t mode, int16_t count,
+                      char* digits, int16_t* exp10)
+{
+    /* count digits (DIGITS_PRECISION) or the digits down to 10^-count
+       (DIGITS_FRACTION); the scaled value is off by one unit at most */
+    struct diy_fp w;
+    int16_t mk;
+    get_grisu_parts(value, &w, NULL, NULL, &mk);
+    uint64_t unit = 1;
+    uint16_t one_e = -w.e;
+    uint64_t one = 1ULL << one_e;
+    uint32_t integrals = w.f >> one_e;
+    uint64_t fractionals = w.f & (one - 1);
+    int16_t  kappa;
+    uint32_t divisor = get_first_divisor(integrals, &kappa);
+
+    /* the first digit is of 10^(kappa - mk - 1) */
+    if ( mode == DIGITS_FRACTION )
+        count += kappa - mk;
+
+    if ( count <= 0 || count >= NUMBER_STR_MAX )
+        return 0;
+
+    uint8_t n = 0;
+    while ( kappa > 0 && n < count ) {
+        digits[n++] = '0' + integrals / divisor;
+        integrals %= divisor;
+        kappa--;
+        if ( n < count )
+            divisor /= 10;
+    }
+
+    uint8_t ok;
+    if ( n == count ) {
+        uint64_t rest = ((uint64_t)integrals << one_e) + fractionals;
+        ok = round_weed_counted(digits, n, rest, (uint64_t)divisor << one_e,
+                                unit, &kappa);
+    } else {
+        while ( n < count && fractionals > unit ) {
+            fractionals *= 10;
+            unit *= 10;
+            digits[n++] = '0' + (fractionals >> one_e);
+            fractionals &= one - 1;
+            kappa--;
+        }
+
+        ok = n == count && round_weed_counted(digits, n, fractionals, one,
+                                              unit, &kappa);
+    }
+
+    *exp10 = n + kappa - mk;
+    return (ok) ? n : 0;
+}
+
+uint8_t get_digits(double value, uint8_t mode, int16_t count, char* digits,
+                   int16_t* exp10)
+{
+    /* value = 0.d1d2d3... * 10^exp10; count is the number of digits
+       (DIGITS_PRECISION) or of digits after the point (DIGITS_FRACTION) */
+    if ( value < 9007199254740992.0 && value == (double)(uint64_t)value ) {
+        /* whole numbers are exact, no need for big integers */
+        char tmp[20];
+        uint8_t len = 0;
+        for ( uint64_t u = (uint64_t)value; u > 0; u /= 10 )
+            tmp[len++] = '0' + u % 10;
+
+        if ( mode != DIGITS_PRECISION || len <= count ) {
+            for ( uint8_t i=0; i<len; i++ )
+                digits[i] = tmp[len - 1 - i];
+
+            *exp10 = len;
+            while ( mode == DIGITS_SHORTEST && len > 1
+                    && digits[len - 1] == '0' )
+                len--;
+
+            return len;
+        }
+    }
+
+    uint8_t n = (mode == DIGITS_SHORTEST)
+                ? grisu_shortest(value, digits, exp10)
+                : grisu_counted(value, mode, count, digits, exp10);
+    if ( n > 0 )
+        return n;
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t f = bits & ((1ULL << 52) - 1);
+    int16_t  e = (bits >> 52) & 0x7ff;
+    uint8_t  boundary = (f == 0 && e > 1);
+    if ( e == 0 )
+        e = -1074;
+    else {
+        f |= 1ULL << 52;
+        e -= 1075;
+    }
+
+    /* r/s = value, m_plus and m_minus - distances to the neighbours */
+    struct bignum r, s, m_plus, m_minus, tmp;
+    bignum_set(&r, f);
+    bignum_set(&s, 1);
+    bignum_set(&m_plus, 1);
+    bignum_set(&m_minus, 1);
+    uint16_t shift = (boundary) ? 2 : 1;
+    bignum_shift(&r, shift);
+    bignum_shift(&s, shift);
+    if ( boundary )
+        bignum_shift(&m_plus, 1);
+
+    if ( e >= 0 ) {
+        bignum_shift(&r, e);
+        bignum_shift(&m_plus, e);
+        bignum_shift(&m_minus, e);
+    } else
+        bignum_shift(&s, -e);
+
+    int16_t k = (int16_t)ceil(log10(value) - 1e-10);
+    if ( k >= 0 )
+        bignum_mul_pow10(&s, k);
+    else {
+        bignum_mul_pow10(&r, -k);
+        bignum_mul_pow10(&m_plus, -k);
+        bignum_mul_pow10(&m_minus, -k);
+    }
+
+    /* the estimate may be one too small */
+    uint8_t even = ((f & 1) == 0);
+    if ( mode == DIGITS_SHORTEST )
+        bignum_add(&tmp, &r, &m_plus);
+    else
+        tmp = r;
+
+    int8_t c = bignum_cmp(&tmp, &s);
+    if ( c > 0 || (c == 0 && (even || mode != DIGITS_SHORTEST)) ) {
+        bignum_mul(&s, 10);
+        k++;
+    }
+
+    *exp10 = k;
+    if ( mode == DIGITS_FRACTION ) {
+        /* less than half of the last digit */
+        if ( k + count < 0 )
+            return 0;
+
+        count += k;
+    }
+
+    n = 0;
+    if ( mode == DIGITS_SHORTEST ) {
+        while ( 1 ) {
+            uint8_t d = bignum_next_digit(&r, &s);
+            bignum_mul(&m_plus, 10);
+            bignum_mul(&m_minus, 10);
+            int8_t low_cmp = bignum_cmp(&r, &m_minus);
+            bignum_add(&tmp, &r, &m_plus);
+            int8_t high_cmp = bignum_cmp(&tmp, &s);
+            uint8_t low  = (low_cmp < 0 || (low_cmp == 0 && even));
+            uint8_t high = (high_cmp > 0 || (high_cmp == 0 && even));
+            if ( low && high ) {
+                /* both are close enough, take the nearest one */
+                tmp = r;
+                bignum_shift(&tmp, 1);
+                c = bignum_cmp(&tmp, &s);
+                if ( c > 0 || (c == 0 && (d & 1)) )
+                    d++;
+            } else if ( high )
+                d++;
+
+            digits[n++] = '0' + d;
+            if ( low || high )
+                break;
+        }
+    } else {
+        while ( n < count )
+            digits[n++] = '0' + bignum_next_digit(&r, &s);
+
+        /* round half to even by the rest of the value */
+        tmp = r;
+        bignum_shift(&tmp, 1);
+        c = bignum_cmp(&tmp, &s);
+        if ( c > 0 || (c == 0 && n > 0 && (digits[n - 1] & 1)) ) {
+            int16_t i = n - 1;
+            while ( i >= 0 && digits[i] == '9' )
+                digits[i--] = '0';
+
+            if ( i >= 0 )
+                digits[i]++;
+            else {
+                /* 999 -> 1000 */
+                digits[0] = '1';
+                if ( n == 0 )
+                    n = 1;
+
+                k++;
+            }
+        }
+    }
+
+    *exp10 = k;
+    return n;
+}
+
+uint16_t put_int_part(char* buf, const char* digits, int16_t count,
+                      char sep)
+{
+    /* digits of the integer part, grouped by three when sep is set */
+    uint16_t len = 0;
+    if ( count <= 0 ) {
+        buf[len++] = '0';
+        return len;
+    }
+
+    for ( int16_t i=0; i<count; i++ ) {
+        if ( sep != '\0' && i > 0 && (count - i) % 3 == 0 )
+            buf[len++] = sep;
+
+        buf[len++] = digits[i];
+    }
+
+    return len;
+}
+
+uint16_t put_number(char* buf, const char* digits, uint8_t n, int16_t exp10,
+                    uint8_t scientific, int16_t frac_len, char sep)
+{
+    /* 0.d1d2...dn * 10^exp10 */
+    uint16_t len = 0;
+    if ( scientific ) {
+        buf[len++] = digits[0];
+        if ( n > 1 ) {
+            buf[len++] = '.';
+            memcpy(&buf[len], &digits[1], n - 1);
+            len += n - 1;
+        }
+
+        int16_t x = exp10 - 1;
+        buf[len++] = 'e';
+        buf[len++] = (x < 0) ? '-' : '+';
+        x = (x < 0) ? -x : x;
+        if ( x >= 100 )
+            buf[len++] = '0' + x / 100;
+
+        buf[len++] = '0' + x / 10 % 10;
+        buf[len++] = '0' + x % 10;
+        return len;
+    }
+
+    /* fixed: digits before the point are padded by zeros */
+    char int_digits[NUMBER_STR_MAX];
+    int16_t int_count = (exp10 > 0) ? exp10 : 0;
+    for ( int16_t i=0; i<int_count; i++ )
+        int_digits[i] = (i < n) ? digits[i] : '0';
+
+    len += put_int_part(&buf[len], int_digits, int_count, sep);
+    if ( frac_len > 0 ) {
+        buf[len++] = '.';
+        for ( int16_t i=0; i<frac_len; i++ ) {
+            int16_t d = exp10 + i;
+            buf[len++] = (d >= 0 && d < n) ? digits[d] : '0';
+        }
+    }
+
+    return len;
+}
+
+uint16_t format_number(double value, const struct num_format* fmt, char* buf)
+{
+    uint16_t len = 0;
+    if ( signbit(value) )
+        buf[len++] = '-';
+
+    if ( isnan(value) || isinf(value) ) {
+        memcpy(&buf[len], isnan(value) ? "nan" : "inf", 4);
+        return len + 3;
+    }
+
+    value = fabs(value);
+    if ( value == 0 ) {
+        uint8_t frac = (fmt->mode == NUM_FIXED) ? fmt->precision : 0;
+        len += put_number(&buf[len], "0", 1, 1, 0, frac, '\0');
+        buf[len] = '\0';
+        return len;
+    }
+
+    char digits[NUMBER_STR_MAX];
+    int16_t exp10;
+    uint8_t n;
+    uint8_t mode = fmt->mode;
+    if ( mode == NUM_FIXED && value >= 1e21 )
+        mode = NUM_SHORTEST;
+
+    if ( mode == NUM_FIXED ) {
+        /* digits down to 10^-precision */
+        n = get_digits(value, DIGITS_FRACTION, fmt->precision, digits, &exp10);
+        if ( n == 0 ) {
+            n = 1;
+            digits[0] = '0';
+            exp10 = 1;
+        }
+
+        len += put_number(&buf[len], digits, n, exp10, 0, fmt->precision,
+                          fmt->thousands_sep);
+    } else {
+        uint8_t p = (mode == NUM_SHORTEST) ? 17 : fmt->precision;
+        if ( p == 0 )
+            p = 1;
+
+        n = get_digits(value, (mode == NUM_SHORTEST) ? DIGITS_SHORTEST
+                                                    : DIGITS_PRECISION,
+                       p, digits, &exp10);
+        while ( n > 1 && digits[n - 1] == '0' )
+            n--;
+
+        /* like %g: exponent form for very big and very small numbers */
+        int16_t x = exp10 - 1;
+        uint8_t scientific = (x < -4 || x >= p);
+        int16_t frac_len = n - exp10;
+        len += put_number(&buf[len], digits, n, exp10, scientific,
+                          (frac_len > 0) ? frac_len : 0, fmt->thousands_sep);
+    }
+
+    buf[len] = '\0';
+    return len;
+}
+
+uint8_t get_num_format(char** attrs, struct num_format* fmt)
+{
+    /* rt - shortest exact form, prec=N - N digits after the point,
+       ts[=c] - thousands separator (',' by default) */
+    fmt->mode = NUM_GENERAL;
+    fmt->precision = 6;
+    fmt->thousands_sep = '\0';
+    if ( attrs == NULL )
+        return 0;
+
+    uint8_t used = 0;
+    char* value = NULL;
+    if ( in_str_array(attrs, "rt") ) {
+        fmt->mode = NUM_SHORTEST;
+        used++;
+    }
+
+    if ( (value = get_attr_value(attrs, "prec")) != NULL ) {
+        if ( is_number(value, 0) ) {
+            fmt->mode = NUM_FIXED;
+            fmt->precision = (atoi(value) > 17) ? 17 : atoi(value);
+        }
+
+        used++;
+    }
+
+    if ( in_str_array(attrs, "ts") ) {
+        fmt->thousands_sep = ',';
+        used++;
+    } else if ( (value = get_attr_value(attrs, "ts")) != NULL ) {
+        fmt->thousands_sep = value[0];
+        used++;
+    }
+
+    return used;
+}
+
+
+/***************************************************************************
+* functions for Text Formatting
+***************************************************************************/
+void set_doc_width(uint8_t width)
+{
+    if ( width < 10 ) {
+        printf("  Error: Document width cannot be less than 10 characters\n");
+        DOC_WIDTH = 10;
+    } else if ( width > 200 ) {
+        printf("  Error: Document width cannot be more than 250 characters\n");
+        DOC_WIDTH = 250;
+    } else {
+        DOC_WIDTH = width;
+    }
+}
+
+
+/***************************************************************************
+* functions for working with arrays
+***************************************************************************/
+uint16_t get_arr_size(char** str_arr)
+{
+    uint16_t count = 0;
+    while ( str_arr[count] != NULL )
+        count++;
+    
+    return count;
+}
+
+uint8_t in_str_array(char** arr, char* value)
+{
+    if ( arr == NULL )
+        return 0;
+
+    uint16_t arr_size = get_arr_size(arr);
+    for ( uint16_t i=0; i<arr_size; i++ ) {
+        if ( strcmp(arr[i], value) == 0 )
+            return 1;
+    }
+
+    return 0;
+}
+
+char* get_attr_value(char** arr, char* name)
+{
+    /* value of the "name=value" attribute */
+    if ( arr == NULL )
+        return NULL;
+
+    uint16_t name_len = strlen(name);
+    uint16_t arr_size = get_arr_size(arr);
+    for ( uint16_t i=0; i<arr_size; i++ ) {
+        if ( strncmp(arr[i], name, name_len) == 0 && arr[i][name_len] == '=' )
+            return &arr[i][name_len + 1];
+    }
+
+    return NULL;
+}
+
+uint32_t get_max_len(char** str_arr, uint32_t arr_size)
+{
+    uint32_t max_len = 0;
+    for ( uint32_t i=0; i<arr_size; i++ ) {
+        if ( max_len < strlen(str_arr[i]) )
+            max_len = strlen(str_arr[i]);
+    }
+
+    return max_len;
+}
+
+uint16_t get_max(const uint16_t* arr, uint32_t size)
+{
+    uint16_t max = arr[0];
+    for ( uint32_t i=1; i<size; i++ ) {
+        if ( max < arr[i] )
+            max = arr[i];
+    }
+
+    return max;
+}
+
+uint16_t get_min(const uint16_t* arr, uint32_t size)
+{
+    uint16_t min = arr[0];
+    for ( uint32_t i=1; i<size; i++ ) {
+        if ( min > arr[i] )
+            min = arr[i];
+    }
+
+    return min;
+}
+
+int32_t get_index(const uint16_t* arr, uint16_t size, uint16_t value)
+{
+    int32_t index = -1;
+    for ( uint16_t i=0; i<size; i++ ) {
+        if ( value == arr[i] )
+            index = i;
+    }
+
+    return index;
+}
+
+uint16_t get_min_index(const uint16_t* arr, uint16_t size)
+{
+    uint16_t min = get_min(arr, size);
+    uint16_t index = get_index(arr, size, min);
+    return index;
+}
+
+
+/***************************************************************************
+* Basic functions for some tags
+***************************************************************************/
+char* get_aligned_text(char* str, char** attrs)
+{
+    char** lines = split('\n', str);
+    uint32_t lines_count = get_elements_count('\n', str);
+    uint32_t max_line = get_max_len(lines, lines_count);
+    uint32_t len = (max_line > DOC_WIDTH) ? max_line : DOC_WIDTH;
+    struct str_buf aligned;
+    str_buf_init(&aligned, (uint64_t)(len + 1) * lines_count + 1);
+    for ( uint32_t i=0; i<lines_count; i++ ) {
+        uint32_t line_len = strlen(lines[i]);
+        uint16_t spaces = (line_len > DOC_WIDTH) ? 0 : DOC_WIDTH - line_len;
+        if ( attrs == NULL )
+            spaces /= 2;
+
+        str_buf_append_sym(&aligned, ' ', spaces);
+        str_buf_append_n(&aligned, lines[i], line_len);
+        /* lines longer than the document are left as they are */
+        spaces = (line_len + spaces < DOC_WIDTH) ?
+                 DOC_WIDTH - line_len - spaces : 0;
+        str_buf_append_sym(&aligned, ' ', spaces);
+        free(lines[i]);
+        if ( i < lines_count - 1 )
+            str_buf_append_n(&aligned, "\n", 1);
+    }
+
+    free(lines);
+    return aligned.data;
 }
 
 char* header(char* str, uint8_t header_type, char** attrs)
 {
-    char sep_sym = '\0';
-    if ( attrs != NULL ) {
-        if ( attrs[0] != NULL )
-            sep_sym = attrs[0][0];
+    char sep_sym = '\0';
+    if ( attrs != NULL ) {
+        if ( attrs[0] != NULL )
+            sep_sym = attrs[0][0];
+    }
+
+    if ( header_type == 1 && sep_sym == '\0' )
+        sep_sym = '=';
+    
+    uint8_t doc_width_bak = DOC_WIDTH;
+    if ( DOC_WIDTH < strlen(str) )
+        set_doc_width(strlen(str) + 4);
+    
+    char* header = NULL;
+    uint16_t len = DOC_WIDTH + 1;
+    if ( header_type == 1 ) {
+        char* centered_str = center(str, NULL);
+        len = DOC_WIDTH * 2 + strlen(centered_str) + 3;
+        header = calloc(len, sizeof(char));
+        is_memory_allocated(header);
+        char* tmp = get_str_from_sym(sep_sym, DOC_WIDTH);
+        sprintf(header, "%s\n%s\n%s", tmp, centered_str, tmp);
+        free(tmp);
+        free(centered_str);
+    } else {
+        header = calloc(len, sizeof(char));
+        is_memory_allocated(header);
+        if ( sep_sym == '\0' )
+            sep_sym = (header_type == 2) ? '=' : '-';
+        
+        char* tmp = get_str_from_sym(sep_sym, (DOC_WIDTH-strlen(str) - 1) / 2);
+        sprintf(header, "%s %s ", tmp, str);
+        free(tmp);
+        tmp = get_str_from_sym(sep_sym, DOC_WIDTH - strlen(header));
+        strcat(header, tmp);
+        free(tmp);
+    }
+
+    set_doc_width(doc_width_bak);
+    return header;
+}
+
+/***************************************************************************
+* functions for calculations
+***************************************************************************/
+/* every thread formats its own document */
+__thread uint8_t        doc_uses_time = 0;
+__thread time_t         doc_time = 0;
+__thread struct doc_var doc_vars[MAX_DOC_VARS];
+__thread uint16_t       doc_vars_count = 0;
+
+void calc_expressions_range(void* ctx, uint32_t start, uint32_t end)
+{
+    struct calc_batch* batch = ctx;
+    for ( uint32_t i=start; i<end; i++ ) {
+        int error;
+        batch->results[i] = te_interp(batch->exprs[i], &error);
+        batch->ok[i] = (error == 0);
+    }
+}
+
+void calc_expressions(char** exprs, uint32_t count, double* results,
+                      uint8_t* ok)
+{
+    /* expressions are independent, big batches are split between threads */
+    struct calc_batch batch = { exprs, results, ok };
+    run_parallel(calc_expressions_range, &batch, count, PARALLEL_MIN_ITEMS);
+}
+
+/* "<" and ">" close a tag, so comparisons are functions: gt(x, 10) */
+double expr_gt(double a, double b)  { return a > b; }
+double expr_ge(double a, double b)  { return a >= b; }
+double expr_lt(double a, double b)  { return a < b; }
+double expr_le(double a, double b)  { return a <= b; }
+double expr_eq(double a, double b)  { return a == b; }
+double expr_ne(double a, double b)  { return a != b; }
+double expr_and(double a, double b) { return a != 0 && b != 0; }
+double expr_or(double a, double b)  { return a != 0 || b != 0; }
+double expr_not(double a)           { return a == 0; }
+
+void clear_doc_vars(void)
+{
+    doc_vars_count = 0;
+}
+
+uint8_t set_doc_var(const char* name, double value)
+{
+    uint32_t len = strlen(name);
+    if ( len == 0 || len >= DOC_VAR_NAME_LEN ||
+         !isalpha((unsigned char)name[0]) )
+        return 0;
+
+    for ( uint32_t i=0; i<len; i++ ) {
+        if ( !isalnum((unsigned char)name[i]) && name[i] != '_' )
+            return 0;
+    }
+
+    for ( uint16_t i=0; i<doc_vars_count; i++ ) {
+        if ( strcmp(doc_vars[i].name, name) == 0 ) {
+            doc_vars[i].value = value;
+            return 1;
+        }
+    }
+
+    if ( doc_vars_count == MAX_DOC_VARS )
+        return 0;
+
+    strcpy(doc_vars[doc_vars_count].name, name);
+    doc_vars[doc_vars_count++].value = value;
+    return 1;
+}
+
+uint8_t eval_doc_expr(const char* expr, double* result)
+{
+    /* the variables are bound by address, a later <set> of the same name
+       changes the value in place */
+    const te_variable funcs[] = {
+        { "gt",  expr_gt,  TE_FUNCTION2 | TE_FLAG_PURE, NULL },
+        { "ge",  expr_ge,  TE_FUNCTION2 | TE_FLAG_PURE, NULL },
+        { "lt",  expr_lt,  TE_FUNCTION2 | TE_FLAG_PURE, NULL },
+        { "le",  expr_le,  TE_FUNCTION2 | TE_FLAG_PURE, NULL },
+        { "eq",  expr_eq,  TE_FUNCTION2 | TE_FLAG_PURE, NULL },
+        { "ne",  expr_ne,  TE_FUNCTION2 | TE_FLAG_PURE, NULL },
+        { "and", expr_and, TE_FUNCTION2 | TE_FLAG_PURE, NULL },
+        { "or",  expr_or,  TE_FUNCTION2 | TE_FLAG_PURE, NULL },
+        { "not", expr_not, TE_FUNCTION1 | TE_FLAG_PURE, NULL }
+    };
+    const uint16_t funcs_count = sizeof(funcs) / sizeof(funcs[0]);
+    te_variable vars[MAX_DOC_VARS + sizeof(funcs) / sizeof(funcs[0])];
+    memcpy(vars, funcs, sizeof(funcs));
+    for ( uint16_t i=0; i<doc_vars_count; i++ ) {
+        vars[funcs_count + i].name = doc_vars[i].name;
+        vars[funcs_count + i].address = &doc_vars[i].value;
+        vars[funcs_count + i].type = TE_VARIABLE;
+        vars[funcs_count + i].context = NULL;
+    }
+
+    int error;
+    te_expr* compiled = te_compile(expr, vars, funcs_count + doc_vars_count,
+                                   &error);
+    if ( compiled == NULL )
+        return 0;
+
+    *result = te_eval(compiled);
+    te_free(compiled);
+    return !isnan(*result);
+}
+
+char* join_attrs(char** attrs, uint16_t first)
+{
+    /* attributes are split by spaces, an expression may have them */
+    struct str_buf sb;
+    str_buf_init(&sb, 64);
+    for ( uint16_t i=first; attrs != NULL && attrs[i] != NULL; i++ ) {
+        if ( i > first )
+            str_buf_append(&sb, " ");
+
+        str_buf_append(&sb, attrs[i]);
+    }
+
+    return sb.data;
+}
+
+
+/***************************************************************************
+* functions for working with tables
+***************************************************************************/
+uint32_t get_rows_count(char* tbl_str)
+{
+    return get_elements_count('\n', tbl_str);
+}
+
+uint16_t* get_cells_count(char* tbl_str)
+{
+    uint32_t  rows_count   = get_rows_count(tbl_str);
+    uint16_t* cells_in_row = calloc(rows_count, sizeof(uint16_t));
+    is_memory_allocated(cells_in_row);
+    char** rows = split('\n', tbl_str);
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        cells_in_row[i] = get_elements_count('|', rows[i]);
+        free(rows[i]);
+    }
+
+    free(rows);
+    return cells_in_row;
+}
+
+void set_cell_text(struct table_cell* cell, char* text)
+{
+    /* the cell takes the string; its number is parsed once, here */
+    cell->text = text;
+    cell->len  = strlen(text);
+    cell->kind = parse_number(text, cell->len, &cell->value);
+    if ( cell->kind != PARSE_NUMBER )
+        cell->value = NAN;
+}
+
+struct table_cell** get_table_data(char* tbl_str)
+{
+    uint32_t  rows_count   = get_rows_count(tbl_str);
+    char**    rows         = split('\n', tbl_str);
+    struct table_cell** table_data = calloc(rows_count,
+                                            sizeof(struct table_cell*));
+    is_memory_allocated(table_data);
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        uint16_t cells_count = get_elements_count('|', rows[i]);
+        char** cells = split('|', rows[i]);
+        table_data[i] = calloc(cells_count + 1, sizeof(struct table_cell));
+        is_memory_allocated(table_data[i]);
+        for ( uint16_t j=0; j<cells_count; j++ )
+            set_cell_text(&table_data[i][j], cells[j]);
+
+        free(cells);
+        free(rows[i]);
+    }
+
+    free(rows);
+    return table_data;
+}
+
+void free_table_data(struct table_cell** table_data, uint32_t rows_count,
+                     const uint16_t* cells_in_row)
+{
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        for ( uint16_t j=0; j<cells_in_row[i]; j++ )
+            free(table_data[i][j].text);
+
+        free(table_data[i]);
+    }
+
+    free(table_data);
+}
+
+uint16_t* get_cells_len(struct table_cell* row, uint16_t cells_count)
+{
+    uint16_t* cells_len = calloc(cells_count, sizeof(uint16_t));
+    is_memory_allocated(cells_len);
+    for ( uint16_t i=0; i<cells_count; i++ )
+        cells_len[i] = row[i].len;
+
+    return cells_len;
+}
+
+uint16_t* get_rows_len(struct table_cell** table_data, uint32_t rows_count,
+                       const uint16_t* cells_in_row)
+{
+    uint16_t* rows_len = calloc(rows_count, sizeof(uint16_t));
+    is_memory_allocated(rows_len);
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        uint16_t row_len = 0;
+        for ( uint16_t j=0; j<cells_in_row[i]; j++ )
+            row_len += table_data[i][j].len;
+
+        rows_len[i] = row_len + cells_in_row[i] - 1;
+    }
+
+    return rows_len;
+}
+
+char* get_table_border(const char* row1, const char* row2)
+{
+    uint16_t row_len = strlen(row1);
+    char* border = calloc(row_len + 1, sizeof(char));
+    is_memory_allocated(border);
+    for ( uint16_t i=0; i<row_len; i++ )
+        border[i] = ( row1[i] == '|' || row2[i] == '|' ) ? '+' : '-';
+
+    return border;
+}
+
+char* add_table_border(char* table_str)
+{
+    char**   rows = split('\n', table_str);
+    uint32_t rows_count = get_rows_count(table_str);
+    uint16_t row_len = strlen(rows[0]);
+    struct str_buf table;
+    str_buf_init(&table, (rows_count * 2 + 1) * (uint64_t)(row_len + 1));
+    char* space_str = get_str_from_sym(' ', row_len);
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        char* row1 = (i == 0) ? space_str : rows[i - 1];
+        char* border = get_table_border(row1, rows[i]);
+        str_buf_append(&table, border);
+        str_buf_append(&table, "\n");
+        str_buf_append(&table, rows[i]);
+        str_buf_append(&table, "\n");
+        free(border);
+        if ( i == rows_count - 1 ) {
+            border = get_table_border(rows[i], space_str);
+            str_buf_append(&table, border);
+            free(border);
+        }
+    }
+    /* Cleaning */
+    for ( uint32_t i=0; i<rows_count; i++ )
+        free(rows[i]);
+
+    free(rows);
+    free(space_str);
+
+    return table.data;
+}
+
+uint8_t get_cell_ref(const char* str, uint32_t pos, struct cell_ref* ref)
+{
+    static const char funcs[][4] = { "SUM", "AVG", "MIN", "MAX" };
+    if ( pos > 0 && (isalnum(str[pos - 1]) || str[pos - 1] == '_'
+        || str[pos - 1] == '.') )
+        return 0;
+
+    uint32_t i = pos;
+    ref->func = REF_CELL;
+    for ( uint8_t f=0; f<4; f++ ) {
+        if ( strncmp(&str[i], funcs[f], 3) == 0 && str[i + 3] == '(' ) {
+            ref->func = f + 1;
+            i += 4;
+            break;
+        }
+    }
+
+    /* one cell or the first cell of a range */
+    uint32_t row[2] = { 0, 0 };
+    uint16_t col[2] = { 0, 0 };
+    for ( uint8_t k=0; k<2; k++ ) {
+        while ( ref->func != REF_CELL && str[i] == ' ' )
+            i++;
+
+        uint8_t letters = 0;
+        while ( isupper(str[i]) && letters < 3 ) {
+            col[k] = col[k] * 26 + (str[i] - 'A' + 1);
+            letters++;
+            i++;
+        }
+
+        if ( letters == 0 || !isdigit(str[i]) )
+            return 0;
+
+        while ( isdigit(str[i]) ) {
+            row[k] = row[k] * 10 + (str[i] - '0');
+            if ( row[k] > UINT16_MAX )
+                return 0;
+
+            i++;
+        }
+
+        if ( row[k] == 0 )
+            return 0;
+
+        if ( ref->func == REF_CELL ) {
+            if ( isalnum(str[i]) || str[i] == '_' || str[i] == '(' )
+                return 0;
+
+            row[1] = row[0];
+            col[1] = col[0];
+            break;
+        }
+
+        while ( str[i] == ' ' )
+            i++;
+
+        if ( k == 0 && str[i] != ':' )
+            return 0;
+
+        if ( k == 1 && str[i] != ')' )
+            return 0;
+
+        i++;
+    }
+
+    /* A1 is stored as row 0, column 0 */
+    ref->row1 = ((row[0] < row[1]) ? row[0] : row[1]) - 1;
+    ref->row2 = ((row[0] < row[1]) ? row[1] : row[0]) - 1;
+    ref->col1 = ((col[0] < col[1]) ? col[0] : col[1]) - 1;
+    ref->col2 = ((col[0] < col[1]) ? col[1] : col[0]) - 1;
+    ref->len  = i - pos;
+    return 1;
+}
+
+char* get_cell_name(uint32_t row, uint16_t col)
+{
+    char* name = calloc(12, sizeof(char));
+    is_memory_allocated(name);
+    char letters[4] = { 0 };
+    uint8_t n = 0;
+    uint32_t c = col + 1;
+    while ( c > 0 && n < 3 ) {
+        letters[n++] = 'A' + (c - 1) % 26;
+        c = (c - 1) / 26;
+    }
+
+    for ( uint8_t i=0; i<n; i++ )
+        name[i] = letters[n - 1 - i];
+
+    sprintf(&name[n], "%u", row + 1);
+    return name;
+}
+
+uint8_t get_range_value(const double* values, uint32_t rows_count,
+                        const struct cell_ref* ref, double* result)
+{
+    double   acc   = 0;
+    uint32_t count = 0;
+    if ( ref->func == REF_MIN )
+        acc = INFINITY;
+    else if ( ref->func == REF_MAX )
+        acc = -INFINITY;
+
+    /* values are stored by columns, so every range is a few flat loops */
+    for ( uint32_t j=ref->col1; j<=ref->col2; j++ ) {
+        const double* column = &values[j * rows_count];
+        for ( uint32_t i=ref->row1; i<=ref->row2; i++ ) {
+            double v = column[i];
+            if ( isnan(v) )
+                continue;
+
+            if ( ref->func == REF_MIN )
+                acc = (v < acc) ? v : acc;
+            else if ( ref->func == REF_MAX )
+                acc = (v > acc) ? v : acc;
+            else
+                acc += v;
+
+            count++;
+        }
+    }
+
+    if ( count == 0 && ref->func != REF_SUM )
+        return 0;
+
+    *result = (ref->func == REF_AVG) ? acc / count : acc;
+    return 1;
+}
+
+uint8_t eval_cell_expr(const char* expr, const double* values,
+                       uint32_t rows_count, uint16_t max_cells, double* result)
+{
+    /* every reference is replaced by its value: "(%.17g)" */
+    uint32_t len = strlen(expr);
+    char* sub_expr = calloc(len * 14 + 32, sizeof(char));
+    is_memory_allocated(sub_expr);
+    uint32_t out = 0;
+    struct cell_ref ref;
+    for ( uint32_t i=0; i<len; ) {
+        if ( get_cell_ref(expr, i, &ref) == 0 ) {
+            sub_expr[out++] = expr[i++];
+            continue;
+        }
+
+        double v = NAN;
+        if ( ref.row2 >= rows_count || ref.col2 >= max_cells ) {
+            free(sub_expr);
+            return 0;
+        }
+
+        if ( ref.func == REF_CELL )
+            v = values[ref.col1 * rows_count + ref.row1];
+        else if ( get_range_value(values, rows_count, &ref, &v) == 0 )
+            v = NAN;
+
+        if ( isnan(v) ) {
+            free(sub_expr);
+            return 0;
+        }
+
+        out += sprintf(&sub_expr[out], "(%.17g)", v);
+        i += ref.len;
+    }
+
+    int error;
+    *result = te_interp(sub_expr, &error);
+    free(sub_expr);
+    return error == 0;
+}
+
+void calc_in_table(struct table_cell** table_data, uint32_t rows_count,
+                   const uint16_t* cells_in_row, const struct num_format* fmt)
+{
+    uint16_t max_cells   = get_max(cells_in_row, rows_count);
+    uint32_t cells_count = (uint32_t)rows_count * max_cells;
+
+    /* cell (i, j) has index j * rows_count + i */
+    char**   exprs  = calloc(cells_count, sizeof(char*));
+    is_memory_allocated(exprs);
+    double*  values = calloc(cells_count, sizeof(double));
+    is_memory_allocated(values);
+    uint8_t* state  = calloc(cells_count, sizeof(uint8_t));
+    is_memory_allocated(state);
+    for ( uint32_t k=0; k<cells_count; k++ )
+        values[k] = NAN;
+
+    /* cells without references are evaluated right away, in one batch;
+       plain numbers are already parsed */
+    struct cell_ref ref;
+    uint32_t pending = 0;
+    uint32_t plain = 0;
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        for ( uint16_t j=0; j<cells_in_row[i]; j++ ) {
+            uint32_t k = (uint32_t)j * rows_count + i;
+            struct table_cell* cell = &table_data[i][j];
+            if ( cell->kind == PARSE_NUMBER
+                 && memchr(cell->text, ' ', cell->len) == NULL ) {
+                values[k] = cell->value;
+                state[k] = CELL_NUMBER;
+                continue;
+            }
+
+            char* tmp = calloc(cell->len + 1, sizeof(char));
+            is_memory_allocated(tmp);
+            strcpy(tmp, cell->text);
+            change_symbols(',', '.', tmp);
+
+            state[k] = CELL_TEXT;
+            for ( uint32_t c=0; tmp[c] != '\0'; c++ ) {
+                if ( get_cell_ref(tmp, c, &ref) ) {
+                    state[k] = CELL_PENDING;
+                    pending++;
+                    break;
+                }
+            }
+
+            if ( state[k] == CELL_TEXT )
+                plain++;
+
+            exprs[k] = tmp;
+        }
+    }
+
+    char**    plain_exprs = calloc(plain + 1, sizeof(char*));
+    is_memory_allocated(plain_exprs);
+    uint32_t* plain_cells = calloc(plain + 1, sizeof(uint32_t));
+    is_memory_allocated(plain_cells);
+    double*   results     = calloc(plain + 1, sizeof(double));
+    is_memory_allocated(results);
+    uint8_t*  ok          = calloc(plain + 1, sizeof(uint8_t));
+    is_memory_allocated(ok);
+    plain = 0;
+    for ( uint32_t k=0; k<cells_count; k++ ) {
+        if ( exprs[k] != NULL && state[k] == CELL_TEXT ) {
+            plain_exprs[plain] = exprs[k];
+            plain_cells[plain++] = k;
+        }
+    }
+
+    calc_expressions(plain_exprs, plain, results, ok);
+    for ( uint32_t n=0; n<plain; n++ ) {
+        uint32_t k = plain_cells[n];
+        if ( ok[n] ) {
+            values[k] = results[n];
+            state[k] = CELL_NUMBER;
+        }
+
+        free(exprs[k]);
+        exprs[k] = NULL;
+    }
+
+    free(plain_exprs);
+    free(plain_cells);
+    free(results);
+    free(ok);
+
+    if ( pending > 0 ) {
+        /* dependency graph: edges go from a cell to the cells using it */
+        uint32_t* indegree   = calloc(cells_count, sizeof(uint32_t));
+        is_memory_allocated(indegree);
+        uint32_t* first_edge = calloc(cells_count + 1, sizeof(uint32_t));
+        is_memory_allocated(first_edge);
+        for ( uint8_t pass=0; pass<2; pass++ ) {
+            uint32_t* edges = NULL;
+            uint32_t* fill  = NULL;
+            if ( pass == 1 ) {
+                for ( uint32_t k=0; k<cells_count; k++ )
+                    first_edge[k + 1] += first_edge[k];
+
+                edges = calloc(first_edge[cells_count] + 1, sizeof(uint32_t));
+                is_memory_allocated(edges);
+                fill = calloc(cells_count, sizeof(uint32_t));
+                is_memory_allocated(fill);
+            }
+
+            for ( uint32_t k=0; k<cells_count; k++ ) {
+                if ( state[k] != CELL_PENDING )
+                    continue;
+
+                for ( uint32_t c=0; exprs[k][c] != '\0'; c++ ) {
+                    if ( get_cell_ref(exprs[k], c, &ref) == 0 )
+                        continue;
+
+                    /* cells out of the table only make the expression
+                       an error, so a range stops at the table's edges */
+                    uint32_t col2 = (ref.col2 < max_cells) ? ref.col2
+                                                           : max_cells - 1u;
+                    uint32_t row2 = (ref.row2 < rows_count) ? ref.row2
+                                                            : rows_count - 1;
+                    for ( uint32_t col=ref.col1; col<=col2; col++ ) {
+                        for ( uint32_t row=ref.row1; row<=row2; row++ ) {
+                            uint32_t d = col * rows_count + row;
+                            if ( state[d] != CELL_PENDING )
+                                continue;
+
+                            if ( pass == 0 ) {
+                                first_edge[d + 1]++;
+                                indegree[k]++;
+                            } else
+                                edges[first_edge[d] + fill[d]++] = k;
+                        }
+                    }
+
+                    c += ref.len - 1;
+                }
+            }
+
+            if ( pass == 1 ) {
+                /* topological order (Kahn), each cell is evaluated once */
+                uint32_t* queue = calloc(pending, sizeof(uint32_t));
+                is_memory_allocated(queue);
+                uint32_t head = 0, tail = 0;
+                for ( uint32_t k=0; k<cells_count; k++ ) {
+                    if ( state[k] == CELL_PENDING && indegree[k] == 0 )
+                        queue[tail++] = k;
+                }
+
+                while ( head < tail ) {
+                    uint32_t k = queue[head++];
+                    double result;
+                    if ( eval_cell_expr(exprs[k], values, rows_count,
+                                        max_cells, &result) ) {
+                        values[k] = result;
+                        state[k] = CELL_NUMBER;
+                    } else
+                        state[k] = CELL_TEXT;
+
+                    for ( uint32_t e=first_edge[k]; e<first_edge[k+1]; e++ ) {
+                        if ( --indegree[edges[e]] == 0 )
+                            queue[tail++] = edges[e];
+                    }
+                }
+
+                free(queue);
+                free(edges);
+                free(fill);
+            }
+        }
+
+        /* whatever is left depends on a circular reference */
+        for ( uint32_t k=0; k<cells_count; k++ ) {
+            if ( state[k] == CELL_PENDING ) {
+                char* name = get_cell_name(k % rows_count, k / rows_count);
+                print_cell_error(name);
+                free(name);
+                state[k] = CELL_TEXT;
+            }
+
+            free(exprs[k]);
+        }
+
+        free(indegree);
+        free(first_edge);
+    }
+
+    /* results are formatted in one buffer, cells get copies of their size */
+    struct str_buf num;
+    str_buf_init(&num, NUMBER_STR_MAX);
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        for ( uint16_t j=0; j<cells_in_row[i]; j++ ) {
+            uint32_t k = (uint32_t)j * rows_count + i;
+            if ( state[k] == CELL_NUMBER ) {
+                num.len = 0;
+                str_buf_append_number(&num, values[k], fmt);
+                char* text = calloc(num.len + 1, sizeof(char));
+                is_memory_allocated(text);
+                memcpy(text, num.data, num.len);
+                free(table_data[i][j].text);
+                set_cell_text(&table_data[i][j], text);
+                /* the exact result, rows are sorted by it */
+                table_data[i][j].value = values[k];
+            }
+        }
+    }
+
+    free(num.data);
+    free(exprs);
+    free(values);
+    free(state);
+}
+
+void pad_cell(struct table_cell* cell, uint16_t count, uint8_t left)
+{
+    /* spaces before (numbers) or after the text, the number stays parsed */
+    char* text = calloc(cell->len + count + 1, sizeof(char));
+    is_memory_allocated(text);
+    if ( left ) {
+        memset(text, ' ', count);
+        memcpy(&text[count], cell->text, cell->len);
+    } else {
+        memcpy(text, cell->text, cell->len);
+        memset(&text[cell->len], ' ', count);
+    }
+
+    free(cell->text);
+    cell->text = text;
+    cell->len += count;
+}
+
+uint16_t** get_column_width(struct table_cell** table_data, uint32_t rows_count,
+                            uint16_t* cells_in_row)
+{
+    uint16_t max_cells = get_max(cells_in_row, rows_count);
+    /* Memory allocation */
+    uint16_t** column_width = calloc(max_cells, sizeof(uint16_t*));
+    is_memory_allocated(column_width);
+    for ( uint16_t i=0; i<max_cells; i++ ) {
+        column_width[i] = calloc(i + 1, sizeof(uint16_t));
+        is_memory_allocated(column_width[i]);
+    }
+
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        for ( uint16_t j=0; j<cells_in_row[i]; j++ ) {
+            if ( table_data[i][j].len > column_width[cells_in_row[i]-1][j] )
+                column_width[cells_in_row[i] - 1][j] = table_data[i][j].len;
+        }
+    }
+
+    return column_width;
+}
+
+void align_to_columns(struct table_cell** table_data, uint32_t rows_count,
+                      uint16_t* cells_in_row, uint8_t na)
+{
+    uint16_t** column_width = get_column_width(table_data, rows_count,
+                                               cells_in_row);
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        for ( uint16_t j=0; j<cells_in_row[i]; j++ ) {
+            struct table_cell* cell = &table_data[i][j];
+            uint16_t al_len = column_width[cells_in_row[i] - 1][j] - cell->len;
+            if ( al_len > 0 )
+                pad_cell(cell, al_len,
+                         cell->kind != PARSE_NOT_NUMBER && na == 0);
+        }
+    }
+    /* Cleaning */
+    uint16_t max_cells = get_max(cells_in_row, rows_count);
+    for ( uint16_t i=0; i<max_cells; i++ )
+        free(column_width[i]);
+    
+    free(column_width);
+}
+
+uint16_t get_max_row_len(struct table_cell** table_data, uint32_t rows_count,
+                         uint16_t* cells_in_row)
+{
+    uint16_t max_row_len = 0;
+    uint16_t max_cells = get_max(cells_in_row, rows_count);
+    uint16_t** column_width = get_column_width(table_data, rows_count,
+                                               cells_in_row);
+    for ( uint16_t i=0; i<max_cells; i++ ) {
+        uint16_t row_len = 0;
+        for ( uint16_t j=0; j<=i; j++ )
+            row_len += column_width[i][j];
+        
+        row_len += i;
+        if ( row_len > max_row_len )
+            max_row_len = row_len;
+    }
+    /* Cleaning */
+    for ( uint16_t i=0; i<max_cells; i++ )
+        free(column_width[i]);
+    
+    free(column_width);
+    return max_row_len;
+}
+
+char* render_table(struct table_cell** table_data, uint32_t rows_count,
+                   uint16_t* cells_in_row, uint8_t nb, uint8_t na,
+                   const struct num_format* fmt)
+{
+    /* the table is freed here; fmt == NULL means no calculations */
+    if ( fmt != NULL )
+        calc_in_table(table_data, rows_count, cells_in_row, fmt);
+
+    align_to_columns(table_data, rows_count, cells_in_row, na);
+    uint16_t* rows_len     = get_rows_len(table_data, rows_count, cells_in_row);
+    uint16_t  max_row_len  = get_max_row_len(table_data, rows_count,
+                                             cells_in_row);
+    
+    if ( max_row_len < DOC_WIDTH - 2 )
+        max_row_len = DOC_WIDTH - 2;
+
+    struct str_buf table;
+    str_buf_init(&table, rows_count * (uint64_t)(max_row_len + 3) + 1);
+
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        if ( nb == 0 )
+            str_buf_append(&table, "|");
+        
+        uint16_t* cells_len = get_cells_len(table_data[i], cells_in_row[i]);
+        uint16_t  align     = max_row_len - rows_len[i];
+
+        while ( align > 0 ) {
+            uint16_t min_cell_i = get_min_index(cells_len, cells_in_row[i]);
+            struct table_cell* cell = &table_data[i][min_cell_i];
+            pad_cell(cell, 1, cell->kind != PARSE_NOT_NUMBER && na == 0);
+            cells_len[min_cell_i]++;
+            align--;
+        }
+
+        for ( uint16_t j=0; j<cells_in_row[i]; j++ ) {
+            str_buf_append_n(&table, table_data[i][j].text,
+                             table_data[i][j].len);
+            str_buf_append(&table, (nb == 0) ? "|" : " ");
+        }
+
+        str_buf_append(&table, "\n");
+        free(cells_len);
+    }
+
+    char* result = (nb == 0) ? add_table_border(table.data) : table.data;
+    /* Cleaning */
+    if ( nb == 0 )
+        free(table.data);
+    
+    free_table_data(table_data, rows_count, cells_in_row);
+    free(rows_len);
+    free(cells_in_row);
+
+    return result;
+}
+
+
+/***************************************************************************
+* functions for working with streamed tables and inserted files
+***************************************************************************/
+/* every thread writes its own documents */
+__thread struct table_stream* table_streams[MAX_TABLE_STREAMS];
+__thread uint16_t             table_streams_count = 0;
+
+const char* get_next_line(const char* pos, const char* end, uint64_t* len)
+{
+    /* empty lines are skipped like in split() */
+    while ( pos < end && *pos == '\n' )
+        pos++;
+
+    if ( pos == end )
+        return NULL;
+
+    const char* nl = memchr(pos, '\n', end - pos);
+    *len = (nl != NULL) ? (uint64_t)(nl - pos) : (uint64_t)(end - pos);
+    return pos;
+}
+
+const char* get_next_cell(const char* pos, const char* end, uint64_t* len)
+{
+    /* empty cells are skipped like in split() */
+    while ( pos < end && *pos == '|' )
+        pos++;
+
+    if ( pos == end )
+        return NULL;
+
+    const char* bar = memchr(pos, '|', end - pos);
+    *len = (bar != NULL) ? (uint64_t)(bar - pos) : (uint64_t)(end - pos);
+    return pos;
+}
+
+void scan_table_stream(struct table_stream* ts, const char* data,
+                       uint64_t size)
+{
+    /* pass one: rows count and the widest cell of every column */
+    const char* end = data + size;
+    const char* line = data;
+    uint64_t line_len;
+    while ( (line = get_next_line(line, end, &line_len)) != NULL ) {
+        const char* line_end = line + line_len;
+        const char* cell = line;
+        uint64_t cell_len = 0;
+        uint16_t cells_count = 0;
+        while ( (cell = get_next_cell(cell, line_end, &cell_len)) != NULL ) {
+            cells_count++;
+            cell += cell_len;
+        }
+
+        if ( cells_count > ts->max_cells ) {
+            ts->cell_width = realloc(ts->cell_width,
+                                     cells_count * sizeof(uint16_t*));
+            is_memory_allocated(ts->cell_width);
+            for ( uint16_t i=ts->max_cells; i<cells_count; i++ ) {
+                ts->cell_width[i] = calloc(i + 1, sizeof(uint16_t));
+                is_memory_allocated(ts->cell_width[i]);
+            }
+            ts->max_cells = cells_count;
+        }
+
+        /* rows of different length are aligned separately */
+        uint16_t* width = (cells_count > 0) ? ts->cell_width[cells_count - 1]
+                                            : NULL;
+        cell = line;
+        for ( uint16_t j=0; j<cells_count; j++ ) {
+            cell = get_next_cell(cell, line_end, &cell_len);
+            if ( cell_len > width[j] )
+                width[j] = (cell_len > UINT16_MAX) ? UINT16_MAX : cell_len;
+
+            cell += cell_len;
+        }
+
+        if ( cells_count > 0 )
+            ts->rows_count++;
+
+        line = line_end;
+    }
+
+    /* the same widening as in get_table(): each extra space goes to the
+       narrowest cell, so the final widths depend only on the row length */
+    ts->row_len = 0;
+    for ( uint16_t i=0; i<ts->max_cells; i++ ) {
+        uint16_t row_len = i;
+        for ( uint16_t j=0; j<=i; j++ )
+            row_len += ts->cell_width[i][j];
+
+        if ( row_len > ts->row_len )
+            ts->row_len = row_len;
+    }
+
+    if ( ts->row_len < ts->doc_width - 2 )
+        ts->row_len = ts->doc_width - 2;
+
+    for ( uint16_t i=0; i<ts->max_cells; i++ ) {
+        uint16_t row_len = i;
+        for ( uint16_t j=0; j<=i; j++ )
+            row_len += ts->cell_width[i][j];
+
+        for ( uint16_t al=ts->row_len - row_len; al>0; al-- )
+            ts->cell_width[i][get_min_index(ts->cell_width[i], i + 1)]++;
+    }
+}
+
+struct table_stream* open_table_stream(char* filename, uint8_t nb, uint8_t na)
+{
+    uint64_t size;
+    char* data = map_file(filename, &size);
+    if ( data == NULL )
+        return NULL;
+
+    struct table_stream* ts = calloc(1, sizeof(struct table_stream));
+    is_memory_allocated(ts);
+    ts->path = strdup(filename);
+    is_memory_allocated(ts->path);
+    ts->nb = nb;
+    ts->na = na;
+    ts->doc_width = DOC_WIDTH;
+    scan_table_stream(ts, data, size);
+    unmap_file(data, size);
+    return ts;
+}
+
+void put_table_border(const struct table_stream* ts, uint16_t cells1,
+                      uint16_t cells2, struct str_buf* out)
+{
+    /* '+' where a '|' of the row above or below is, 0 cells is no row */
+    uint32_t len = ts->row_len + 2;
+    str_buf_reserve(out, len + 1);
+    char* border = &out->data[out->len];
+    memset(border, '-', len);
+    uint16_t cells[2] = { cells1, cells2 };
+    for ( uint8_t r=0; r<2; r++ ) {
+        if ( cells[r] == 0 )
+            continue;
+
+        const uint16_t* width = ts->cell_width[cells[r] - 1];
+        uint32_t pos = 0;
+        border[pos] = '+';
+        for ( uint16_t j=0; j<cells[r]; j++ ) {
+            pos += width[j] + 1;
+            border[pos] = '+';
+        }
+    }
+
+    out->len += len;
+}
+
+void write_table_stream(const struct table_stream* ts, struct str_buf* out,
+                        FILE* file)
+{
+    /* pass two: formatted rows go to the file as soon as the buffer fills */
+    uint64_t size;
+    char* data = map_file(ts->path, &size);
+    if ( data == NULL )
+        return;
+
+    const char* end = data + size;
+    const char* line = data;
+    uint64_t line_len;
+    uint16_t prev_cells = 0;
+    uint32_t rows = 0;
+    while ( rows < ts->rows_count &&
+            (line = get_next_line(line, end, &line_len)) != NULL ) {
+        const char* line_end = line + line_len;
+        const char* cell = line;
+        uint64_t cell_len = 0;
+        uint16_t cells_count = 0;
+        while ( (cell = get_next_cell(cell, line_end, &cell_len)) != NULL ) {
+            cells_count++;
+            cell += cell_len;
+        }
+
+        /* the file may have changed since pass one */
+        if ( cells_count == 0 || cells_count > ts->max_cells ) {
+            line = line_end;
+            continue;
+        }
+
+        if ( ts->nb == 0 ) {
+            put_table_border(ts, prev_cells, cells_count, out);
+            str_buf_append_n(out, "\n|", 2);
+        }
+
+        const uint16_t* width = ts->cell_width[cells_count - 1];
+        cell = line;
+        for ( uint16_t j=0; j<cells_count; j++ ) {
+            cell = get_next_cell(cell, line_end, &cell_len);
+            double value;
+            uint16_t al = (cell_len < width[j]) ? width[j] - cell_len : 0;
+            uint8_t left = ts->na == 0 &&
+                           parse_number(cell, cell_len, &value) !=
+                           PARSE_NOT_NUMBER;
+            str_buf_reserve(out, cell_len + al + 2);
+            if ( left ) {
+                memset(&out->data[out->len], ' ', al);
+                out->len += al;
+            }
+
+            str_buf_append_n(out, cell, cell_len);
+            if ( left == 0 ) {
+                memset(&out->data[out->len], ' ', al);
+                out->len += al;
+            }
+
+            str_buf_append_n(out, (ts->nb == 0) ? "|" : " ", 1);
+            cell += cell_len;
+        }
+
+        str_buf_append_n(out, "\n", 1);
+        line = line_end;
+        prev_cells = cells_count;
+        rows++;
+        if ( file != NULL && out->len >= TABLE_STREAM_FLUSH ) {
+            fwrite(out->data, 1, out->len, file);
+            out->len = 0;
+        }
+    }
+
+    if ( ts->nb == 0 && rows > 0 )
+        put_table_border(ts, prev_cells, 0, out);
+
+    out->data[out->len] = '\0';
+    unmap_file(data, size);
+}
+
+void free_table_stream(struct table_stream* ts)
+{
+    for ( uint16_t i=0; i<ts->max_cells; i++ )
+        free(ts->cell_width[i]);
+
+    free(ts->cell_width);
+    free(ts->path);
+    free(ts);
+}
+
+uint8_t can_stream(void)
+{
+    /* only a top level tag of the document itself is written by
+       write_text(); a nested one is needed as text by the outer tag */
+    return tag_depth == 0 && render_depth == 1 &&
+           table_streams_count < MAX_TABLE_STREAMS;
+}
+
+uint8_t add_table_stream(struct table_stream* ts, uint64_t pos)
+{
+    /* ts is written by write_text() at pos in the result of the tag; the
+       text itself keeps no mark of it */
+    if ( can_stream() == 0 )
+        return 0;
+
+    ts->pos = pos;
+    table_streams[table_streams_count++] = ts;
+    return 1;
+}
+
+void move_table_streams(uint16_t first, uint64_t offset)
+{
+    /* the result of a tag is put at offset of the document */
+    for ( uint16_t i=first; i<table_streams_count; i++ )
+        table_streams[i]->pos += offset;
+}
+
+char* get_streamed_table(char* filename, uint8_t nb, uint8_t na)
+{
+    struct table_stream* ts = open_table_stream(filename, nb, na);
+    if ( ts == NULL ) {
+        char* empty = calloc(1, sizeof(char));
+        is_memory_allocated(empty);
+        return empty;
+    }
+
+    if ( add_table_stream(ts, 0) ) {
+        char* empty = calloc(1, sizeof(char));
+        is_memory_allocated(empty);
+        return empty;
+    }
+
+    struct str_buf out;
+    str_buf_init(&out, (uint64_t)(ts->row_len + 3) * (ts->rows_count * 2 + 1));
+    write_table_stream(ts, &out, NULL);
+    free_table_stream(ts);
+    return out.data;
+}
+
+uint8_t is_plain_text(const char* data, uint64_t size)
+{
+    /* no symbols that the tags or write_result() would change */
+    uint64_t i = 0;
+#ifdef __SSE2__
+    const __m128i s[5] = { _mm_set1_epi8('\0'), _mm_set1_epi8('\a'),
+                           _mm_set1_epi8('\v'), _mm_set1_epi8('\f'),
+                           _mm_set1_epi8('\r') };
+    for ( ; i + 16 <= size; i += 16 ) {
+        __m128i block = _mm_loadu_si128((const __m128i*)&data[i]);
+        __m128i hits  = _mm_cmpeq_epi8(block, s[0]);
+        for ( uint8_t j=1; j<5; j++ )
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, s[j]));
+
+        if ( _mm_movemask_epi8(hits) != 0 )
+            return 0;
+    }
+#endif
+    for ( ; i<size; i++ ) {
+        char c = data[i];
+        if ( c == '\0' || c == '\a' || c == '\v' || c == '\f' ||
+             c == '\r' )
+            return 0;
+    }
+
+    return 1;
+}
+
+struct table_stream* open_file_stream(char* filename)
+{
+    /* a big file inserted at the top level is not read into the document,
+       write_text() copies it; NULL if the text is needed */
+    if ( can_stream() == 0 )
+        return NULL;
+
+    struct stat st;
+    char* path = find_doc_file(filename);
+    if ( stat(path, &st) != 0 || !S_ISREG(st.st_mode) ||
+         st.st_size < INSERT_STREAM_SIZE ) {
+        if ( path != filename )
+            free(path);
+
+        return NULL;
+    }
+
+    uint64_t size;
+    char* data = map_file(path, &size);
+    uint8_t plain = (data != NULL) ? is_plain_text(data, size) : 0;
+    if ( data != NULL )
+        unmap_file(data, size);
+
+    if ( plain == 0 ) {
+        if ( path != filename )
+            free(path);
+
+        return NULL;
+    }
+
+    struct table_stream* ts = calloc(1, sizeof(struct table_stream));
+    is_memory_allocated(ts);
+    ts->path = (path != filename) ? path : strdup(filename);
+    is_memory_allocated(ts->path);
+    ts->file_copy = 1;
+    ts->size = size;
+    return ts;
+}
+
+uint8_t copy_file_data(int from, int to, uint64_t size)
+{
+    /* in the kernel if it can, with read() and write() if not */
+    uint64_t copied = 0;
+#ifdef __linux__
+    while ( copied < size ) {
+        ssize_t n = copy_file_range(from, NULL, to, NULL, size - copied, 0);
+        if ( n <= 0 )
+            break;
+
+        copied += n;
+    }
+
+    while ( copied < size ) {
+        ssize_t n = sendfile(to, from, NULL, size - copied);
+        if ( n <= 0 )
+            break;
+
+        copied += n;
+    }
+#endif
+    char* block = NULL;
+    while ( copied < size ) {
+        if ( block == NULL ) {
+            block = malloc(COPY_BLOCK);
+            is_memory_allocated(block);
+        }
+
+        uint64_t left = size - copied;
+        ssize_t n = read(from, block, (left < COPY_BLOCK) ? left : COPY_BLOCK);
+        if ( n <= 0 )
+            break;
+
+        for ( ssize_t done = 0, w; done < n; done += w ) {
+            w = write(to, &block[done], n - done);
+            if ( w <= 0 ) {
+                free(block);
+                return 0;
+            }
+        }
+
+        copied += n;
+    }
+
+    free(block);
+    return copied == size;
+}
+
+void write_file_stream(const struct table_stream* ts, FILE* file)
+{
+    int from = open(ts->path, O_RDONLY);
+    if ( from == -1 ) {
+        print_file_error(ts->path);
+        return;
+    }
+
+    /* the file may have been cut since <insert> */
+    struct stat st;
+    uint64_t size = ts->size;
+    if ( fstat(from, &st) == 0 && (uint64_t)st.st_size < size )
+        size = st.st_size;
+
+    fflush(file);
+    int to = fileno(file);
+    if ( to == -1 ) {
+        /* a memory stream, see render_text() */
+        char block[COPY_BLOCK];
+        ssize_t n;
+        while ( size > 0 && (n = read(from, block,
+                (size < COPY_BLOCK) ? size : COPY_BLOCK)) > 0 ) {
+            fwrite(block, 1, n, file);
+            size -= n;
+        }
+    } else if ( copy_file_data(from, to, size) == 0 )
+        print_file_error(ts->path);
+
+    close(from);
+}
+
+void set_doc_time(time_t t)
+{
+    doc_time = t;
+}
+
+time_t get_doc_time(void)
+{
+    /* <date> and <time> of the document; 0 - the current time */
+    doc_uses_time = 1;
+    return (doc_time != 0) ? doc_time : time(NULL);
+}
+
+void restore_symbols(char* str)
+{
+    /* the symbols that tags use to protect text from other tags */
+    change_symbols('\f', '<', str);
+    change_symbols('\a', '>', str);
+    change_symbols('\r', ' ', str);
+    change_symbols('\v', ' ', str);
+}
+
+void write_document(char* filename, char* str)
+{
+    FILE *file;
+    file = fopen(filename, "w");
+    if ( file == NULL ) {
+        print_file_error(filename);
+        return;
+    }
+
+    write_text(file, str);
+    fclose(file);
+}
+
+char* render_text(const char* text, uint8_t width, uint64_t* len)
+{
+    /* a whole document in memory; streamed tables and files included */
+    set_doc_width(width);
+    clear_doc_vars();
+    clear_macros();
+    doc_uses_time = 0;
+    char* result = execute_all_tags((char*)text);
+    restore_symbols(result);
+
+    char* out = NULL;
+    size_t out_len = 0;
+    FILE* file = open_memstream(&out, &out_len);
+    if ( file == NULL )
+        exit_on_error("Error: can't create a memory stream", NULL);
+
+    write_text(file, result);
+    fclose(file);
+    free(result);
+    *len = out_len;
+    return out;
+}
+
+void write_text(FILE* file, char* str)
+{
+    /* the streams are in the order of the document, see
+       execute_all_tags() */
+    struct str_buf out;
+    str_buf_init(&out, TABLE_STREAM_FLUSH);
+    uint64_t len = strlen(str);
+    uint64_t done = 0;
+    for ( uint16_t i=0; i<table_streams_count; i++ ) {
+        struct table_stream* ts = table_streams[i];
+        uint64_t pos = (ts->pos < done) ? done :
+                       (ts->pos > len)  ? len  : ts->pos;
+        fwrite(&str[done], 1, pos - done, file);
+        done = pos;
+        if ( ts->file_copy )
+            write_file_stream(ts, file);
+        else {
+            write_table_stream(ts, &out, file);
+            fwrite(out.data, 1, out.len, file);
+            out.len = 0;
+        }
+    }
+
+    fwrite(&str[done], 1, len - done, file);
+    free(out.data);
+
+    for ( uint16_t i=0; i<table_streams_count; i++ )
+        free_table_stream(table_streams[i]);
+
+    table_streams_count = 0;
+}
+
+
+/***************************************************************************
+* functions for working with CSV files
+***************************************************************************/
+const char* find_csv_special(const char* pos, const char* end, char delim)
+{
+    /* the first delimiter, quote or line end */
+#ifdef __SSE2__
+    const __m128i d  = _mm_set1_epi8(delim);
+    const __m128i q  = _mm_set1_epi8('"');
+    const __m128i nl = _mm_set1_epi8('\n');
+    while ( end - pos >= 16 ) {
+        __m128i block = _mm_loadu_si128((const __m128i*)pos);
+        __m128i hits  = _mm_or_si128(_mm_cmpeq_epi8(block, d),
+                        _mm_or_si128(_mm_cmpeq_epi8(block, q),
+                                     _mm_cmpeq_epi8(block, nl)));
+        uint32_t mask = _mm_movemask_epi8(hits);
+        if ( mask != 0 )
+            return pos + __builtin_ctz(mask);
+
+        pos += 16;
+    }
+#else
+    /* a zero byte in (word ^ pattern) is a match, 8 bytes at a time */
+    const uint64_t ones  = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    while ( end - pos >= 8 ) {
+        uint64_t w;
+        memcpy(&w, pos, 8);
+        uint64_t a = w ^ (ones * (uint8_t)delim);
+        uint64_t b = w ^ (ones * '"');
+        uint64_t c = w ^ (ones * '\n');
+        if ( (((a - ones) & ~a) | ((b - ones) & ~b) | ((c - ones) & ~c)) &
+             highs )
+            break;
+
+        pos += 8;
+    }
+#endif
+    while ( pos < end && *pos != delim && *pos != '"' && *pos != '\n' )
+        pos++;
+
+    return pos;
+}
+
+void add_csv_field(struct csv_data* csv, uint64_t start, uint64_t len,
+                   uint8_t quoted)
+{
+    if ( csv->fields_count == csv->fields_cap ) {
+        csv->fields_cap = (csv->fields_cap == 0) ? 1024 : csv->fields_cap * 2;
+        csv->fields = realloc(csv->fields,
+                              csv->fields_cap * sizeof(struct csv_field));
+        is_memory_allocated(csv->fields);
+    }
+
+    struct csv_field* field = &csv->fields[csv->fields_count++];
+    field->start  = start;
+    field->len    = (len > UINT32_MAX) ? UINT32_MAX : len;
+    field->quoted = quoted;
+}
+
+void add_csv_row(struct csv_data* csv, uint64_t first_field)
+{
+    /* an empty line is one empty field, it's dropped like in split() */
+    uint64_t n = csv->fields_count - first_field;
+    if ( n == 0 || ( n == 1 && csv->fields[first_field].len == 0 &&
+                     csv->fields[first_field].quoted == 0 ) ) {
+        csv->fields_count = first_field;
+        return;
+    }
+
+    if ( csv->rows_count + 1 >= csv->rows_cap ) {
+        csv->rows_cap = (csv->rows_cap == 0) ? 1024 : csv->rows_cap * 2;
+        csv->rows = realloc(csv->rows, csv->rows_cap * sizeof(uint64_t));
+        is_memory_allocated(csv->rows);
+    }
+
+    csv->rows[csv->rows_count++] = first_field;
+    csv->rows[csv->rows_count] = csv->fields_count;
+}
+
+void parse_csv(const char* data, uint64_t size, char delim,
+               struct csv_data* csv)
+{
+    /* only field positions are stored, the text stays in the mapping */
+    memset(csv, 0, sizeof(struct csv_data));
+    const char* pos = data;
+    const char* end = data + size;
+    uint64_t first_field = 0;
+    while ( pos < end ) {
+        const char* start = pos;
+        const char* field_end;
+        uint8_t quoted = 0;
+        if ( *pos == '"' ) {
+            /* "" inside quotes is an escaped quote */
+            quoted = 1;
+            start = pos + 1;
+            const char* q = start;
+            while ( (q = memchr(q, '"', end - q)) != NULL ) {
+                if ( q + 1 < end && q[1] == '"' )
+                    q += 2;
+                else
+                    break;
+            }
+
+            field_end = (q != NULL) ? q : end;
+            pos = (q != NULL) ? q + 1 : end;
+            while ( pos < end && *pos != delim && *pos != '\n' )
+                pos++;
+        } else {
+            /* a quote in the middle of a field is an ordinary symbol */
+            pos = find_csv_special(pos, end, delim);
+            while ( pos < end && *pos == '"' )
+                pos = find_csv_special(pos + 1, end, delim);
+
+            field_end = pos;
+            if ( field_end > start && field_end[-1] == '\r' )
+                field_end--;
+        }
+
+        add_csv_field(csv, start - data, field_end - start, quoted);
+        if ( pos < end && *pos == delim ) {
+            pos++;
+            if ( pos == end )
+                add_csv_field(csv, size, 0, 0);
+        } else {
+            add_csv_row(csv, first_field);
+            first_field = csv->fields_count;
+            if ( pos < end )
+                pos++;
+        }
+    }
+
+    if ( first_field < csv->fields_count )
+        add_csv_row(csv, first_field);
+}
+
+char* get_csv_text(const char* data, const struct csv_field* field)
+{
+    /* unescaped text of a field, safe to put into a document */
+    char* text = calloc(field->len + 1, sizeof(char));
+    is_memory_allocated(text);
+    const char* src = &data[field->start];
+    uint32_t n = 0;
+    for ( uint32_t i=0; i<field->len; i++ ) {
+        char c = src[i];
+        if ( c == '"' && field->quoted && i + 1 < field->len &&
+             src[i + 1] == '"' )
+            i++;
+        else if ( c == '\n' || c == '\r' || c == '\t' )
+            c = ' ';
+        else if ( c == '<' )
+            c = '\f';
+        else if ( c == '>' )
+            c = '\a';
+
+        text[n++] = c;
+    }
+
+    return text;
+}
+
+void append_csv_text(struct str_buf* sb, const char* data,
+                     const struct csv_field* field)
+{
+    /* get_csv_text() straight into a buffer */
+    str_buf_reserve(sb, field->len);
+    const char* src = &data[field->start];
+    char* dst = &sb->data[sb->len];
+    uint32_t n = 0;
+    for ( uint32_t i=0; i<field->len; i++ ) {
+        char c = src[i];
+        if ( c == '"' && field->quoted && i + 1 < field->len &&
+             src[i + 1] == '"' )
+            i++;
+        else if ( c == '\n' || c == '\r' || c == '\t' )
+            c = ' ';
+        else if ( c == '<' )
+            c = '\f';
+        else if ( c == '>' )
+            c = '\a';
+
+        dst[n++] = c;
+    }
+
+    sb->len += n;
+    sb->data[sb->len] = '\0';
+}
+
+char** get_csv_header(const char* data, const struct csv_data* csv,
+                      uint16_t* count)
+{
+    /* trimmed fields of the first record */
+    *count = 0;
+    if ( csv->rows_count == 0 )
+        return NULL;
+
+    uint64_t n = csv->rows[1] - csv->rows[0];
+    *count = (n > UINT16_MAX) ? UINT16_MAX : n;
+    char** names = calloc(*count + 1, sizeof(char*));
+    is_memory_allocated(names);
+    for ( uint16_t i=0; i<*count; i++ )
+        names[i] = rm_spaces_start_end(
+                       get_csv_text(data, &csv->fields[csv->rows[0] + i]));
+
+    return names;
+}
+
+char get_csv_delim(char** attrs, char* filename)
+{
+    /* "," by default, tabs for tsv and .tsv files, or delim=X */
+    char* ext = strrchr(filename, '.');
+    char  delim = ',';
+    if ( in_str_array(attrs, "tsv") || (ext != NULL && strcmp(ext, ".tsv")==0) )
+        delim = '\t';
+
+    char* d = get_attr_value(attrs, "delim");
+    if ( d != NULL && d[0] != '\0' )
+        delim = d[0];
+
+    return delim;
+}
+
+void free_csv_data(struct csv_data* csv)
+{
+    free(csv->fields);
+    free(csv->rows);
+}
+
+struct table_cell** get_csv_table_data(const char* data,
+                                       const struct csv_data* csv,
+                                       uint16_t** cells)
+{
+    uint32_t  rows_count   = csv->rows_count;
+    uint16_t* cells_in_row = calloc(rows_count + 1, sizeof(uint16_t));
+    is_memory_allocated(cells_in_row);
+    struct table_cell** table_data = calloc(rows_count,
+                                            sizeof(struct table_cell*));
+    is_memory_allocated(table_data);
+    for ( uint32_t i=0; i<rows_count; i++ ) {
+        uint64_t first = csv->rows[i];
+        uint64_t n = csv->rows[i + 1] - first;
+        cells_in_row[i] = (n > UINT16_MAX) ? UINT16_MAX : n;
+        table_data[i] = calloc(cells_in_row[i] + 1, sizeof(struct table_cell));
+        is_memory_allocated(table_data[i]);
+        for ( uint16_t j=0; j<cells_in_row[i]; j++ )
+            set_cell_text(&table_data[i][j],
+                          get_csv_text(data, &csv->fields[first + j]));
+    }
+
+    *cells = cells_in_row;
+    return table_data;
+}
+
+char* csv_to_table(const char* data, const struct csv_data* csv, uint8_t nb,
+                   uint8_t na)
+{
+    uint16_t* cells_in_row = NULL;
+    struct table_cell** table_data = get_csv_table_data(data, csv,
+                                                        &cells_in_row);
+    return render_table(table_data, csv->rows_count, cells_in_row, nb, na,
+                        NULL);
+}
+
+char* csv_to_histogram(const char* data, const struct csv_data* csv,
+                       uint32_t first_row, uint16_t name_col,
+                       uint16_t value_col, char sym)
+{
+    uint32_t count = (csv->rows_count > first_row)
+                     ? csv->rows_count - first_row : 0;
+    char** names = calloc(count + 1, sizeof(char*));
+    is_memory_allocated(names);
+    char** values = calloc(count + 1, sizeof(char*));
+    is_memory_allocated(values);
+    double* numbers = calloc(count + 1, sizeof(double));
+    is_memory_allocated(numbers);
+    for ( uint32_t i=0; i<count; i++ ) {
+        uint64_t first = csv->rows[first_row + i];
+        uint64_t n = csv->rows[first_row + i + 1] - first;
+        if ( name_col < n )
+            names[i] = rm_spaces_start_end(
+                           get_csv_text(data, &csv->fields[first + name_col]));
+        else
+            names[i] = strdup(" ");
+
+        is_memory_allocated(names[i]);
+        if ( value_col < n ) {
+            char* text = get_csv_text(data, &csv->fields[first + value_col]);
+            values[i] = get_histogram_value(text, strlen(text), &numbers[i]);
+            free(text);
+        } else {
+            values[i] = strdup("error");
+            is_memory_allocated(values[i]);
+            numbers[i] = NAN;
+        }
+    }
+
+    return render_histogram(names, values, numbers, count, sym);
+}
+
+
+/***************************************************************************
+* functions for working with Histograms
+***************************************************************************/
+double get_max_value(const double* numbers, uint16_t values_count)
+{
+    double max_value = 0;
+    for ( uint16_t i=0; i<values_count; i++ ) {
+        double vl = fabs(numbers[i]);
+        if ( vl > max_value )   /* NAN is never greater */
+            max_value = vl;
+    }
+    return max_value;
+}
+
+char* get_histogram_value(const char* str, uint64_t len, double* number)
+{
+    /* the text shown next to the bar: spaces removed, ',' -> '.' */
+    uint8_t kind = parse_number(str, len, number);
+    if ( kind == PARSE_NOT_NUMBER ) {
+        *number = NAN;
+        return strdup("error");
+    }
+
+    if ( kind == PARSE_NUMBER_LIKE )
+        *number = 0;
+
+    char* value = calloc(len + 1, sizeof(char));
+    is_memory_allocated(value);
+    uint64_t n = 0;
+    for ( uint64_t i=0; i<len; i++ ) {
+        if ( str[i] != ' ' )
+            value[n++] = (str[i] == ',') ? '.' : str[i];
+    }
+
+    return value;
+}
+
+void get_histogram_data(char* str, char** names, char** values,
+                        double* numbers)
+{
+    char** lines = split('\n', str);
+    uint32_t lines_count = get_elements_count('\n', str);
+    for ( uint32_t i=0; i<lines_count; i++ ) {
+        char* bar = strchr(lines[i], '|');
+        if ( bar != NULL && bar != lines[i] ) {
+            /* "name | value", empty fields are skipped like in split() */
+            char* val = bar + strspn(bar, "|");
+            char* end = strchr(val, '|');
+            uint64_t len = (end != NULL) ? (uint64_t)(end - val) : strlen(val);
+            values[i] = get_histogram_value(val, len, &numbers[i]);
+            *bar = '\0';
+            names[i] = rm_spaces_start_end(strdup(lines[i]));
+        } else {
+            /* only a value */
+            values[i] = get_histogram_value(lines[i], strlen(lines[i]),
+                                            &numbers[i]);
+            names[i] = strdup(" ");
+        }
+
+        is_memory_allocated(names[i]);
+        free(lines[i]);
+    }
+    free(lines);
+}
+
+char* render_histogram(char** names, char** values, double* numbers,
+                       uint32_t count, char sym)
+{
+    /* the arrays and their strings are freed here */
+    struct str_buf histogram;
+    str_buf_init(&histogram, (DOC_WIDTH + 1) * (uint64_t)count + 1);
+
+    uint16_t max_name = get_max_len(names, count);
+    double max_value = get_max_value(numbers, count);
+    uint16_t max_value_len = get_max_len(values, count);
+    uint16_t hist_width = 0;
+    if ( max_name + max_value_len + 8 < DOC_WIDTH )
+        hist_width = DOC_WIDTH - max_name - max_value_len - 8;
+
+    double hist_sym = max_value / (double)(hist_width);
+
+    for ( uint32_t i=0; i<count; i++ ) {
+        uint16_t name_len = strlen(names[i]);
+        str_buf_reserve(&histogram, max_name + hist_width +
+                                    strlen(values[i]) + 8);
+        str_buf_append(&histogram, " ");
+        for ( uint16_t j=name_len; j<max_name; j++ )
+            str_buf_append_n(&histogram, " ", 1);
+
+        str_buf_append(&histogram, names[i]);
+        str_buf_append(&histogram, " | ");
+        /* NAN (error) and negative values get an empty bar */
+        double v = (numbers[i] > 0 && hist_sym > 0) ? numbers[i] : 0;
+        uint16_t hist_len = (uint16_t)round(v / (double)hist_sym);
+        for ( uint16_t j=0; j<hist_width; j++ )
+            histogram.data[histogram.len++] = (j < hist_len) ? sym : ' ';
+
+        str_buf_append(&histogram, " | ");
+        str_buf_append(&histogram, values[i]);
+        str_buf_append(&histogram, " ");
+        if ( i < count - 1 )
+            str_buf_append(&histogram, "\n");
+
+        free(names[i]);
+        free(values[i]);
+    }
+
+    free(names);
+    free(values);
+    free(numbers);
+    return histogram.data;
+}
+
+char get_histogram_symbol(char** attrs)
+{
+    /* the first attribute that is not "name=value" or a keyword */
+    if ( attrs == NULL )
+        return '#';
+
+    uint16_t attrs_count = get_arr_size(attrs);
+    for ( uint16_t i=0; i<attrs_count; i++ ) {
+        if ( strlen(attrs[i]) == 1 ||
+             ( strchr(attrs[i], '=') == NULL && strcmp(attrs[i], "hdr") != 0 ) )
+            return attrs[i][0];
+    }
+
+    return '#';
+}
+
+uint32_t parse_samples(const char** pos, const char* end, double* block,
+                       uint32_t block_size, uint64_t* invalid)
+{
+    /* the next samples separated by spaces or line breaks */
+    uint32_t n = 0;
+    const char* p = *pos;
+    while ( n < block_size ) {
+        while ( p < end && IS_SAMPLE_SPACE(*p) )
+            p++;
+
+        if ( p == end )
+            break;
+
+        const char* start = p;
+        while ( p < end && !IS_SAMPLE_SPACE(*p) )
+            p++;
+
+        double v;
+        uint64_t len = p - start;
+        if ( parse_number(start, len, &v) != PARSE_NUMBER ) {
+            /* exponents are left to strtod */
+            char tmp[NUMBER_STR_MAX];
+            char* tmp_end = tmp;
+            if ( len < NUMBER_STR_MAX ) {
+                memcpy(tmp, start, len);
+                tmp[len] = '\0';
+                v = strtod(tmp, &tmp_end);
+            }
+
+            if ( tmp_end != &tmp[len] ) {
+                (*invalid)++;
+                continue;
+            }
+        }
+
+        if ( isfinite(v) )
+            block[n++] = v;
+        else
+            (*invalid)++;
+    }
+
+    *pos = p;
+    return n;
+}
+
+void get_min_max(const double* values, uint32_t count, double* min,
+                 double* max)
+{
+    /* updates *min and *max, two lanes at a time */
+    uint32_t i = 0;
+    double lo = *min, hi = *max;
+#ifdef __SSE2__
+    if ( count >= 2 ) {
+        __m128d vmin = _mm_set1_pd(lo);
+        __m128d vmax = _mm_set1_pd(hi);
+        for ( ; i + 2 <= count; i += 2 ) {
+            __m128d v = _mm_loadu_pd(&values[i]);
+            vmin = _mm_min_pd(vmin, v);
+            vmax = _mm_max_pd(vmax, v);
+        }
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, vmin);
+        lo = (lanes[0] < lanes[1]) ? lanes[0] : lanes[1];
+        _mm_storeu_pd(lanes, vmax);
+        hi = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+    }
+#endif
+    for ( ; i<count; i++ ) {
+        lo = (values[i] < lo) ? values[i] : lo;
+        hi = (values[i] > hi) ? values[i] : hi;
+    }
+
+    *min = lo;
+    *max = hi;
+}
+
+void scan_samples(const char* data, uint64_t size, struct sample_stats* st)
+{
+    /* pass one: count, min and max */
+    double block[SAMPLES_BLOCK];
+    const char* pos = data;
+    const char* end = data + size;
+    st->count = 0;
+    st->invalid = 0;
+    st->min = INFINITY;
+    st->max = -INFINITY;
+    uint32_t n;
+    while ( (n = parse_samples(&pos, end, block, SAMPLES_BLOCK,
+                               &st->invalid)) > 0 ) {
+        get_min_max(block, n, &st->min, &st->max);
+        st->count += n;
+    }
+}
+
+void count_bins(const char* data, uint64_t size, const struct sample_stats* st,
+                uint64_t* bins, uint16_t bins_count)
+{
+    /* pass two: the bins are [min + k*step, min + (k+1)*step), the last
+       one includes max */
+    double block[SAMPLES_BLOCK];
+    const char* pos = data;
+    const char* end = data + size;
+    uint64_t invalid = 0;
+    double range = st->max - st->min;
+    double scale = (range > 0) ? bins_count / range : 0;
+    uint32_t n;
+    while ( (n = parse_samples(&pos, end, block, SAMPLES_BLOCK,
+                               &invalid)) > 0 ) {
+        for ( uint32_t i=0; i<n; i++ ) {
+            uint32_t k = (uint32_t)((block[i] - st->min) * scale);
+            bins[(k < bins_count) ? k : bins_count - 1u]++;
+        }
+    }
+}
+
+void samples_range(void* ctx, uint32_t start, uint32_t end)
+{
+    struct samples_job* job = ctx;
+    for ( uint32_t i=start; i<end; i++ ) {
+        const char* data = job->data + job->bounds[i];
+        uint64_t size = job->bounds[i + 1] - job->bounds[i];
+        if ( job->summaries != NULL )
+            summarize_samples(data, size, &job->summaries[i]);
+        else if ( job->total == NULL )
+            scan_samples(data, size, &job->stats[i]);
+        else
+            count_bins(data, size, job->total,
+                       &job->bins[(uint64_t)i * job->bins_count],
+                       job->bins_count);
+    }
+}
+
+void split_samples(struct samples_job* job)
+{
+    /* parts of about SAMPLES_PART bytes, cut between two samples */
+    job->parts = job->size / SAMPLES_PART + 1;
+    if ( job->parts > MAX_SAMPLES_PARTS )
+        job->parts = MAX_SAMPLES_PARTS;
+
+    job->bounds = calloc(job->parts + 1, sizeof(uint64_t));
+    is_memory_allocated(job->bounds);
+    for ( uint32_t i=1; i<job->parts; i++ ) {
+        uint64_t pos = job->size / job->parts * i;
+        if ( pos < job->bounds[i - 1] )
+            pos = job->bounds[i - 1];
+
+        while ( pos < job->size && !IS_SAMPLE_SPACE(job->data[pos]) )
+            pos++;
+
+        job->bounds[i] = pos;
+    }
+
+    job->bounds[job->parts] = job->size;
+}
+
+uint16_t get_auto_bins(uint64_t count)
+{
+    /* Sturges' rule */
+    if ( count < 2 )
+        return 1;
+
+    uint16_t bins = (uint16_t)ceil(log2((double)count)) + 1;
+    return (bins > MAX_HISTOGRAM_BINS) ? MAX_HISTOGRAM_BINS : bins;
+}
+
+char* get_binned_histogram(const char* data, uint64_t size, char* bins_attr,
+                           char sym)
+{
+    /* both passes run on parts of the data in parallel */
+    struct samples_job job = { 0 };
+    job.data = data;
+    job.size = size;
+    split_samples(&job);
+    job.stats = calloc(job.parts, sizeof(struct sample_stats));
+    is_memory_allocated(job.stats);
+    run_parallel(samples_range, &job, job.parts, 2);
+
+    struct sample_stats st = { 0, 0, INFINITY, -INFINITY };
+    for ( uint32_t i=0; i<job.parts; i++ ) {
+        st.count   += job.stats[i].count;
+        st.invalid += job.stats[i].invalid;
+        st.min = (job.stats[i].min < st.min) ? job.stats[i].min : st.min;
+        st.max = (job.stats[i].max > st.max) ? job.stats[i].max : st.max;
+    }
+
+    if ( st.invalid > 0 )
+        print_error("%lu histogram samples are not numbers",
+                    (unsigned long)st.invalid);
+
+    uint16_t bins_count = get_auto_bins(st.count);
+    if ( strcmp(bins_attr, "auto") != 0 ) {
+        if ( is_number(bins_attr, 0) && atoi(bins_attr) > 0 )
+            bins_count = (atoi(bins_attr) > MAX_HISTOGRAM_BINS)
+                         ? MAX_HISTOGRAM_BINS : atoi(bins_attr);
+        else
+            print_error("invalid bins value \"%s\"", bins_attr);
+    }
+
+    if ( st.count == 0 || st.max == st.min )
+        bins_count = 1;
+
+    uint64_t* bins = calloc((uint64_t)bins_count * job.parts,
+                            sizeof(uint64_t));
+    is_memory_allocated(bins);
+    if ( st.count > 0 ) {
+        job.total = &st;
+        job.bins = bins;
+        job.bins_count = bins_count;
+        run_parallel(samples_range, &job, job.parts, 2);
+        for ( uint32_t i=1; i<job.parts; i++ ) {
+            for ( uint16_t k=0; k<bins_count; k++ )
+                bins[k] += bins[(uint64_t)i * bins_count + k];
+        }
+    }
+
+    free(job.bounds);
+    free(job.stats);
+
+    char** names = calloc(bins_count, sizeof(char*));
+    is_memory_allocated(names);
+    char** values = calloc(bins_count, sizeof(char*));
+    is_memory_allocated(values);
+    double* numbers = calloc(bins_count, sizeof(double));
+    is_memory_allocated(numbers);
+    struct num_format fmt = { NUM_GENERAL, 6, '\0' };
+    double step = (st.max - st.min) / bins_count;
+    for ( uint16_t k=0; k<bins_count; k++ ) {
+        char lo[NUMBER_STR_MAX] = "", hi[NUMBER_STR_MAX] = "";
+        if ( st.count > 0 ) {
+            format_number(st.min + k * step, &fmt, lo);
+            format_number((k == bins_count - 1) ? st.max
+                                                : st.min + (k + 1) * step,
+                          &fmt, hi);
+        }
+
+        names[k] = calloc(2 * NUMBER_STR_MAX + 4, sizeof(char));
+        is_memory_allocated(names[k]);
+        sprintf(names[k], "%s - %s", lo, hi);
+        values[k] = calloc(NUMBER_STR_MAX, sizeof(char));
+        is_memory_allocated(values[k]);
+        sprintf(values[k], "%lu", (unsigned long)bins[k]);
+        numbers[k] = bins[k];
+    }
+
+    free(bins);
+    return render_histogram(names, values, numbers, bins_count, sym);
+}
+
+
+/***************************************************************************
+* functions for working with statistics
+***************************************************************************/
+void tdigest_init(struct tdigest* td)
+{
+    memset(td, 0, sizeof(struct tdigest));
+    td->centroids = calloc(TDIGEST_CENTROIDS, sizeof(struct centroid));
+    is_memory_allocated(td->centroids);
+    /* the buffer also takes the centroids when they are merged */
+    td->buffer = calloc(TDIGEST_BUFFER + TDIGEST_CENTROIDS,
+                        sizeof(struct centroid));
+    is_memory_allocated(td->buffer);
+    td->min = INFINITY;
+    td->max = -INFINITY;
+}
+
+void tdigest_free(struct tdigest* td)
+{
+    free(td->centroids);
+    free(td->buffer);
+}
+
+int compare_centroids(const void* a, const void* b)
+{
+    double x = ((const struct centroid*)a)->mean;
+    double y = ((const struct centroid*)b)->mean;
+    return (x > y) - (x < y);
+}
+
+double tdigest_q_limit(double q)
+{
+    /* k1 scale: k(q) = d/(2*pi) * asin(2q - 1), the limit is k^-1(k(q)+1) */
+    double k = TDIGEST_COMPRESSION / (2 * M_PI) * asin(2 * q - 1) + 1;
+    if ( k >= TDIGEST_COMPRESSION / 4.0 )
+        return 1;
+
+    return (sin(k * 2 * M_PI / TDIGEST_COMPRESSION) + 1) / 2;
+}
+
+void tdigest_compress(struct tdigest* td)
+{
+    /* buffered points and centroids are merged in the order of means */
+    if ( td->buffer_count == 0 )
+        return;
+
+    struct centroid* all = td->buffer;
+    uint32_t n = td->buffer_count;
+    memcpy(&all[n], td->centroids, td->count * sizeof(struct centroid));
+    n += td->count;
+    qsort(all, n, sizeof(struct centroid), compare_centroids);
+
+    struct centroid cur = all[0];
+    double w_so_far = 0;
+    double q_limit = tdigest_q_limit(0);
+    td->count = 0;
+    for ( uint32_t i=1; i<n; i++ ) {
+        double proposed = cur.weight + all[i].weight;
+        if ( (w_so_far + proposed) / td->total <= q_limit ||
+             td->count == TDIGEST_CENTROIDS - 1 ) {
+            cur.mean  += (all[i].mean - cur.mean) * all[i].weight / proposed;
+            cur.weight = proposed;
+        } else {
+            w_so_far += cur.weight;
+            td->centroids[td->count++] = cur;
+            q_limit = tdigest_q_limit(w_so_far / td->total);
+            cur = all[i];
+        }
+    }
+
+    td->centroids[td->count++] = cur;
+    td->buffer_count = 0;
+}
+
+void tdigest_add(struct tdigest* td, double mean, double weight)
+{
+    if ( td->buffer_count == TDIGEST_BUFFER )
+        tdigest_compress(td);
+
+    td->buffer[td->buffer_count].mean = mean;
+    td->buffer[td->buffer_count].weight = weight;
+    td->buffer_count++;
+    td->total += weight;
+    td->min = (mean < td->min) ? mean : td->min;
+    td->max = (mean > td->max) ? mean : td->max;
+}
+
+void tdigest_merge(struct tdigest* dst, struct tdigest* src)
+{
+    tdigest_compress(src);
+    for ( uint32_t i=0; i<src->count; i++ )
+        tdigest_add(dst, src->centroids[i].mean, src->centroids[i].weight);
+
+    dst->min = (src->min < dst->min) ? src->min : dst->min;
+    dst->max = (src->max > dst->max) ? src->max : dst->max;
+}
+
+double tdigest_quantile(struct tdigest* td, double q)
+{
+    /* linear between centroid centers, min and max at the ends */
+    tdigest_compress(td);
+    if ( td->count == 0 )
+        return NAN;
+
+    if ( td->count == 1 )
+        return td->centroids[0].mean;
+
+    double index = q * td->total;
+    double left = td->centroids[0].weight / 2;
+    if ( index <= left )
+        return td->min + (td->centroids[0].mean - td->min) *
+                         ((left > 0) ? index / left : 0);
+
+    double cum = left;
+    for ( uint32_t i=0; i+1<td->count; i++ ) {
+        double step = (td->centroids[i].weight +
+                       td->centroids[i + 1].weight) / 2;
+        if ( index <= cum + step ) {
+            double t = (index - cum) / step;
+            return td->centroids[i].mean +
+                   (td->centroids[i + 1].mean - td->centroids[i].mean) * t;
+        }
+
+        cum += step;
+    }
+
+    double right = td->centroids[td->count - 1].weight / 2;
+    double t = (right > 0) ? (index - cum) / right : 1;
+    return td->centroids[td->count - 1].mean +
+           (td->max - td->centroids[td->count - 1].mean) * ((t > 1) ? 1 : t);
+}
+
+void summary_init(struct summary* sm)
+{
+    sm->count = 0;
+    sm->invalid = 0;
+    sm->sum = 0;
+    sm->mean = 0;
+    sm->m2 = 0;
+    tdigest_init(&sm->td);
+}
+
+void summarize_samples(const char* data, uint64_t size, struct summary* sm)
+{
+    /* one pass: Welford's mean and variance, and the t-digest */
+    double block[SAMPLES_BLOCK];
+    const char* pos = data;
+    const char* end = data + size;
+    uint32_t n;
+    while ( (n = parse_samples(&pos, end, block, SAMPLES_BLOCK,
+                               &sm->invalid)) > 0 ) {
+        for ( uint32_t i=0; i<n; i++ ) {
+            double v = block[i];
+            sm->count++;
+            sm->sum += v;
+            double delta = v - sm->mean;
+            sm->mean += delta / sm->count;
+            sm->m2 += delta * (v - sm->mean);
+            tdigest_add(&sm->td, v, 1);
+        }
+    }
+}
+
+void merge_summary(struct summary* dst, struct summary* src)
+{
+    /* Chan et al. for the mean and the sum of squares */
+    if ( src->count > 0 ) {
+        double n = (double)dst->count + src->count;
+        double delta = src->mean - dst->mean;
+        dst->mean += delta * src->count / n;
+        dst->m2 += src->m2 + delta * delta * dst->count * src->count / n;
+        dst->count += src->count;
+        dst->sum += src->sum;
+        tdigest_merge(&dst->td, &src->td);
+    }
+
+    dst->invalid += src->invalid;
+}
+
+void add_stats_row(struct table_cell** table_data, uint16_t* cells_in_row,
+                   uint32_t row, const char* name, double value,
+                   const struct num_format* fmt)
+{
+    table_data[row] = calloc(3, sizeof(struct table_cell));
+    is_memory_allocated(table_data[row]);
+    cells_in_row[row] = 2;
+    char* text = strdup(name);
+    is_memory_allocated(text);
+    set_cell_text(&table_data[row][0], text);
+    text = calloc(NUMBER_STR_MAX, sizeof(char));
+    is_memory_allocated(text);
+    if ( isnan(value) )
+        strcpy(text, "-");
+    else
+        format_number(value, fmt, text);
+
+    /* exponent forms are numbers too, they are aligned to the right */
+    set_cell_text(&table_data[row][1], text);
+    if ( !isnan(value) ) {
+        table_data[row][1].kind  = PARSE_NUMBER;
+        table_data[row][1].value = value;
+    }
+}
+
+char* get_stats_table(const char* data, uint64_t size, char* quantiles,
+                      uint8_t nb, const struct num_format* fmt)
+{
+    /* every part gets its own summary, they are merged at the end */
+    struct samples_job job = { 0 };
+    job.data = data;
+    job.size = size;
+    split_samples(&job);
+    job.summaries = calloc(job.parts, sizeof(struct summary));
+    is_memory_allocated(job.summaries);
+    for ( uint32_t i=0; i<job.parts; i++ )
+        summary_init(&job.summaries[i]);
+
+    run_parallel(samples_range, &job, job.parts, 2);
+    struct summary* sm = &job.summaries[0];
+    for ( uint32_t i=1; i<job.parts; i++ ) {
+        merge_summary(sm, &job.summaries[i]);
+        tdigest_free(&job.summaries[i].td);
+    }
+
+    if ( sm->invalid > 0 )
+        print_error("%lu statistics samples are not numbers",
+                    (unsigned long)sm->invalid);
+
+    char* q_list = strdup((quantiles != NULL) ? quantiles : "50,95,99");
+    is_memory_allocated(q_list);
+    uint32_t rows_count = 7 + get_elements_count(',', q_list);
+    struct table_cell** table_data = calloc(rows_count,
+                                            sizeof(struct table_cell*));
+    is_memory_allocated(table_data);
+    uint16_t* cells_in_row = calloc(rows_count, sizeof(uint16_t));
+    is_memory_allocated(cells_in_row);
+
+    double n = sm->count;
+    double variance = (sm->count > 1) ? sm->m2 / (n - 1) : ((n) ? 0 : NAN);
+    struct num_format count_fmt = { NUM_FIXED, 0, fmt->thousands_sep };
+    uint32_t row = 0;
+    add_stats_row(table_data, cells_in_row, row++, "count", n, &count_fmt);
+    add_stats_row(table_data, cells_in_row, row++, "sum", sm->sum, fmt);
+    add_stats_row(table_data, cells_in_row, row++, "mean",
+                  (n) ? sm->mean : NAN, fmt);
+    add_stats_row(table_data, cells_in_row, row++, "stddev", sqrt(variance),
+                  fmt);
+    add_stats_row(table_data, cells_in_row, row++, "variance", variance, fmt);
+    add_stats_row(table_data, cells_in_row, row++, "min",
+                  (n) ? sm->td.min : NAN, fmt);
+    char* save = NULL;
+    for ( char* q = strtok_r(q_list, ",", &save); q != NULL;
+          q = strtok_r(NULL, ",", &save) ) {
+        char name[NUMBER_STR_MAX + 2];
+        snprintf(name, sizeof(name), "p%s", q);
+        double p = strtod(q, NULL);
+        if ( is_number(q, 1) == 0 || p < 0 || p > 100 ) {
+            print_error("invalid quantile \"%s\"", q);
+            rows_count--;
+            continue;
+        }
+
+        add_stats_row(table_data, cells_in_row, row++, name,
+                      tdigest_quantile(&sm->td, p / 100), fmt);
+    }
+
+    add_stats_row(table_data, cells_in_row, row++, "max",
+                  (n) ? sm->td.max : NAN, fmt);
+
+    tdigest_free(&sm->td);
+    free(job.summaries);
+    free(job.bounds);
+    free(q_list);
+    return render_table(table_data, rows_count, cells_in_row, nb, nb, NULL);
+}
+
+
+/***************************************************************************
+* functions for working with charts
+***************************************************************************/
+void merge_chart_bucket(struct chart_bucket* dst,
+                        const struct chart_bucket* src)
+{
+    /* src follows dst in the series */
+    dst->count += src->count;
+    dst->min = (src->min < dst->min) ? src->min : dst->min;
+    dst->max = (src->max > dst->max) ? src->max : dst->max;
+    dst->sum += src->sum;
+    dst->last = src->last;
+}
+
+void add_chart_sample(struct chart_series* cs, double value)
+{
+    /* the length of the series is not known: when all the buckets are full,
+       neighbours are merged and every bucket takes twice as many samples */
+    struct chart_bucket* b = (cs->count > 0) ? &cs->buckets[cs->count - 1]
+                                             : NULL;
+    if ( b == NULL || b->count == cs->per_bucket ) {
+        if ( cs->count == CHART_BUCKETS ) {
+            for ( uint32_t i=0; i<CHART_BUCKETS / 2; i++ ) {
+                cs->buckets[i] = cs->buckets[2 * i];
+                merge_chart_bucket(&cs->buckets[i], &cs->buckets[2 * i + 1]);
+            }
+
+            cs->count = CHART_BUCKETS / 2;
+            cs->per_bucket *= 2;
+        }
+
+        b = &cs->buckets[cs->count++];
+        b->count = 1;
+        b->min = b->max = b->sum = b->last = value;
+        cs->samples++;
+        return;
+    }
+
+    b->count++;
+    b->min = (value < b->min) ? value : b->min;
+    b->max = (value > b->max) ? value : b->max;
+    b->sum += value;
+    b->last = value;
+    cs->samples++;
+}
+
+void get_chart_series(const char* data, uint64_t size,
+                      struct chart_series* cs)
+{
+    /* one pass, the memory does not depend on the length of the series */
+    cs->buckets = calloc(CHART_BUCKETS, sizeof(struct chart_bucket));
+    is_memory_allocated(cs->buckets);
+    cs->count = 0;
+    cs->per_bucket = 1;
+    cs->samples = 0;
+    cs->invalid = 0;
+
+    double block[SAMPLES_BLOCK];
+    const char* pos = data;
+    const char* end = data + size;
+    uint32_t n;
+    while ( (n = parse_samples(&pos, end, block, SAMPLES_BLOCK,
+                               &cs->invalid)) > 0 ) {
+        for ( uint32_t i=0; i<n; i++ )
+            add_chart_sample(cs, block[i]);
+    }
+}
+
+uint16_t get_chart_level(double value, double min, double max,
+                         uint16_t height)
+{
+    if ( max <= min )
+        return (height - 1) / 2;
+
+    return (uint16_t)round((value - min) / (max - min) * (height - 1));
+}
+
+char* render_chart(struct chart_series* cs, uint16_t height, uint8_t bars,
+                   char sym, const struct num_format* fmt)
+{
+    /* min/max of every column, bars show the mean of the column;
+       the buckets are freed here */
+    double min = INFINITY, max = -INFINITY;
+    for ( uint32_t i=0; i<cs->count; i++ ) {
+        min = (cs->buckets[i].min < min) ? cs->buckets[i].min : min;
+        max = (cs->buckets[i].max > max) ? cs->buckets[i].max : max;
+    }
+
+    char labels[3][NUMBER_STR_MAX];
+    format_number(max, fmt, labels[0]);
+    format_number(min + (max - min) * ((height - 1) / 2) / (height - 1), fmt,
+                  labels[1]);
+    format_number(min, fmt, labels[2]);
+    uint16_t label_len = 0;
+    for ( uint8_t i=0; i<3; i++ )
+        label_len = (strlen(labels[i]) > label_len) ? strlen(labels[i])
+                                                    : label_len;
+
+    uint16_t chart_width = 1;
+    if ( label_len + 4 < DOC_WIDTH )
+        chart_width = DOC_WIDTH - label_len - 4;
+
+    uint32_t columns = (cs->count < chart_width) ? cs->count : chart_width;
+    char* grid = calloc((uint64_t)columns * height, sizeof(char));
+    is_memory_allocated(grid);
+    memset(grid, ' ', (uint64_t)columns * height);
+
+    double base = (min > 0) ? min : ((max < 0) ? max : 0);
+    uint16_t base_level = get_chart_level(base, min, max, height);
+    uint16_t prev_level = 0;
+    for ( uint32_t c=0; c<columns; c++ ) {
+        uint32_t from = (uint64_t)c * cs->count / columns;
+        uint32_t to = (uint64_t)(c + 1) * cs->count / columns;
+        struct chart_bucket col = cs->buckets[from];
+        for ( uint32_t i=from + 1; i<to; i++ )
+            merge_chart_bucket(&col, &cs->buckets[i]);
+
+        uint16_t lo, hi;
+        if ( bars ) {
+            uint16_t level = get_chart_level(col.sum / col.count, min, max,
+                                             height);
+            lo = (level < base_level) ? level : base_level;
+            hi = (level > base_level) ? level : base_level;
+        } else {
+            /* the line joins the last value of the previous column */
+            lo = get_chart_level(col.min, min, max, height);
+            hi = get_chart_level(col.max, min, max, height);
+            if ( c > 0 ) {
+                lo = (prev_level < lo) ? prev_level : lo;
+                hi = (prev_level > hi) ? prev_level : hi;
+            }
+
+            prev_level = get_chart_level(col.last, min, max, height);
+        }
+
+        for ( uint16_t r=lo; r<=hi; r++ )
+            grid[(uint64_t)r * columns + c] = sym;
+    }
+
+    struct str_buf chart;
+    str_buf_init(&chart, (uint64_t)(height + 2) * (DOC_WIDTH + 2) + 1);
+    for ( int32_t r=height - 1; r>=0; r-- ) {
+        const char* label = "";
+        if ( r == height - 1 )
+            label = labels[0];
+        else if ( r == 0 )
+            label = labels[2];
+        else if ( r == (height - 1) / 2 )
+            label = labels[1];
+
+        str_buf_reserve(&chart, label_len + columns + 4);
+        str_buf_append(&chart, " ");
+        for ( uint16_t i=strlen(label); i<label_len; i++ )
+            str_buf_append_n(&chart, " ", 1);
+
+        str_buf_append(&chart, label);
+        str_buf_append(&chart, " |");
+        str_buf_append_n(&chart, &grid[(uint64_t)r * columns], columns);
+        str_buf_append(&chart, "\n");
+    }
+
+    /* the axis and the indexes of the first and the last samples */
+    char last[NUMBER_STR_MAX];
+    struct num_format index_fmt = { NUM_FIXED, 0, '\0' };
+    format_number((cs->samples > 0) ? cs->samples - 1 : 0, &index_fmt, last);
+    str_buf_reserve(&chart, 2 * (label_len + columns + 4));
+    for ( uint16_t i=0; i<label_len + 2; i++ )
+        str_buf_append_n(&chart, " ", 1);
+
+    str_buf_append(&chart, "+");
+    for ( uint32_t i=0; i<columns; i++ )
+        str_buf_append_n(&chart, "-", 1);
+
+    str_buf_append(&chart, "\n");
+    for ( uint16_t i=0; i<label_len + 3; i++ )
+        str_buf_append_n(&chart, " ", 1);
+
+    str_buf_append(&chart, "0");
+    if ( cs->samples > 1 && strlen(last) + 1 < columns ) {
+        for ( uint32_t i=strlen(last) + 1; i<columns; i++ )
+            str_buf_append_n(&chart, " ", 1);
+
+        str_buf_append(&chart, last);
+    }
+
+    free(grid);
+    free(cs->buckets);
+    return chart.data;
+}
+
+
+/***************************************************************************
+* functions for sorting
+***************************************************************************/
+uint64_t get_number_key(double value)
+{
+    /* unsigned order of the keys is the order of the numbers,
+       NAN goes after everything */
+    if ( isnan(value) )
+        return UINT64_MAX;
+
+    if ( value == 0 )
+        value = 0;  /* -0 */
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x8000000000000000ULL) ? ~bits
+                                          : bits | 0x8000000000000000ULL;
+}
+
+uint64_t get_text_key(const char* text, uint32_t len)
+{
+    /* the first 8 bytes, big-endian */
+    uint64_t key = 0;
+    for ( uint8_t i=0; i<8; i++ )
+        key = (key << 8) | ((i < len) ? (uint8_t)text[i] : 0);
+
+    return key;
+}
+
+void set_sort_item(struct sort_item* item, uint32_t row, const char* text,
+                   uint32_t len, double value, uint8_t numeric)
+{
+    item->row  = row;
+    item->text = text;
+    item->len  = len;
+    item->key  = (numeric) ? get_number_key(value) : get_text_key(text, len);
+}
+
+void radix_sort_items(struct sort_item* items, uint32_t count, uint8_t desc)
+{
+    /* LSD by bytes, stable; bytes that are equal in all keys are skipped */
+    if ( desc ) {
+        for ( uint32_t i=0; i<count; i++ )
+            if ( items[i].key != UINT64_MAX )
+                items[i].key = ~items[i].key - 1;
+    }
+
+    uint32_t (*hist)[256] = calloc(8, sizeof(*hist));
+    is_memory_allocated(hist);
+    for ( uint32_t i=0; i<count; i++ )
+        for ( uint8_t b=0; b<8; b++ )
+            hist[b][(items[i].key >> (8 * b)) & 0xff]++;
+
+    struct sort_item* tmp = calloc(count + 1, sizeof(struct sort_item));
+    is_memory_allocated(tmp);
+    struct sort_item* from = items;
+    struct sort_item* to = tmp;
+    for ( uint8_t b=0; b<8; b++ ) {
+        uint32_t sum = 0;
+        uint8_t trivial = 0;
+        for ( uint16_t d=0; d<256; d++ ) {
+            if ( hist[b][d] == count )
+                trivial = 1;
+
+            uint32_t n = hist[b][d];
+            hist[b][d] = sum;
+            sum += n;
+        }
+
+        if ( trivial )
+            continue;
+
+        for ( uint32_t i=0; i<count; i++ )
+            to[hist[b][(from[i].key >> (8 * b)) & 0xff]++] = from[i];
+
+        struct sort_item* swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if ( from != items )
+        memcpy(items, from, count * sizeof(struct sort_item));
+
+    free(tmp);
+    free(hist);
+}
+
+int compare_text_items(const struct sort_item* a, const struct sort_item* b)
+{
+    if ( a->key != b->key )
+        return (a->key < b->key) ? -1 : 1;
+
+    uint32_t len = (a->len < b->len) ? a->len : b->len;
+    if ( len > 8 ) {
+        int cmp = memcmp(a->text + 8, b->text + 8, len - 8);
+        if ( cmp != 0 )
+            return cmp;
     }
 
-    if ( header_type == 1 && sep_sym == '\0' )
-        sep_sym = '=';
-    
-    uint8_t doc_width_bak = DOC_WIDTH;
-    if ( DOC_WIDTH < strlen(str) )
-        set_doc_width(strlen(str) + 4);
-    
-    char* header = NULL;
-    uint16_t len = DOC_WIDTH + 1;
-    if ( header_type == 1 ) {
-        char* centered_str = center(str, NULL);
-        len = DOC_WIDTH * 2 + strlen(centered_str) + 3;
-        header = calloc(len, sizeof(char));
-        is_memory_allocated(header);
-        char* tmp = get_str_from_sym(sep_sym, DOC_WIDTH);
-        sprintf(header, "%s\n%s\n%s", tmp, centered_str, tmp);
-        free(tmp);
-        free(centered_str);
-    } else {
-        header = calloc(len, sizeof(char));
-        is_memory_allocated(header);
-        if ( sep_sym == '\0' )
-            sep_sym = (header_type == 2) ? '=' : '-';
-        
-        char* tmp = get_str_from_sym(sep_sym, (DOC_WIDTH-strlen(str) - 1) / 2);
-        sprintf(header, "%s %s ", tmp, str);
-        free(tmp);
-        tmp = get_str_from_sym(sep_sym, DOC_WIDTH - strlen(header));
-        strcat(header, tmp);
-        free(tmp);
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+void merge_sort_items(struct sort_item* items, uint32_t count, uint8_t desc)
+{
+    /* bottom-up and stable: insertion sort of short runs, then merges;
+       the keys hold the first bytes, so most comparisons stay in the array */
+    const uint32_t run = 32;
+    for ( uint32_t start=0; start<count; start+=run ) {
+        uint32_t end = (start + run < count) ? start + run : count;
+        for ( uint32_t i=start + 1; i<end; i++ ) {
+            struct sort_item item = items[i];
+            uint32_t j = i;
+            while ( j > start ) {
+                int cmp = compare_text_items(&items[j - 1], &item);
+                if ( (desc) ? cmp >= 0 : cmp <= 0 )
+                    break;
+
+                items[j] = items[j - 1];
+                j--;
+            }
+
+            items[j] = item;
+        }
     }
 
-    set_doc_width(doc_width_bak);
-    return header;
+    struct sort_item* tmp = calloc(count + 1, sizeof(struct sort_item));
+    is_memory_allocated(tmp);
+    struct sort_item* from = items;
+    struct sort_item* to = tmp;
+    for ( uint32_t width=run; width<count; width*=2 ) {
+        for ( uint32_t lo=0; lo<count; lo+=2 * width ) {
+            uint32_t mid = (lo + width < count) ? lo + width : count;
+            uint32_t hi = (mid + width < count) ? mid + width : count;
+            uint32_t i = lo, j = mid, k = lo;
+            while ( i < mid && j < hi ) {
+                int cmp = compare_text_items(&from[i], &from[j]);
+                if ( (desc) ? cmp >= 0 : cmp <= 0 )
+                    to[k++] = from[i++];
+                else
+                    to[k++] = from[j++];
+            }
+
+            while ( i < mid )
+                to[k++] = from[i++];
+
+            while ( j < hi )
+                to[k++] = from[j++];
+        }
+
+        struct sort_item* swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if ( from != items )
+        memcpy(items, from, count * sizeof(struct sort_item));
+
+    free(tmp);
 }
 
-/***************************************************************************
-* functions for working with tables
-***************************************************************************/
-uint16_t get_rows_count(char* tbl_str)
+void sort_items(struct sort_item* items, uint32_t count, uint8_t numeric,
+                uint8_t desc)
 {
-    return get_elements_count('\n', tbl_str);
+    if ( numeric )
+        radix_sort_items(items, count, desc);
+    else
+        merge_sort_items(items, count, desc);
 }
 
-uint16_t* get_cells_count(char* tbl_str)
+uint8_t get_table_sort(char** attrs, struct table_sort* ts)
 {
-    uint16_t  rows_count   = get_rows_count(tbl_str);
-    uint16_t* cells_in_row = calloc(rows_count, sizeof(uint16_t));
-    is_memory_allocated(cells_in_row);
-    char** rows = split('\n', tbl_str);
-    for ( uint16_t i=0; i<rows_count; i++ ) {
-        cells_in_row[i] = get_elements_count('|', rows[i]);
-        free(rows[i]);
+    /* sort=N - by the column N (from 1), desc, hdr - keep the first row */
+    char* column = get_attr_value(attrs, "sort");
+    if ( column == NULL )
+        return 0;
+
+    if ( is_number(column, 0) == 0 || atoi(column) < 1 ||
+         atoi(column) > UINT16_MAX ) {
+        print_error("invalid sort column \"%s\"", column);
+        return 0;
     }
 
-    free(rows);
-    return cells_in_row;
+    ts->column = atoi(column) - 1;
+    ts->desc = in_str_array(attrs, "desc");
+    ts->hdr = in_str_array(attrs, "hdr");
+    return 1;
 }
 
-char*** get_table_data(char* tbl_str)
+void sort_table(struct table_cell** table_data, uint32_t rows_count,
+                uint16_t* cells_in_row, const struct table_sort* ts)
 {
-    uint16_t  rows_count   = get_rows_count(tbl_str);
-    char**    rows         = split('\n', tbl_str);
-    char***   table_data   = (char***)calloc(rows_count, sizeof(char**));
-    is_memory_allocated(table_data);
-    for ( uint16_t i=0; i<rows_count; i++ ) {
-        table_data[i] = split('|', rows[i]);
-        free(rows[i]);
+    /* only the row pointers move; numbers are compared by value if all the
+       cells in the column are numbers, rows without the column go last */
+    uint32_t first = (ts->hdr && rows_count > 0) ? 1 : 0;
+    uint32_t count = rows_count - first;
+    if ( count < 2 )
+        return;
+
+    uint8_t numeric = 1;
+    for ( uint32_t i=first; i<rows_count && numeric; i++ ) {
+        if ( ts->column < cells_in_row[i] &&
+             isnan(table_data[i][ts->column].value) )
+            numeric = 0;
+    }
+
+    struct sort_item* items = calloc(count, sizeof(struct sort_item));
+    is_memory_allocated(items);
+    uint32_t sorted = 0;
+    for ( uint32_t i=first; i<rows_count; i++ ) {
+        if ( ts->column < cells_in_row[i] ) {
+            struct table_cell* cell = &table_data[i][ts->column];
+            set_sort_item(&items[sorted++], i, cell->text, cell->len,
+                          cell->value, numeric);
+        }
+    }
+
+    sort_items(items, sorted, numeric, ts->desc);
+    for ( uint32_t i=first; i<rows_count; i++ ) {
+        if ( ts->column >= cells_in_row[i] )
+            items[sorted++].row = i;
     }
 
+    struct table_cell** rows = calloc(count, sizeof(struct table_cell*));
+    is_memory_allocated(rows);
+    uint16_t* cells = calloc(count, sizeof(uint16_t));
+    is_memory_allocated(cells);
+    for ( uint32_t i=0; i<count; i++ ) {
+        rows[i]  = table_data[items[i].row];
+        cells[i] = cells_in_row[items[i].row];
+    }
+
+    memcpy(&table_data[first], rows, count * sizeof(struct table_cell*));
+    memcpy(&cells_in_row[first], cells, count * sizeof(uint16_t));
     free(rows);
-    return table_data;
+    free(cells);
+    free(items);
 }
 
-uint16_t* get_cells_len(char** row, uint16_t cells_count)
+uint32_t* sort_lines(char** lines, uint32_t count, uint8_t desc)
 {
-    uint16_t* cells_len = calloc(cells_count, sizeof(uint16_t));
-    is_memory_allocated(cells_len);
-    for ( uint16_t i=0; i<cells_count; i++ )
-        cells_len[i] = strlen(row[i]);
+    /* the order of the lines, by value if all of them are numbers */
+    struct sort_item* items = calloc(count + 1, sizeof(struct sort_item));
+    is_memory_allocated(items);
+    double* values = calloc(count + 1, sizeof(double));
+    is_memory_allocated(values);
+    uint8_t numeric = 1;
+    for ( uint32_t i=0; i<count; i++ ) {
+        if ( parse_number(lines[i], strlen(lines[i]), &values[i])
+             != PARSE_NUMBER )
+            numeric = 0;
+    }
 
-    return cells_len;
+    for ( uint32_t i=0; i<count; i++ )
+        set_sort_item(&items[i], i, lines[i], strlen(lines[i]), values[i],
+                      numeric);
+
+    sort_items(items, count, numeric, desc);
+    uint32_t* order = calloc(count + 1, sizeof(uint32_t));
+    is_memory_allocated(order);
+    for ( uint32_t i=0; i<count; i++ )
+        order[i] = items[i].row;
+
+    free(values);
+    free(items);
+    return order;
 }
 
-uint16_t* get_rows_len(char*** table_data, uint16_t rows_count,
-                       const uint16_t* cells_in_row)
+
+/***************************************************************************
+* functions for joining tables
+***************************************************************************/
+uint8_t get_table_join(char** attrs, struct table_join* tj)
 {
-    uint16_t* rows_len = calloc(rows_count, sizeof(uint16_t));
-    is_memory_allocated(rows_len);
-    for ( uint16_t i=0; i<rows_count; i++ ) {
-        uint16_t row_len = 0;
-        for ( uint16_t j=0; j<cells_in_row[i]; j++ )
-            row_len += strlen(table_data[i][j]);
+    /* join=file on=N[:M] - column N of the table, column M of the file */
+    tj->path = get_attr_value(attrs, "join");
+    if ( tj->path == NULL )
+        return 0;
 
-        rows_len[i] = row_len + cells_in_row[i] - 1;
+    tj->left_col = 0;
+    tj->right_col = 0;
+    tj->hdr = in_str_array(attrs, "hdr");
+    char* on = get_attr_value(attrs, "on");
+    if ( on != NULL ) {
+        char* colon = strchr(on, ':');
+        int left = atoi(on);
+        int right = (colon != NULL) ? atoi(colon + 1) : left;
+        if ( left < 1 || right < 1 ||
+             left > UINT16_MAX || right > UINT16_MAX ) {
+            print_error("invalid join columns \"%s\"", on);
+            return 0;
+        }
+
+        tj->left_col = left - 1;
+        tj->right_col = right - 1;
     }
 
-    return rows_len;
+    return 1;
 }
 
-char* get_table_border(const char* row1, const char* row2)
+struct table_cell** load_join_table(char* path, uint32_t* rows_count,
+                                    uint16_t** cells_in_row)
 {
-    uint16_t row_len = strlen(row1);
-    char* border = calloc(row_len + 1, sizeof(char));
-    is_memory_allocated(border);
-    for ( uint16_t i=0; i<row_len; i++ ) {
-        if ( row1[i] == '|' || row2[i] == '|' )
-            strcat(border, "+");
-        else
-            strcat(border, "-");
+    /* .csv and .tsv files are parsed as CSV, others as table rows */
+    char* ext = strrchr(path, '.');
+    if ( ext != NULL &&
+         (strcmp(ext, ".csv") == 0 || strcmp(ext, ".tsv") == 0) ) {
+        uint64_t size;
+        char* data = map_file(path, &size);
+        if ( data == NULL )
+            return NULL;
+
+        struct csv_data csv;
+        parse_csv(data, size, (strcmp(ext, ".tsv") == 0) ? '\t' : ',', &csv);
+        struct table_cell** table_data = get_csv_table_data(data, &csv,
+                                                            cells_in_row);
+        *rows_count = csv.rows_count;
+        free_csv_data(&csv);
+        unmap_file(data, size);
+        return table_data;
     }
 
-    return border;
+    char* content = get_file_content(path);
+    if ( content == NULL )
+        return NULL;
+
+    *rows_count = get_rows_count(content);
+    *cells_in_row = get_cells_count(content);
+    struct table_cell** table_data = get_table_data(content);
+    free(content);
+    return table_data;
 }
 
-char* add_table_border(char* table_str)
+const char* get_key_span(const struct table_cell* row, uint16_t cells_count,
+                         uint16_t column, uint32_t* len)
 {
-    char**   rows = split('\n', table_str);
-    uint16_t rows_count = get_rows_count(table_str);
-    uint16_t row_len = strlen(rows[0]);
-    uint32_t len = (rows_count * 2 + 1) * (row_len + 1);
-    char*    table = calloc(len, sizeof(char));
-    is_memory_allocated(table);
-    char* space_str = get_str_from_sym(' ', row_len);
-    for ( uint16_t i=0; i<rows_count; i++ ) {
-        char* row1;
-        char* row2;
-        if ( i == 0 ) {
-            row1 = space_str;
-            row2 = rows[i];
-        } else if ( i == rows_count - 1 ) {
-            row1 = rows[i];
-            row2 = space_str;
-        } else {
-            row1 = rows[i - 1];
-            row2 = rows[i];
+    /* the cell text without spaces around it */
+    if ( column >= cells_count ) {
+        *len = 0;
+        return NULL;
+    }
+
+    const char* text = row[column].text;
+    uint32_t end = row[column].len;
+    while ( *text == ' ' && end > 0 ) {
+        text++;
+        end--;
+    }
+
+    while ( end > 0 && text[end - 1] == ' ' )
+        end--;
+
+    *len = end;
+    return text;
+}
+
+uint64_t hash_key(const char* key, uint32_t len)
+{
+    /* FNV-1a */
+    uint64_t hash = 14695981039346656037ULL;
+    for ( uint32_t i=0; i<len; i++ ) {
+        hash ^= (uint8_t)key[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+void build_join_index(struct join_index* ji, struct table_cell** table_data,
+                      uint32_t rows_count, const uint16_t* cells_in_row,
+                      uint16_t column, uint32_t first)
+{
+    /* open addressing with linear probing; a slot holds the first row with
+       the key, rows with the same key follow it through next[] */
+    uint64_t capacity = 16;
+    while ( capacity < 2 * (uint64_t)rows_count )
+        capacity *= 2;
+
+    ji->mask = capacity - 1;
+    ji->table_data = table_data;
+    ji->cells_in_row = cells_in_row;
+    ji->column = column;
+    ji->slots = calloc(capacity, sizeof(uint32_t));
+    is_memory_allocated(ji->slots);
+    ji->next = calloc(rows_count + 1, sizeof(uint32_t));
+    is_memory_allocated(ji->next);
+    ji->tail = calloc(rows_count + 1, sizeof(uint32_t));
+    is_memory_allocated(ji->tail);
+
+    for ( uint32_t i=first; i<rows_count; i++ ) {
+        uint32_t len;
+        const char* key = get_key_span(table_data[i], cells_in_row[i], column,
+                                       &len);
+        ji->next[i] = JOIN_END;
+        if ( key == NULL )
+            continue;
+
+        uint64_t slot = hash_key(key, len) & ji->mask;
+        while ( ji->slots[slot] != 0 ) {
+            uint32_t head = ji->slots[slot] - 1;
+            uint32_t head_len;
+            const char* head_key = get_key_span(table_data[head],
+                                                cells_in_row[head], column,
+                                                &head_len);
+            if ( head_len == len && memcmp(head_key, key, len) == 0 )
+                break;
+
+            slot = (slot + 1) & ji->mask;
         }
 
-        char* border = get_table_border(row1, row2);
-        strcat(table, border);
-        strcat(table, "\n");
-        strcat(table, rows[i]);
-        if ( i != rows_count - 1 ) {
-            free(border);
-            strcat(table, "\n");
+        if ( ji->slots[slot] == 0 ) {
+            ji->slots[slot] = i + 1;
+            ji->tail[i] = i;
         } else {
-            strcat(table, "\n");
-            strcat(table, border);
-            free(border);
+            uint32_t head = ji->slots[slot] - 1;
+            ji->next[ji->tail[head]] = i;
+            ji->tail[head] = i;
         }
     }
-    /* Cleaning */
-    for ( uint16_t i=0; i<rows_count; i++ )
-        free(rows[i]);
+}
 
-    free(rows);
-    free(space_str);
+uint32_t find_join_rows(const struct join_index* ji, const char* key,
+                        uint32_t len)
+{
+    /* the first row with the key, JOIN_END if there is none */
+    uint64_t slot = hash_key(key, len) & ji->mask;
+    while ( ji->slots[slot] != 0 ) {
+        uint32_t head = ji->slots[slot] - 1;
+        uint32_t head_len;
+        const char* head_key = get_key_span(ji->table_data[head],
+                                            ji->cells_in_row[head],
+                                            ji->column, &head_len);
+        if ( head_len == len && memcmp(head_key, key, len) == 0 )
+            return head;
+
+        slot = (slot + 1) & ji->mask;
+    }
 
-    return table;
+    return JOIN_END;
 }
 
-void calc_in_table(char*** table_data, uint16_t rows_count,
-                   const uint16_t* cells_in_row)
+void free_join_index(struct join_index* ji)
 {
-    char* calc_res = NULL;
-    for ( uint16_t i=0; i<rows_count; i++ ) {
-        for ( uint16_t j=0; j<cells_in_row[i]; j++ ) {
-            char* tmp = calloc(strlen(table_data[i][j]) + 1, sizeof(char));
-            strcpy(tmp, table_data[i][j]);
-            change_symbols(',', '.', tmp);
+    free(ji->slots);
+    free(ji->next);
+    free(ji->tail);
+}
 
-            calc_res = calc(tmp, NULL);
-            if ( strcmp(calc_res, "error") != 0 ) {
-                free(table_data[i][j]);
-                table_data[i][j] = strdup(calc_res);
-            }
+struct table_cell* get_joined_row(struct table_cell* left, uint16_t left_count,
+                                  const struct table_cell* right,
+                                  uint16_t right_count, uint16_t right_col,
+                                  uint16_t right_width, uint8_t move,
+                                  uint16_t* count)
+{
+    /* the left cells, then the right ones without the key; a left row
+       without a match gets empty cells; move - the left texts are taken */
+    uint32_t n = left_count + ((right_width > 0) ? right_width - 1 : 0);
+    *count = (n > UINT16_MAX) ? UINT16_MAX : n;
+    struct table_cell* row = calloc(*count + 1, sizeof(struct table_cell));
+    is_memory_allocated(row);
+    n = 0;
+    for ( uint16_t j=0; j<left_count && n<*count; j++, n++ ) {
+        row[n] = left[j];
+        if ( move == 0 ) {
+            row[n].text = strdup(left[j].text);
+            is_memory_allocated(row[n].text);
+        }
+    }
 
-            free(calc_res);
-            free(tmp);
+    for ( uint16_t j=0; j<right_width && n<*count; j++ ) {
+        if ( j == right_col )
+            continue;
+
+        if ( j < right_count ) {
+            row[n] = right[j];
+            row[n].text = strdup(right[j].text);
+        } else {
+            row[n].text = strdup("");
+            row[n].kind = PARSE_NOT_NUMBER;
+            row[n].value = NAN;
         }
+
+        is_memory_allocated(row[n].text);
+        n++;
     }
+
+    return row;
 }
 
-uint16_t** get_column_width(char*** table_data, uint16_t rows_count,
-                            uint16_t* cells_in_row)
+struct table_cell** join_tables(struct table_cell** table_data,
+                                uint32_t* rows_count, uint16_t** cells_in_row,
+                                const struct table_join* tj)
 {
-    uint16_t max_cells = get_max(cells_in_row, rows_count);
-    /* Memory allocation */
-    uint16_t** column_width = calloc(max_cells, sizeof(uint16_t*));
-    is_memory_allocated(column_width);
-    for ( uint16_t i=0; i<max_cells; i++ ) {
-        column_width[i] = calloc(i + 1, sizeof(uint16_t));
-        is_memory_allocated(column_width[i]);
+    /* left join in linear time: the rows of the file are indexed by key and
+       every row of the table probes the index; the table is freed here */
+    uint32_t right_rows = 0;
+    uint16_t* right_cells = NULL;
+    struct table_cell** right = load_join_table(tj->path, &right_rows,
+                                                &right_cells);
+    if ( right == NULL )
+        return table_data;
+
+    uint8_t hdr = (tj->hdr && right_rows > 0 && *rows_count > 0);
+    uint16_t right_width = get_max(right_cells, right_rows);
+    if ( right_width <= tj->right_col )
+        right_width = tj->right_col + 1;
+
+    struct join_index ji;
+    build_join_index(&ji, right, right_rows, right_cells, tj->right_col, hdr);
+
+    /* pass one: the first match of every row and the size of the result */
+    uint32_t* match = calloc(*rows_count + 1, sizeof(uint32_t));
+    is_memory_allocated(match);
+    uint64_t joined_count = 0;
+    for ( uint32_t i=0; i<*rows_count; i++ ) {
+        uint32_t len;
+        const char* key = get_key_span(table_data[i], (*cells_in_row)[i],
+                                       tj->left_col, &len);
+        if ( i == 0 && hdr )
+            match[i] = 0;
+        else
+            match[i] = (key != NULL) ? find_join_rows(&ji, key, len)
+                                     : JOIN_END;
+
+        joined_count++;
+        if ( i == 0 && hdr )
+            continue;
+
+        for ( uint32_t r=match[i]; r != JOIN_END && ji.next[r] != JOIN_END;
+              r = ji.next[r] )
+            joined_count++;
     }
 
-    for ( uint16_t i=0; i<rows_count; i++ ) {
-        for ( uint16_t j=0; j<cells_in_row[i]; j++ ) {
-            if ( strlen(table_data[i][j]) > column_width[cells_in_row[i]-1][j] )
-                column_width[cells_in_row[i] - 1][j] = strlen(table_data[i][j]);
+    if ( joined_count > UINT32_MAX ) {
+        print_error("the joined table is too large");
+        free(match);
+        free_join_index(&ji);
+        free_table_data(right, right_rows, right_cells);
+        free(right_cells);
+        return table_data;
+    }
+
+    /* pass two: the rows */
+    struct table_cell** joined = calloc(joined_count + 1,
+                                        sizeof(struct table_cell*));
+    is_memory_allocated(joined);
+    uint16_t* joined_cells = calloc(joined_count + 1, sizeof(uint16_t));
+    is_memory_allocated(joined_cells);
+    uint32_t k = 0;
+    for ( uint32_t i=0; i<*rows_count; i++ ) {
+        struct table_cell* left = table_data[i];
+        uint16_t left_count = (*cells_in_row)[i];
+        uint32_t r = match[i];
+        if ( r == JOIN_END ) {
+            joined[k] = get_joined_row(left, left_count, NULL, 0,
+                                       tj->right_col, right_width, 1,
+                                       &joined_cells[k]);
+            k++;
+        }
+
+        while ( r != JOIN_END ) {
+            uint32_t next = (i == 0 && hdr) ? JOIN_END : ji.next[r];
+            joined[k] = get_joined_row(left, left_count, right[r],
+                                       right_cells[r], tj->right_col,
+                                       right_width, next == JOIN_END,
+                                       &joined_cells[k]);
+            k++;
+            r = next;
         }
+
+        free(left);
     }
 
-    return column_width;
+    free(match);
+    free_join_index(&ji);
+    free_table_data(right, right_rows, right_cells);
+    free(right_cells);
+    free(table_data);
+    free(*cells_in_row);
+    *rows_count = k;
+    *cells_in_row = joined_cells;
+    return joined;
 }
 
-void align_to_columns(char*** table_data, uint16_t rows_count,
-                      uint16_t* cells_in_row, uint8_t na)
+
+/***************************************************************************
+* functions for working with templates
+***************************************************************************/
+void add_template_part(struct template* tpl, const char* text, uint32_t len,
+                       int32_t field)
 {
-    uint16_t** column_width = get_column_width(table_data, rows_count,
-                                               cells_in_row);
-    char* align = NULL;
-    char* tmp = NULL;
-    for ( uint16_t i=0; i<rows_count; i++ ) {
-        for ( uint16_t j=0; j<cells_in_row[i]; j++ ) {
-            uint16_t al_len = column_width[cells_in_row[i] - 1][j] \
-                - strlen(table_data[i][j]);
-            if ( al_len > 0 ) {
-                align = get_str_from_sym(' ', al_len);
-                tmp = strdup(table_data[i][j]);
-                free(table_data[i][j]);
-                table_data[i][j] = calloc(al_len + strlen(tmp) + 1, sizeof(char));
-                if ( is_number(tmp, 2) && na == 0 )
-                    sprintf(table_data[i][j], "%s%s", align, tmp);
-                else
-                    sprintf(table_data[i][j], "%s%s", tmp, align);
-                
-                free(tmp);
-                free(align);
-            }
-        }
+    if ( tpl->count == tpl->cap ) {
+        tpl->cap = (tpl->cap == 0) ? 16 : tpl->cap * 2;
+        tpl->parts = realloc(tpl->parts,
+                             tpl->cap * sizeof(struct template_part));
+        is_memory_allocated(tpl->parts);
     }
-    /* Cleaning */
-    uint16_t max_cells = get_max(cells_in_row, rows_count);
-    for ( uint16_t i=0; i<max_cells; i++ )
-        free(column_width[i]);
-    
-    free(column_width);
+
+    tpl->parts[tpl->count].text = text;
+    tpl->parts[tpl->count].len = len;
+    tpl->parts[tpl->count].field = field;
+    tpl->count++;
 }
 
-uint16_t get_max_row_len(char*** table_data, uint16_t rows_count,
-                         uint16_t* cells_in_row)
+int32_t get_template_field(const char* name, uint32_t len, char** names,
+                           uint16_t names_count)
 {
-    uint16_t max_row_len = 0;
-    uint16_t max_cells = get_max(cells_in_row, rows_count);
-    uint16_t** column_width = get_column_width(table_data, rows_count,
-                                               cells_in_row);
-    for ( uint16_t i=0; i<max_cells; i++ ) {
-        uint16_t row_len = 0;
-        for ( uint16_t j=0; j<=i; j++ )
-            row_len += column_width[i][j];
-        
-        row_len += i;
-        if ( row_len > max_row_len )
-            max_row_len = row_len;
+    /* {{N}} - column N, {{#}} - number of the record, {{name}} - a column
+       from the header */
+    if ( len == 1 && name[0] == '#' )
+        return TEMPLATE_INDEX;
+
+    uint32_t i = 0;
+    while ( i < len && isdigit((unsigned char)name[i]) )
+        i++;
+
+    if ( i == len && len > 0 && len < 6 && atoi(name) >= 1 )
+        return atoi(name) - 1;
+
+    for ( uint16_t j=0; j<names_count; j++ ) {
+        if ( strlen(names[j]) == len && memcmp(names[j], name, len) == 0 )
+            return j;
     }
-    /* Cleaning */
-    for ( uint16_t i=0; i<max_cells; i++ )
-        free(column_width[i]);
-    
-    free(column_width);
-    return max_row_len;
-}
 
+    return TEMPLATE_TEXT;
+}
 
-/***************************************************************************
-* functions for working with Histograms
-***************************************************************************/
-double get_max_value(char** values, uint16_t values_count)
+void compile_template(const char* text, char** names, uint16_t names_count,
+                      struct template* tpl)
 {
-    double max_value = 0;
-    for ( uint16_t i=0; i<values_count; i++ ) {
-        if ( is_number(values[i], 1) ) {
-            double vl = strtod(values[i], NULL);
-            vl = (vl < 0) ? vl * (double)-1 : vl;/* abs */
-            max_value = (max_value < vl) ? vl : max_value;
+    /* the text is split once into literal parts and placeholders */
+    tpl->parts = NULL;
+    tpl->count = 0;
+    tpl->cap = 0;
+    tpl->has_tags = (strchr(text, '<') != NULL);
+    const char* pos = text;
+    const char* open;
+    while ( (open = strstr(pos, "{{")) != NULL ) {
+        const char* close = strstr(open + 2, "}}");
+        if ( close == NULL )
+            break;
+
+        int32_t field = get_template_field(open + 2, close - open - 2, names,
+                                           names_count);
+        if ( field == TEMPLATE_TEXT ) {
+            print_error("unknown field \"%.*s\"",
+                        (int)(close - open - 2), open + 2);
+            add_template_part(tpl, pos, close + 2 - pos, TEMPLATE_TEXT);
+        } else {
+            if ( open > pos )
+                add_template_part(tpl, pos, open - pos, TEMPLATE_TEXT);
+
+            add_template_part(tpl, NULL, 0, field);
         }
+
+        pos = close + 2;
     }
-    return max_value;
+
+    if ( *pos != '\0' )
+        add_template_part(tpl, pos, strlen(pos), TEMPLATE_TEXT);
 }
 
-void get_histogram_data(char* str, char** names, char** values)
+void expand_template(const struct template* tpl, struct str_buf* sb,
+                     const char* data, const struct csv_data* csv,
+                     uint32_t row, uint32_t index)
 {
-    char** lines = split('\n', str);
-    uint16_t lines_count = get_elements_count('\n', str);
-    for ( uint16_t i=0; i<lines_count; i++ ) {
-        char* name = NULL;
-        char* value = NULL;
-        uint16_t t_count = get_elements_count('|', lines[i]);
-        if ( t_count >= 2 ) {
-            char** t = split('|', lines[i]);
-            name = strdup(t[0]);
-            is_memory_allocated(name);
-
-            value = strdup(t[1]);
-            is_memory_allocated(value);
-
-            if ( strcmp(value, " ") != 0 )
-                value = rm_spaces_from_str(value);
-            
-            change_symbols(',', '.', value);
-            if ( is_number(value, 1) == 0 ) {
-                free(value);
-                value = calloc(6, sizeof(char));
-                is_memory_allocated(value);
-                strcpy(value, "error");
-            }
-            
-            for ( uint16_t j=0; j<t_count; j++ )
-                free(t[j]);
-            
-            free(t);
-        } else if ( t_count == 1 ) {
-            name = calloc(2, sizeof(char));
-            is_memory_allocated(name);
-            strcpy(name, " ");
-
-            change_symbols(',', '.', lines[i]);
-
-            if ( is_number(lines[i], 1) ) {
-                value = calloc(strlen(lines[i]) + 1, sizeof(char));
-                is_memory_allocated(value);
-                strcpy(value, lines[i]);
-            } else {
-                value = calloc(6, sizeof(char));
-                is_memory_allocated(value);
-                strcpy(value, "error");
-            }
+    /* one record; missing fields are empty */
+    uint64_t first = csv->rows[row];
+    uint64_t fields_count = csv->rows[row + 1] - first;
+    for ( uint32_t i=0; i<tpl->count; i++ ) {
+        const struct template_part* part = &tpl->parts[i];
+        if ( part->field == TEMPLATE_TEXT )
+            str_buf_append_n(sb, part->text, part->len);
+        else if ( part->field == TEMPLATE_INDEX ) {
+            struct num_format fmt = { NUM_FIXED, 0, '\0' };
+            str_buf_append_number(sb, index, &fmt);
+        } else if ( (uint64_t)part->field < fields_count )
+            append_csv_text(sb, data, &csv->fields[first + part->field]);
+    }
+}
+
+void compile_macro(const char* text, struct template* tpl)
+{
+    /* {{content}} - the content of the tag, {{N}} - attribute N */
+    tpl->parts = NULL;
+    tpl->count = 0;
+    tpl->cap = 0;
+    tpl->has_tags = (strchr(text, '<') != NULL);
+    const char* pos = text;
+    const char* open;
+    while ( (open = strstr(pos, "{{")) != NULL ) {
+        const char* close = strstr(open + 2, "}}");
+        if ( close == NULL )
+            break;
+
+        uint32_t len = close - open - 2;
+        int32_t field = TEMPLATE_TEXT;
+        if ( len == 7 && strncmp(open + 2, "content", 7) == 0 )
+            field = MACRO_CONTENT;
+        else if ( len > 0 && len < 4 && isdigit((unsigned char)open[2]) &&
+                    atoi(open + 2) >= 1 )
+            field = atoi(open + 2) - 1;
+
+        if ( field == TEMPLATE_TEXT )
+            add_template_part(tpl, pos, close + 2 - pos, TEMPLATE_TEXT);
+        else {
+            if ( open > pos )
+                add_template_part(tpl, pos, open - pos, TEMPLATE_TEXT);
+
+            add_template_part(tpl, NULL, 0, field);
         }
 
-        if ( strcmp(name, " ") != 0 )
-            name = rm_spaces_start_end(name);
-        
-        value = rm_spaces_from_str(value);
-        names[i] = calloc(strlen(name) + 1, sizeof(char));
-        is_memory_allocated(names[i]);
-        values[i] = calloc(strlen(value) + 1, sizeof(char));
-        is_memory_allocated(values[i]);
-        strcpy(names[i], name);
-        strcpy(values[i], value);
-        free(name);
-        free(value);
-        free(lines[i]);
+        pos = close + 2;
     }
-    free(lines);
+
+    if ( *pos != '\0' )
+        add_template_part(tpl, pos, strlen(pos), TEMPLATE_TEXT);
+}
+
+void expand_macro(const struct template* tpl, struct str_buf* sb,
+                  const char* content, char** attrs)
+{
+    /* missing attributes are empty */
+    uint16_t attrs_count = (attrs != NULL) ? get_arr_size(attrs) : 0;
+    for ( uint32_t i=0; i<tpl->count; i++ ) {
+        const struct template_part* part = &tpl->parts[i];
+        if ( part->field == TEMPLATE_TEXT )
+            str_buf_append_n(sb, part->text, part->len);
+        else if ( part->field == MACRO_CONTENT )
+            str_buf_append(sb, content);
+        else if ( part->field < attrs_count )
+            str_buf_append(sb, attrs[part->field]);
+    }
+}
+
+void free_template(struct template* tpl)
+{
+    free(tpl->parts);
 }
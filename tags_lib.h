@@ -10,15 +10,32 @@
 #ifndef TAGS_LIB_H
 #define TAGS_LIB_H
 
+#ifdef __linux__
+#define _GNU_SOURCE                   /* copy_file_range() */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
 #include <time.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "tinyexpr.h"
+#include "parallel.h"
+#include "profile.h"
 #include "tags.h"
 #include "tag_handler.h"
 
@@ -27,37 +44,210 @@ void           exit_on_error         (char* msg,      void* ptr);
 void           is_memory_allocated   (void* mem_ptr);
 void           is_directory_opened   (void* dir_ptr);
 void           print_file_error      (char* filename);
+void           print_error           (const char* format, ...);
 void           print_tag_error       (char* tag);
+void           print_cell_error      (char* cell);
 
 /* files */
 uint16_t       get_files_count       (char* dirname,  char* file_extension);
 char**         get_files_in_dir      (char* dirname,  char* file_extension);
+void           set_doc_paths         (const char* const* paths,
+                                      uint16_t count);
+char*          find_doc_file         (char* filename);
 char*          get_file_content      (char* filename);
 void           write_to_file         (char* filename, char* str);
+char*          map_file              (char* filename, uint64_t* size);
+void           unmap_file            (char* data,     uint64_t size);
 char*          change_file_extension (char* filename, char* extension);
 
+/* files read by a document, see --watch */
+#define        MAX_USED_FILES        1024
+
+char*          get_full_path         (const char* filename);
+void           start_file_tracking   (void);
+void           note_used_file        (const char* filename);
+char**         stop_file_tracking    (uint16_t* count);
+
+/* cache of inserted files, shared by all the threads; it keeps the text as
+   it was read (escaped for <insert>), never a formatted result */
+#define        INSERT_CACHE_SIZE     64  /* MB, or TXTFMT_CACHE_MB */
+#define        INSERT_CACHE_BUCKETS  256
+
+struct cached_file
+{
+    char*      path;
+    dev_t      dev;           /* (path, dev, ino, mtime, size) is the key */
+    ino_t      ino;
+    struct timespec mtime;
+    off_t      size;
+    uint8_t    escaped;       /* for <insert>, not for <include> */
+    char*      text;          /* "<" and ">" replaced if escaped */
+    uint64_t   len;
+    uint32_t   refs;          /* threads using the text */
+    uint8_t    unlinked;      /* out of the cache, freed by the last user */
+    uint32_t   bucket;
+    struct cached_file* next;
+    struct cached_file* newer;  /* LRU list, the newest file first */
+    struct cached_file* older;
+};
+
+struct insert_cache
+{
+    pthread_mutex_t lock;
+    struct cached_file* buckets[INSERT_CACHE_BUCKETS];
+    uint64_t   bytes;
+    uint64_t   max_bytes;
+    uint8_t    ready;
+    struct cached_file* newest;
+    struct cached_file* oldest;
+};
+
+uint64_t       get_insert_cache_size (void);
+void           free_cached_file      (struct cached_file* cf);
+void           add_lru_file          (struct cached_file* cf);
+void           remove_lru_file       (struct cached_file* cf);
+void           unlink_cached_file    (struct cached_file** link);
+uint8_t        evict_cached_files    (uint64_t len);
+struct cached_file** find_cached_file(const char* filename, uint8_t escaped,
+                                      uint32_t bucket);
+uint8_t        is_same_file          (const struct cached_file* cf,
+                                      const struct stat* st);
+struct cached_file* load_cached_file (char* filename, uint8_t escaped,
+                                      const struct stat* st);
+struct cached_file* get_cached_file  (char* filename, uint8_t escaped);
+struct cached_file* get_cached_path  (char* filename, uint8_t escaped);
+void           release_cached_file   (struct cached_file* cf);
+void           free_insert_cache     (void);
+
+/* included fragments */
+#define        MAX_INCLUDE_DEPTH     16
+
+struct include_frame
+{
+    dev_t      dev;
+    ino_t      ino;
+};
+
+uint8_t        push_include          (const struct cached_file* cf);
+void           pop_include           (void);
+
 /* strings */
-uint16_t       get_elements_count    (char  sym,  char* str);
+uint32_t       get_elements_count    (char  sym,  char* str);
 char**         split                 (char  sym,  char* str);
 char*          get_str_from_sym      (char  sym,  uint16_t count);
 void           change_symbols        (char  from, char to, char* str);
 uint8_t        is_number             (char* str,  uint8_t mode);
+#define        PARSE_NOT_NUMBER      0
+#define        PARSE_NUMBER_LIKE     1  /* only digits, '-', '.', ',', ' ' */
+#define        PARSE_NUMBER          2
+uint8_t        parse_number          (const char* str, uint64_t len,
+                                      double* value);
 
-uint16_t       get_number_len        (uint16_t number);
+uint16_t       get_number_len        (uint32_t number);
 char*          rm_spaces_from_str    (char*    str);
 char*          rm_spaces_start_end   (char*    str);
 
+/* string buffers */
+struct str_buf
+{
+    char*      data;
+    uint64_t   len;
+    uint64_t   cap;
+};
+
+void           str_buf_init          (struct str_buf* sb, uint64_t cap);
+void           str_buf_reserve       (struct str_buf* sb, uint64_t extra);
+void           str_buf_append_n      (struct str_buf* sb, const char* str,
+                                      uint64_t n);
+void           str_buf_append        (struct str_buf* sb, const char* str);
+void           str_buf_append_sym    (struct str_buf* sb, char sym,
+                                      uint64_t count);
+
+/* numbers */
+#define        NUMBER_STR_MAX        64
+#define        NUM_GENERAL           0  /* like "%g" */
+#define        NUM_SHORTEST          1  /* shortest exact form */
+#define        NUM_FIXED             2  /* fixed digits after the point */
+
+#define        DIGITS_SHORTEST       0
+#define        DIGITS_PRECISION      1
+#define        DIGITS_FRACTION       2
+
+struct num_format
+{
+    uint8_t    mode;
+    uint8_t    precision;
+    char       thousands_sep;
+};
+
+#define        GRISU_MIN_EXPONENT    -60  /* of the scaled value */
+
+struct diy_fp
+{
+    uint64_t   f;         /* f * 2^e */
+    int16_t    e;
+};
+
+struct bignum
+{
+    uint32_t   words[40];
+    uint16_t   len;
+};
+
+void           bignum_set            (struct bignum* b, uint64_t value);
+void           bignum_mul            (struct bignum* b, uint32_t factor);
+void           bignum_mul_pow10      (struct bignum* b, uint16_t power);
+void           bignum_shift          (struct bignum* b, uint16_t bits);
+int8_t         bignum_cmp            (const struct bignum* a,
+                                      const struct bignum* b);
+void           bignum_add            (struct bignum* res,
+                                      const struct bignum* a,
+                                      const struct bignum* b);
+void           bignum_sub            (struct bignum* a, const struct bignum* b);
+uint8_t        bignum_next_digit     (struct bignum* r, const struct bignum* s);
+struct diy_fp  diy_fp_mul            (struct diy_fp a, struct diy_fp b);
+struct diy_fp  diy_fp_normalize      (struct diy_fp a);
+struct diy_fp  get_cached_pow10      (int16_t min_e, int16_t* exp10);
+uint8_t        round_weed            (char* digits, uint8_t n, uint64_t dist,
+                                      uint64_t delta, uint64_t rest,
+                                      uint64_t ten_kappa, uint64_t unit);
+uint8_t        round_weed_counted    (char* digits, uint8_t n, uint64_t rest,
+                                      uint64_t ten_kappa, uint64_t unit,
+                                      int16_t* kappa);
+void           get_grisu_parts       (double value, struct diy_fp* w,
+                                      struct diy_fp* low, struct diy_fp* high,
+                                      int16_t* mk);
+uint32_t       get_first_divisor     (uint32_t integrals, int16_t* kappa);
+uint8_t        grisu_shortest        (double value, char* digits,
+                                      int16_t* exp10);
+uint8_t        grisu_counted         (double value, uint8_t mode, int16_t count,
+                                      char* digits, int16_t* exp10);
+uint8_t        get_digits            (double value, uint8_t mode, int16_t count,
+                                      char* digits, int16_t* exp10);
+uint16_t       put_int_part          (char* buf, const char* digits,
+                                      int16_t count, char sep);
+uint16_t       put_number            (char* buf, const char* digits, uint8_t n,
+                                      int16_t exp10, uint8_t scientific,
+                                      int16_t frac_len, char sep);
+uint16_t       format_number         (double value,
+                                      const struct num_format* fmt, char* buf);
+uint8_t        get_num_format        (char** attrs, struct num_format* fmt);
+void           str_buf_append_number (struct str_buf* sb, double value,
+                                      const struct num_format* fmt);
+
 /* text formatting */
 #define        DEFAULT_DOC_WIDTH     80
-extern uint8_t DOC_WIDTH;
+extern __thread uint8_t DOC_WIDTH;     /* per thread, see --merge */
+extern __thread FILE*   error_file;    /* NULL - stdout */
 void           set_doc_width         (uint8_t width);
 
 /* arrays */
 uint16_t       get_arr_size          (char** str_arr);
 uint8_t        in_str_array          (char** arr, char* value);
+char*          get_attr_value        (char** arr, char* name);
 uint32_t       get_max_len           (char** str_arr, uint32_t arr_size);
-uint16_t       get_max               (const uint16_t* arr, uint16_t size);
-uint16_t       get_min               (const uint16_t* arr, uint16_t size);
+uint16_t       get_max               (const uint16_t* arr, uint32_t size);
+uint16_t       get_min               (const uint16_t* arr, uint32_t size);
 int32_t        get_index             (const uint16_t* arr, uint16_t size,
                                       uint16_t value);
 uint16_t       get_min_index         (const uint16_t* arr, uint16_t size);
@@ -67,27 +257,499 @@ char*          get_aligned_text      (char*  str, char** attrs);
 char*          header                (char*  str, uint8_t header_type, 
                                       char** attrs);
 
+/* calculations */
+struct calc_batch
+{
+    char**     exprs;
+    double*    results;
+    uint8_t*   ok;
+};
+
+void           calc_expressions_range(void* ctx, uint32_t start, uint32_t end);
+void           calc_expressions      (char** exprs, uint32_t count,
+                                      double* results, uint8_t* ok);
+
+/* set by <date> and <time>, the result changes with time */
+extern __thread uint8_t doc_uses_time;
+
+void           set_doc_time          (time_t t);
+time_t         get_doc_time          (void);
+
+/* document variables, see <set> and <if> */
+#define        MAX_DOC_VARS          256
+#define        DOC_VAR_NAME_LEN      32
+
+struct doc_var
+{
+    char       name[DOC_VAR_NAME_LEN];
+    double     value;
+};
+
+double         expr_gt               (double a, double b);
+double         expr_ge               (double a, double b);
+double         expr_lt               (double a, double b);
+double         expr_le               (double a, double b);
+double         expr_eq               (double a, double b);
+double         expr_ne               (double a, double b);
+double         expr_and              (double a, double b);
+double         expr_or               (double a, double b);
+double         expr_not              (double a);
+void           clear_doc_vars        (void);
+uint8_t        set_doc_var           (const char* name, double value);
+uint8_t        eval_doc_expr         (const char* expr, double* result);
+char*          join_attrs            (char** attrs, uint16_t first);
+
 /* tables */
-uint16_t       get_rows_count        (char*   tbl_str);
+#define        CELL_TEXT             0  /* not an expression */
+#define        CELL_NUMBER           1  /* calculated */
+#define        CELL_PENDING          2  /* expression with cell references */
+
+#define        REF_CELL              0  /* A1 */
+#define        REF_SUM               1  /* SUM(A1:B2) */
+#define        REF_AVG               2  /* AVG(A1:B2) */
+#define        REF_MIN               3  /* MIN(A1:B2) */
+#define        REF_MAX               4  /* MAX(A1:B2) */
+
+struct table_cell
+{
+    char*      text;
+    uint32_t   len;
+    uint8_t    kind;     /* PARSE_* */
+    double     value;    /* parsed number, NAN for text */
+};
+
+struct cell_ref
+{
+    uint8_t    func;
+    uint32_t   row1, row2;
+    uint16_t   col1, col2;
+    uint16_t   len;      /* length of the reference in the expression */
+};
+
+uint32_t       get_rows_count        (char*   tbl_str);
 uint16_t*      get_cells_count       (char*   tbl_str);
-char***        get_table_data        (char*   tbl_str);
-uint16_t*      get_cells_len         (char**  row, uint16_t cells_count);
-uint16_t*      get_rows_len          (char*** table_data, uint16_t rows_count,
+void           set_cell_text         (struct table_cell* cell, char* text);
+void           pad_cell              (struct table_cell* cell, uint16_t count,
+                                      uint8_t left);
+struct table_cell**
+               get_table_data        (char*   tbl_str);
+void           free_table_data       (struct table_cell** table_data,
+                                      uint32_t rows_count,
+                                      const uint16_t* cells_in_row);
+uint16_t*      get_cells_len         (struct table_cell* row,
+                                      uint16_t cells_count);
+uint16_t*      get_rows_len          (struct table_cell** table_data,
+                                      uint32_t rows_count,
                                       const uint16_t* cells_in_row);
 char*          get_table_border      (const char* row1, const char* row2);
 char*          add_table_border      (char*   table_str);
-void           calc_in_table         (char*** table_data, uint16_t rows_count,
-                                      const uint16_t* cells_in_row);
-uint16_t**     get_column_width      (char*** table_data, uint16_t rows_count,
+uint8_t        get_cell_ref          (const char* str, uint32_t pos,
+                                      struct cell_ref* ref);
+char*          get_cell_name         (uint32_t row, uint16_t col);
+uint8_t        get_range_value       (const double* values, uint32_t rows_count,
+                                      const struct cell_ref* ref,
+                                      double* result);
+uint8_t        eval_cell_expr        (const char* expr, const double* values,
+                                      uint32_t rows_count, uint16_t max_cells,
+                                      double* result);
+void           calc_in_table         (struct table_cell** table_data,
+                                      uint32_t rows_count,
+                                      const uint16_t* cells_in_row,
+                                      const struct num_format* fmt);
+uint16_t**     get_column_width      (struct table_cell** table_data,
+                                      uint32_t rows_count,
                                       uint16_t* cells_in_row);
-void           align_to_columns      (char*** table_data, uint16_t rows_count,
+void           align_to_columns      (struct table_cell** table_data,
+                                      uint32_t rows_count,
                                       uint16_t* cells_in_row, uint8_t na);
-uint16_t       get_max_row_len       (char*** table_data, uint16_t rows_count,
+uint16_t       get_max_row_len       (struct table_cell** table_data,
+                                      uint32_t rows_count,
                                       uint16_t* cells_in_row);
+char*          render_table          (struct table_cell** table_data,
+                                      uint32_t rows_count,
+                                      uint16_t* cells_in_row,
+                                      uint8_t nb, uint8_t na,
+                                      const struct num_format* fmt);
+
+/* streamed tables */
+#define        TABLE_STREAM_FLUSH    65536
+#define        MAX_TABLE_STREAMS     256
+extern __thread uint16_t table_streams_count;  /* see write_text() */
+
+struct table_stream
+{
+    char*      path;
+    uint8_t    nb;           /* no border */
+    uint8_t    na;           /* don't align numbers to the right */
+    uint8_t    doc_width;    /* DOC_WIDTH when the tag was executed */
+    uint16_t   max_cells;
+    uint16_t** cell_width;   /* final widths of the cells in rows of i+1 */
+    uint16_t   row_len;
+    uint32_t   rows_count;
+    uint8_t    file_copy;    /* <insert>, the file is copied as it is */
+    uint64_t   size;         /* bytes to copy */
+    uint64_t   pos;          /* offset in the text of the document */
+};
+
+const char*    get_next_line         (const char* pos, const char* end,
+                                      uint64_t* len);
+const char*    get_next_cell         (const char* pos, const char* end,
+                                      uint64_t* len);
+void           scan_table_stream     (struct table_stream* ts,
+                                      const char* data, uint64_t size);
+struct table_stream*
+               open_table_stream     (char* filename, uint8_t nb, uint8_t na);
+void           put_table_border      (const struct table_stream* ts,
+                                      uint16_t cells1, uint16_t cells2,
+                                      struct str_buf* out);
+void           write_table_stream    (const struct table_stream* ts,
+                                      struct str_buf* out, FILE* file);
+void           free_table_stream     (struct table_stream* ts);
+uint8_t        can_stream            (void);
+uint8_t        add_table_stream      (struct table_stream* ts, uint64_t pos);
+void           move_table_streams    (uint16_t first, uint64_t offset);
+char*          get_streamed_table    (char* filename, uint8_t nb, uint8_t na);
+
+/* streamed inserts */
+#define        INSERT_STREAM_SIZE    (1 << 20)  /* smaller files are cached */
+#define        COPY_BLOCK            (1 << 16)
+
+uint8_t        is_plain_text         (const char* data, uint64_t size);
+struct table_stream*
+               open_file_stream      (char* filename);
+uint8_t        copy_file_data        (int from, int to, uint64_t size);
+void           write_file_stream     (const struct table_stream* ts,
+                                      FILE* file);
+void           restore_symbols       (char* str);
+void           write_document        (char* filename, char* str);
+char*          render_text           (const char* text, uint8_t width,
+                                      uint64_t* len);
+void           write_text            (FILE* file, char* str);
+
+/* CSV files */
+struct csv_field
+{
+    uint64_t   start;        /* offset in the file */
+    uint32_t   len;
+    uint8_t    quoted;
+};
+
+struct csv_data
+{
+    struct csv_field* fields;
+    uint64_t   fields_count;
+    uint64_t   fields_cap;
+    uint64_t*  rows;         /* first field of each row, and the end */
+    uint32_t   rows_count;
+    uint32_t   rows_cap;
+};
+
+const char*    find_csv_special      (const char* pos, const char* end,
+                                      char delim);
+void           add_csv_field         (struct csv_data* csv, uint64_t start,
+                                      uint64_t len, uint8_t quoted);
+void           add_csv_row           (struct csv_data* csv,
+                                      uint64_t first_field);
+void           parse_csv             (const char* data, uint64_t size,
+                                      char delim, struct csv_data* csv);
+char*          get_csv_text          (const char* data,
+                                      const struct csv_field* field);
+void           append_csv_text       (struct str_buf* sb, const char* data,
+                                      const struct csv_field* field);
+char**         get_csv_header        (const char* data,
+                                      const struct csv_data* csv,
+                                      uint16_t* count);
+char           get_csv_delim         (char** attrs, char* filename);
+void           free_csv_data         (struct csv_data* csv);
+struct table_cell** get_csv_table_data (const char* data,
+                                      const struct csv_data* csv,
+                                      uint16_t** cells);
+char*          csv_to_table          (const char* data,
+                                      const struct csv_data* csv,
+                                      uint8_t nb, uint8_t na);
+char*          csv_to_histogram      (const char* data,
+                                      const struct csv_data* csv,
+                                      uint32_t first_row, uint16_t name_col,
+                                      uint16_t value_col, char sym);
 
 /* histograms */
-double         get_max_value         (char** values, uint16_t values_count);
-void           get_histogram_data    (char*  str, char** names, char** values);
+double         get_max_value         (const double* numbers,
+                                      uint16_t values_count);
+char*          get_histogram_value   (const char* str, uint64_t len,
+                                      double* number);
+void           get_histogram_data    (char*  str, char** names, char** values,
+                                      double* numbers);
+char*          render_histogram      (char** names, char** values,
+                                      double* numbers, uint32_t count,
+                                      char sym);
+char           get_histogram_symbol  (char** attrs);
+
+/* statistics */
+#define        TDIGEST_COMPRESSION   100
+#define        TDIGEST_CENTROIDS     (2 * TDIGEST_COMPRESSION)
+#define        TDIGEST_BUFFER        (5 * TDIGEST_COMPRESSION)
+
+struct centroid
+{
+    double     mean;
+    double     weight;
+};
+
+struct tdigest
+{
+    struct centroid* centroids;  /* sorted by mean */
+    uint32_t   count;
+    struct centroid* buffer;     /* points that are not merged yet */
+    uint32_t   buffer_count;
+    double     total;
+    double     min;
+    double     max;
+};
+
+struct summary
+{
+    uint64_t   count;
+    uint64_t   invalid;
+    double     sum;
+    double     mean;
+    double     m2;       /* sum of squared differences from the mean */
+    struct tdigest td;
+};
+
+/* sorting */
+struct sort_item
+{
+    uint64_t   key;      /* number bits or the first 8 bytes of the text */
+    const char* text;
+    uint32_t   len;
+    uint32_t   row;
+};
+
+struct table_sort
+{
+    uint16_t   column;
+    uint8_t    desc;
+    uint8_t    hdr;
+};
+
+/* joined tables */
+#define        JOIN_END              UINT32_MAX
+
+struct table_join
+{
+    char*      path;
+    uint16_t   left_col;
+    uint16_t   right_col;
+    uint8_t    hdr;
+};
+
+struct join_index
+{
+    uint32_t*  slots;    /* first row with the key + 1, 0 - empty */
+    uint64_t   mask;
+    uint32_t*  next;     /* next row with the same key */
+    uint32_t*  tail;     /* last row with the key, for the first row */
+    struct table_cell** table_data;
+    const uint16_t* cells_in_row;
+    uint16_t   column;
+};
+
+/* templates */
+#define        TEMPLATE_TEXT         -1
+#define        TEMPLATE_INDEX        -2  /* {{#}}, the number of the record */
+#define        MACRO_CONTENT         -3  /* {{content}} of a macro tag */
+
+struct template_part
+{
+    const char* text;    /* literal text, points into the template */
+    uint32_t   len;
+    int32_t    field;    /* column or attribute, or one of the above */
+};
+
+struct template
+{
+    struct template_part* parts;
+    uint32_t   count;
+    uint32_t   cap;
+    uint8_t    has_tags;
+};
+
+/* tags defined by a document, see <define> */
+#define        MAX_MACROS            64
+#define        MAX_MACRO_DEPTH       16
+
+struct macro
+{
+    char       name[20];
+    char*      body;         /* the parts of tpl point into it */
+    struct template tpl;
+    uint8_t    paired;       /* the body has {{content}} */
+};
+
+/* charts */
+#define        CHART_BUCKETS         4096  /* even, at least 8 * 255 */
+#define        CHART_HEIGHT          10
+#define        MAX_CHART_HEIGHT      100
+
+struct chart_bucket
+{
+    uint64_t   count;
+    double     min;
+    double     max;
+    double     sum;
+    double     last;
+};
+
+struct chart_series
+{
+    struct chart_bucket* buckets;
+    uint32_t   count;
+    uint64_t   per_bucket;   /* doubles when all the buckets are full */
+    uint64_t   samples;
+    uint64_t   invalid;
+};
+
+/* binned histograms */
+#define        SAMPLES_BLOCK         4096
+#define        MAX_HISTOGRAM_BINS    1000
+#define        SAMPLES_PART          (1 << 20)  /* bytes per parallel part */
+#define        MAX_SAMPLES_PARTS     256
+#define        IS_SAMPLE_SPACE(c)    ((c) == ' '  || (c) == '\n' || \
+                                      (c) == '\t' || (c) == '\r' || \
+                                      (c) == '\v' || (c) == '\f')
+
+struct sample_stats
+{
+    uint64_t   count;
+    uint64_t   invalid;
+    double     min;
+    double     max;
+};
+
+struct samples_job
+{
+    const char*  data;
+    uint64_t     size;
+    uint64_t*    bounds;     /* parts of the data */
+    uint32_t     parts;
+    struct sample_stats* stats;        /* pass one, for each part */
+    const struct sample_stats* total;  /* pass two */
+    uint64_t*    bins;       /* pass two, bins_count for each part */
+    uint16_t     bins_count;
+    struct summary* summaries; /* statistics, for each part */
+};
+
+uint32_t       parse_samples         (const char** pos, const char* end,
+                                      double* block, uint32_t block_size,
+                                      uint64_t* invalid);
+void           get_min_max           (const double* values, uint32_t count,
+                                      double* min, double* max);
+void           scan_samples          (const char* data, uint64_t size,
+                                      struct sample_stats* st);
+void           count_bins            (const char* data, uint64_t size,
+                                      const struct sample_stats* st,
+                                      uint64_t* bins, uint16_t bins_count);
+void           samples_range         (void* ctx, uint32_t start, uint32_t end);
+void           split_samples         (struct samples_job* job);
+uint16_t       get_auto_bins         (uint64_t count);
+char*          get_binned_histogram  (const char* data, uint64_t size,
+                                      char* bins_attr, char sym);
+
+void           tdigest_init          (struct tdigest* td);
+void           tdigest_free          (struct tdigest* td);
+int            compare_centroids     (const void* a, const void* b);
+double         tdigest_q_limit       (double q);
+void           tdigest_compress      (struct tdigest* td);
+void           tdigest_add           (struct tdigest* td, double mean,
+                                      double weight);
+void           tdigest_merge         (struct tdigest* dst, struct tdigest* src);
+double         tdigest_quantile      (struct tdigest* td, double q);
+void           summary_init          (struct summary* sm);
+void           summarize_samples     (const char* data, uint64_t size,
+                                      struct summary* sm);
+void           merge_summary         (struct summary* dst, struct summary* src);
+void           add_stats_row         (struct table_cell** table_data,
+                                      uint16_t* cells_in_row, uint32_t row,
+                                      const char* name, double value,
+                                      const struct num_format* fmt);
+char*          get_stats_table       (const char* data, uint64_t size,
+                                      char* quantiles, uint8_t nb,
+                                      const struct num_format* fmt);
+
+void           merge_chart_bucket    (struct chart_bucket* dst,
+                                      const struct chart_bucket* src);
+void           add_chart_sample      (struct chart_series* cs, double value);
+void           get_chart_series      (const char* data, uint64_t size,
+                                      struct chart_series* cs);
+uint16_t       get_chart_level       (double value, double min, double max,
+                                      uint16_t height);
+char*          render_chart          (struct chart_series* cs, uint16_t height,
+                                      uint8_t bars, char sym,
+                                      const struct num_format* fmt);
+
+uint64_t       get_number_key        (double value);
+uint64_t       get_text_key          (const char* text, uint32_t len);
+void           set_sort_item         (struct sort_item* item, uint32_t row,
+                                      const char* text, uint32_t len,
+                                      double value, uint8_t numeric);
+void           radix_sort_items      (struct sort_item* items, uint32_t count,
+                                      uint8_t desc);
+int            compare_text_items    (const struct sort_item* a,
+                                      const struct sort_item* b);
+void           merge_sort_items      (struct sort_item* items, uint32_t count,
+                                      uint8_t desc);
+void           sort_items            (struct sort_item* items, uint32_t count,
+                                      uint8_t numeric, uint8_t desc);
+uint8_t        get_table_sort        (char** attrs, struct table_sort* ts);
+void           sort_table            (struct table_cell** table_data,
+                                      uint32_t rows_count,
+                                      uint16_t* cells_in_row,
+                                      const struct table_sort* ts);
+uint32_t*      sort_lines            (char** lines, uint32_t count,
+                                      uint8_t desc);
+
+uint8_t        get_table_join        (char** attrs, struct table_join* tj);
+struct table_cell** load_join_table  (char* path, uint32_t* rows_count,
+                                      uint16_t** cells_in_row);
+const char*    get_key_span          (const struct table_cell* row,
+                                      uint16_t cells_count, uint16_t column,
+                                      uint32_t* len);
+uint64_t       hash_key              (const char* key, uint32_t len);
+void           build_join_index      (struct join_index* ji,
+                                      struct table_cell** table_data,
+                                      uint32_t rows_count,
+                                      const uint16_t* cells_in_row,
+                                      uint16_t column, uint32_t first);
+uint32_t       find_join_rows        (const struct join_index* ji,
+                                      const char* key, uint32_t len);
+void           free_join_index       (struct join_index* ji);
+struct table_cell* get_joined_row    (struct table_cell* left,
+                                      uint16_t left_count,
+                                      const struct table_cell* right,
+                                      uint16_t right_count, uint16_t right_col,
+                                      uint16_t right_width, uint8_t move,
+                                      uint16_t* count);
+struct table_cell** join_tables      (struct table_cell** table_data,
+                                      uint32_t* rows_count,
+                                      uint16_t** cells_in_row,
+                                      const struct table_join* tj);
+
+void           add_template_part     (struct template* tpl, const char* text,
+                                      uint32_t len, int32_t field);
+int32_t        get_template_field    (const char* name, uint32_t len,
+                                      char** names, uint16_t names_count);
+void           compile_template      (const char* text, char** names,
+                                      uint16_t names_count,
+                                      struct template* tpl);
+void           expand_template       (const struct template* tpl,
+                                      struct str_buf* sb, const char* data,
+                                      const struct csv_data* csv,
+                                      uint32_t row, uint32_t index);
+void           compile_macro         (const char* text, struct template* tpl);
+void           expand_macro          (const struct template* tpl,
+                                      struct str_buf* sb, const char* content,
+                                      char** attrs);
+void           free_template         (struct template* tpl);
 
 
 #endif /* TAGS_LIB_H */
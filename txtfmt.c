@@ -19,6 +19,18 @@
  */
 #include "tags.h"
 #include "help.h"
+#include "watch.h"
+#include "server.h"
+
+/* --merge: one template and one output document for every record */
+struct merge_job
+{
+    struct template  tpl;
+    const char*      name;         /* of the template */
+    const char*      data;
+    struct csv_data  csv;
+    char*            out_base;     /* output path without the extension */
+};
 
 void print_logo()
 {
@@ -30,16 +42,208 @@ void print_logo()
 \n \\__/_/|_|\\__/_/    \\____/_/  /_/ /_/ /_/\\__,_/\\__/\\__/\\___/_/\n");
 }
 
+void write_result(char* filename, char* result)
+{
+    restore_symbols(result);
+    write_document(filename, result);
+}
+
+void process_file(char* filename)
+{
+    set_doc_width(DEFAULT_DOC_WIDTH);
+    clear_doc_vars();
+    clear_macros();
+    printf("processing file: %s\n", filename);
+    char* file_content = get_file_content(filename);
+    if ( file_content == NULL )
+        return;
+
+    if ( profiling )
+        profile_enter(filename, FRAME_FILE);
+
+    char* result = execute_all_tags(file_content);
+    char* result_file = change_file_extension(filename, ".txt");
+    write_result(result_file, result);
+    if ( profiling ) {
+        profile_leave(NULL, strlen(file_content), strlen(result));
+        print_file_profile(filename);
+    }
+
+    puts("  done");
+
+    free(result_file);
+    free(file_content);
+    free(result);
+}
+
+void merge_records(void* ctx, uint32_t start, uint32_t end)
+{
+    /* workers share the compiled template and the data; the document width,
+       tag depth and streamed tables are per thread */
+    struct merge_job* job = ctx;
+    struct str_buf record;
+    str_buf_init(&record, 4096);
+    char* filename = calloc(strlen(job->out_base) + 16, sizeof(char));
+    is_memory_allocated(filename);
+    for ( uint32_t i=start; i<end; i++ ) {
+        record.len = 0;
+        record.data[0] = '\0';
+        expand_template(&job->tpl, &record, job->data, &job->csv, i + 1,
+                        i + 1);
+        set_doc_width(DEFAULT_DOC_WIDTH);
+        clear_doc_vars();
+        clear_macros();
+        if ( profiling )
+            profile_enter(job->name, FRAME_FILE);
+
+        char* result = execute_all_tags(record.data);
+        sprintf(filename, "%s_%u.txt", job->out_base, i + 1);
+        write_result(filename, result);
+        if ( profiling )
+            profile_leave(NULL, record.len, strlen(result));
+
+        free(result);
+    }
+
+    clear_macros();
+    if ( profiling )
+        add_thread_profile();
+
+    free(filename);
+    free(record.data);
+}
+
+int merge_documents(char* template_file, char* data_file, char* out_dir)
+{
+    /* the first record of the data holds the names for {{name}} */
+    char* template_text = get_file_content(template_file);
+    if ( template_text == NULL )
+        return EXIT_FAILURE;
+
+    uint64_t size;
+    char* data = map_file(data_file, &size);
+    if ( data == NULL ) {
+        free(template_text);
+        return EXIT_FAILURE;
+    }
+
+    struct merge_job job;
+    job.name = template_file;
+    job.data = data;
+    parse_csv(data, size, get_csv_delim(NULL, data_file), &job.csv);
+    uint16_t names_count = 0;
+    char** names = get_csv_header(data, &job.csv, &names_count);
+    compile_template(template_text, names, names_count, &job.tpl);
+
+    /* <out_dir>/<template name>_N.txt */
+    char* base = change_file_extension(template_file, "");
+    char* name = strrchr(base, '/');
+    name = (name != NULL) ? name + 1 : base;
+    if ( out_dir != NULL ) {
+        job.out_base = calloc(strlen(out_dir) + strlen(name) + 2,
+                              sizeof(char));
+        is_memory_allocated(job.out_base);
+        sprintf(job.out_base, "%s/%s", out_dir, name);
+    } else
+        job.out_base = strdup(base);
+
+    uint32_t records = (job.csv.rows_count > 0) ? job.csv.rows_count - 1 : 0;
+    printf("merging %s with %u records of %s\n", template_file, records,
+           data_file);
+    run_parallel(merge_records, &job, records, 1);
+    printf("  done, %u documents\n", records);
+
+    for ( uint16_t i=0; i<names_count; i++ )
+        free(names[i]);
+
+    free(names);
+    free(base);
+    free(job.out_base);
+    free_template(&job.tpl);
+    free_csv_data(&job.csv);
+    unmap_file(data, size);
+    free(template_text);
+    free_workers();
+    free_insert_cache();
+    return 0;
+}
+
 int main(int argc, char* argv[])
 {
-    if ( argc > 1 )
-        help();
+    /* --profile, --trace and --folded go before the other options */
+    while ( argc > 1 ) {
+        if ( strcmp(argv[1], "--profile") == 0 )
+            profiling |= PROFILE_REPORT;
+        else if ( strcmp(argv[1], "--trace") == 0 && argc > 2 ) {
+            if ( start_trace(argv[2]) == 0 )
+                exit(EXIT_FAILURE);
+
+            argc--;
+            argv++;
+        } else if ( strcmp(argv[1], "--folded") == 0 && argc > 2 ) {
+            if ( start_folded(argv[2]) == 0 )
+                exit(EXIT_FAILURE);
+
+            argc--;
+            argv++;
+        } else
+            break;
+
+        argc--;
+        argv++;
+    }
+
+    if ( argc > 1 && (strcmp(argv[1], "--help") == 0 ||
+                      strcmp(argv[1], "-h") == 0) ) {
+        /* the help waits for input, a script only gets the usage */
+        if ( isatty(STDIN_FILENO) )
+            help();
+
+        print_usage(stdout);
+        return EXIT_SUCCESS;
+    }
+
+    if ( argc > 1 && strcmp(argv[1], "--merge") != 0 &&
+         strcmp(argv[1], "--watch") != 0 && strcmp(argv[1], "--serve") != 0 ) {
+        fprintf(stderr, "Error: unknown argument \"%s\"\n", argv[1]);
+        print_usage(stderr);
+        return EXIT_FAILURE;
+    }
         
     print_logo();
     puts("txtFormatter text formatting utility v1.0\n"
          "Copyright (C) 2024 Dmitriy Eliseev\n");
+    if ( argc > 1 && strcmp(argv[1], "--watch") == 0 ) {
+        watch_documents(".txtm", process_file);
+        return EXIT_FAILURE;
+    }
+
+    if ( argc > 1 && strcmp(argv[1], "--serve") == 0 ) {
+        if ( argc < 3 ) {
+            print_usage(stderr);
+            exit(EXIT_FAILURE);
+        }
+
+        return serve_documents(argv[2]);
+    }
+
+    if ( argc > 1 ) {
+        if ( argc < 4 ) {
+            print_usage(stderr);
+            exit(EXIT_FAILURE);
+        }
+
+        int status = merge_documents(argv[2], argv[3],
+                                     (argc > 4) ? argv[4] : NULL);
+        if ( profiling )
+            print_total_profile();
+
+        finish_trace();
+        finish_folded();
+        return status;
+    }
+
     char source_file_extension[] = ".txtm";
-    char result_file_extension[] = ".txt";
     char** files = get_files_in_dir(".", source_file_extension);
     uint16_t files_count = get_files_count(".", source_file_extension);
 
@@ -51,29 +255,17 @@ int main(int argc, char* argv[])
     uint16_t i;
     
     for ( i=0; i<files_count; i++) {
-        set_doc_width(DEFAULT_DOC_WIDTH);
-        printf("processing file: %s\n", files[i]);
-        char* file_content = get_file_content(files[i]);
-
-        char* result = execute_all_tags(file_content);
-
-        change_symbols('\f', '<', result);
-        change_symbols('\a', '>', result);
-        change_symbols('\r', ' ', result);
-        change_symbols('\v', ' ', result);
-
-        char* result_file = change_file_extension(files[i],
-            result_file_extension);
-        
-        write_to_file(result_file, result);
-        puts("  done");
-
-        free(result_file);
-        free(file_content);
-        free(result);
+        process_file(files[i]);
         free(files[i]);
     }
 
     free(files);
+    if ( profiling )
+        print_total_profile();
+
+    finish_trace();
+    finish_folded();
+    clear_macros();
+    free_insert_cache();
     return 0;
 }
@@ -0,0 +1,801 @@
+/* txtfmt_bench.c
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ *
+ * Benchmarks of the engine on generated documents (make bench):
+ *     txtfmt_bench [scale] [runs] [workload]
+ *     txtfmt_bench --generate workload [scale] > document.txtm
+ * and the growth of the time of every tag with its input (make scaling):
+ *     txtfmt_bench --scaling [max_exponent] [tag]
+ * and the tags over more than 65535 lines, rows or items (make check):
+ *     txtfmt_bench --limits [tag]
+ */
+#include "tags_lib.h"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <malloc.h>
+
+#define        BENCH_VERSION         1
+#define        BENCH_INSERT_FILE     "bench_insert.txt"
+#define        SCALING_TEXT_FILE     "bench_scaling.txt"
+#define        SCALING_CSV_FILE      "bench_scaling.csv"
+#define        SCALING_STEPS         6     /* the input is doubled each step */
+#define        SCALING_MIN_RUNS      3
+#define        SCALING_MIN_MS        50    /* of runs for every size */
+#define        SCALING_STOP_MS       2000  /* no bigger sizes after this */
+#define        SCALING_MAX_EXPONENT  1.2
+#define        LIMITS_ITEMS          70000 /* more than 16-bit counters */
+#define        LIMITS_TIMEOUT_S      60
+
+struct workload
+{
+    const char*  name;
+    void       (*generate)(struct str_buf* doc, uint32_t scale);
+};
+
+struct bench_result
+{
+    uint64_t     bytes;
+    uint64_t     tags;
+    double       generate_ms;
+    double       render_ms;   /* medians of the runs */
+    double       output_ms;
+    double       parse_ms;    /* self times of one profiled run */
+    double       splice_ms;
+    double       tag_ms;
+    long         peak_rss_kb;
+};
+
+/* items are lines, rows, words or tags, whatever grows the input of the
+   tag; the smallest size should take about a millisecond */
+struct scaling_case
+{
+    const char*  tag;
+    uint32_t     items;
+    void       (*generate)(struct str_buf* doc, const char* tag,
+                           uint32_t items);
+};
+
+struct limits_result
+{
+    uint64_t     lines;
+    double       render_ms;
+};
+
+struct scaling_result
+{
+    uint32_t     items[SCALING_STEPS];
+    double       render_ms[SCALING_STEPS];   /* the fastest of the runs */
+    uint16_t     steps;
+    double       exponent;
+};
+
+const char* words[] = { "lorem", "ipsum", "dolor", "sit", "amet",
+                        "consectetur", "adipiscing", "elit", "sed", "do",
+                        "eiusmod", "tempor", "incididunt", "ut", "labore",
+                        "et", "dolore", "magna", "aliqua" };
+const uint16_t words_count = sizeof(words) / sizeof(words[0]);
+
+/****************************************************************************
+*                         functions for the documents                       *
+****************************************************************************/
+
+void append_words(struct str_buf* doc, uint32_t count, uint32_t seed)
+{
+    /* the same text for the same seed, lines of about 70 characters */
+    uint32_t line = 0;
+    for ( uint32_t i=0; i<count; i++ ) {
+        const char* word = words[(seed + i * 7) % words_count];
+        if ( line > 0 && line + strlen(word) > 70 ) {
+            str_buf_append(doc, "\n");
+            line = 0;
+        } else if ( line > 0 ) {
+            str_buf_append(doc, " ");
+            line++;
+        }
+
+        str_buf_append(doc, word);
+        line += strlen(word);
+    }
+}
+
+void generate_paragraphs(struct str_buf* doc, uint32_t scale)
+{
+    for ( uint32_t i=0; i<200 * scale; i++ ) {
+        if ( i % 20 == 0 )
+            str_buf_append(doc, "<h2>Section</h2>\n");
+
+        str_buf_append(doc, "<p>\n");
+        append_words(doc, 60, i);
+        str_buf_append(doc, "\n</p>\n\n");
+    }
+}
+
+void generate_table_rows(struct str_buf* doc, uint32_t rows)
+{
+    char row[128];
+    str_buf_append(doc, "<table>\nID|Name|Quantity|Price|Total\n");
+    for ( uint32_t i=0; i<rows; i++ ) {
+        snprintf(row, sizeof(row), "%u|%s %s|%u|%u.%02u|%u*%u.%02u\n", i + 1,
+                 words[i % words_count], words[(i * 3) % words_count],
+                 i % 97, i % 500, i % 100, i % 97, i % 500, i % 100);
+        str_buf_append(doc, row);
+    }
+
+    str_buf_append(doc, "</table>\n");
+}
+
+void generate_table(struct str_buf* doc, uint32_t scale)
+{
+    generate_table_rows(doc, 500 * scale);
+}
+
+void generate_nesting(struct str_buf* doc, uint32_t scale)
+{
+    /* the same tag can't be nested in itself, except the raw ones */
+    char line[64];
+    uint32_t depth = 20 * scale;
+    for ( uint32_t i=0; i<depth; i++ ) {
+        snprintf(line, sizeof(line), "<if %u>\n<center>level %u</center>\n",
+                 i + 1, i + 1);
+        str_buf_append(doc, line);
+    }
+
+    append_words(doc, 8, depth);
+    str_buf_append(doc, "\n");
+    for ( uint32_t i=0; i<depth; i++ )
+        str_buf_append(doc, "</if>\n");
+}
+
+void generate_inserts(struct str_buf* doc, uint32_t scale)
+{
+    for ( uint32_t i=0; i<100 * scale; i++ )
+        str_buf_append(doc, "<insert " BENCH_INSERT_FILE ">\n");
+}
+
+void generate_calc_lines(struct str_buf* doc, uint32_t lines)
+{
+    char line[128];
+    str_buf_append(doc, "<calc s prec=3>\n");
+    for ( uint32_t i=0; i<lines; i++ ) {
+        snprintf(line, sizeof(line), "(%u+%u.5)*sin(%u)/%u^0.5\n", i, i % 13,
+                 i % 360, i % 31 + 1);
+        str_buf_append(doc, line);
+    }
+
+    str_buf_append(doc, "</calc>\n");
+}
+
+void generate_calc(struct str_buf* doc, uint32_t scale)
+{
+    generate_calc_lines(doc, 500 * scale);
+}
+
+void generate_histogram_rows(struct str_buf* doc, uint32_t rows)
+{
+    char line[128];
+    str_buf_append(doc, "<histogram>\n");
+    for ( uint32_t i=0; i<rows; i++ ) {
+        snprintf(line, sizeof(line), "%s %u|%u.%02u\n", words[i % words_count],
+                 i, (i * 37) % 1000, i % 100);
+        str_buf_append(doc, line);
+    }
+
+    str_buf_append(doc, "</histogram>\n");
+}
+
+void generate_histogram(struct str_buf* doc, uint32_t scale)
+{
+    generate_histogram_rows(doc, 500 * scale);
+}
+
+struct workload workloads[] = { { "paragraphs", generate_paragraphs },
+                                { "table",      generate_table },
+                                { "nesting",    generate_nesting },
+                                { "inserts",    generate_inserts },
+                                { "calc",       generate_calc },
+                                { "histogram",  generate_histogram } };
+const uint16_t workloads_count = sizeof(workloads) / sizeof(workloads[0]);
+
+uint8_t write_insert_file(void)
+{
+    /* 4 KB of text, read through the cache of inserted files */
+    struct str_buf text;
+    str_buf_init(&text, 4096);
+    append_words(&text, 600, 0);
+    str_buf_append(&text, "\n");
+    FILE* file = fopen(BENCH_INSERT_FILE, "w");
+    if ( file != NULL ) {
+        fputs(text.data, file);
+        fclose(file);
+    }
+
+    free(text.data);
+    return file != NULL;
+}
+
+/****************************************************************************
+*                         functions for the runs                            *
+****************************************************************************/
+
+double get_ms(uint64_t start)
+{
+    return (get_clock_ns() - start) / 1e6;
+}
+
+int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+double render_once(const char* doc, FILE* out, double* output_ms)
+{
+    set_doc_width(DEFAULT_DOC_WIDTH);
+    clear_doc_vars();
+    clear_macros();
+    uint64_t start = get_clock_ns();
+    char* result = execute_all_tags((char*)doc);
+    double render_ms = get_ms(start);
+
+    start = get_clock_ns();
+    restore_symbols(result);
+    write_text(out, result);
+    fflush(out);
+    *output_ms = get_ms(start);
+    free(result);
+    return render_ms;
+}
+
+void run_workload(const struct workload* wl, uint32_t scale, uint16_t runs,
+                  struct bench_result* res)
+{
+    FILE* out = fopen("/dev/null", "w");
+    if ( out == NULL )
+        exit_on_error("Error: can't open /dev/null", NULL);
+
+    struct str_buf doc;
+    str_buf_init(&doc, 1 << 16);
+    uint64_t start = get_clock_ns();
+    wl->generate(&doc, scale);
+    res->generate_ms = get_ms(start);
+    res->bytes = doc.len;
+
+    double* render = calloc(runs, sizeof(double));
+    double* output = calloc(runs, sizeof(double));
+    is_memory_allocated(render);
+    is_memory_allocated(output);
+    for ( uint16_t i=0; i<runs; i++ )
+        render[i] = render_once(doc.data, out, &output[i]);
+
+    qsort(render, runs, sizeof(double), compare_doubles);
+    qsort(output, runs, sizeof(double), compare_doubles);
+    res->render_ms = render[runs / 2];
+    res->output_ms = output[runs / 2];
+
+    /* one more run for the phases and the number of tags */
+    double output_ms;
+    profiling = PROFILE_REPORT;
+    render_once(doc.data, out, &output_ms);
+    profiling = 0;
+    uint16_t count = 0;
+    struct tag_profile* tp = get_thread_profiles(&count);
+    for ( uint16_t i=0; i<count; i++ ) {
+        double self_ms = tp[i].self_ns / 1e6;
+        if ( strcmp(tp[i].name, PROFILE_PARSE) == 0 )
+            res->parse_ms += self_ms;
+        else if ( strcmp(tp[i].name, PROFILE_SPLICE) == 0 )
+            res->splice_ms += self_ms;
+        else {
+            res->tag_ms += self_ms;
+            res->tags += tp[i].calls;
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    res->peak_rss_kb = usage.ru_maxrss;
+
+    free(render);
+    free(output);
+    free(doc.data);
+    fclose(out);
+}
+
+void print_result(const char* name, uint32_t scale, uint16_t runs,
+                  const struct bench_result* res)
+{
+    /* one line for every workload, the keys never change their order */
+    double seconds = res->render_ms / 1e3;
+    printf("workload=%s scale=%u runs=%u bytes=%lu tags=%lu "
+           "generate_ms=%.3f render_ms=%.3f output_ms=%.3f parse_ms=%.3f "
+           "splice_ms=%.3f tag_ms=%.3f mb_per_s=%.3f tags_per_s=%.0f "
+           "peak_rss_kb=%ld\n", name, scale, runs,
+           (unsigned long)res->bytes, (unsigned long)res->tags,
+           res->generate_ms, res->render_ms, res->output_ms, res->parse_ms,
+           res->splice_ms, res->tag_ms,
+           (seconds > 0) ? res->bytes / 1e6 / seconds : 0,
+           (seconds > 0) ? res->tags / seconds : 0, res->peak_rss_kb);
+    fflush(stdout);
+}
+
+uint8_t run_in_child(void (*run)(const void*, void*), const void* arg,
+                     void* res, size_t size)
+{
+    /* the peak RSS is the run's own, and the engine's messages go to
+       /dev/null; the result comes back through a pipe */
+    int fds[2];
+    fflush(stdout);
+    if ( pipe(fds) != 0 )
+        return 0;
+
+    pid_t pid = fork();
+    if ( pid == 0 ) {
+        close(fds[0]);
+        FILE* null = freopen("/dev/null", "w", stdout);
+        memset(res, 0, size);
+        run(arg, res);
+        uint8_t ok = write(fds[1], res, size) == (ssize_t)size;
+        if ( null != NULL )
+            fclose(null);
+
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    ssize_t n = (pid > 0) ? read(fds[0], res, size) : -1;
+    close(fds[0]);
+    int status = 0;
+    if ( pid > 0 )
+        waitpid(pid, &status, 0);
+
+    return n == (ssize_t)size;
+}
+
+struct workload_run
+{
+    const struct workload* wl;
+    uint32_t     scale;
+    uint16_t     runs;
+};
+
+void run_workload_in_child(const void* arg, void* res)
+{
+    const struct workload_run* wr = arg;
+    run_workload(wr->wl, wr->scale, wr->runs, res);
+}
+
+uint8_t bench_workload(const struct workload* wl, uint32_t scale,
+                       uint16_t runs)
+{
+    struct workload_run wr = { wl, scale, runs };
+    struct bench_result res;
+    if ( run_in_child(run_workload_in_child, &wr, &res, sizeof(res)) == 0 ) {
+        printf("workload=%s scale=%u error=failed\n", wl->name, scale);
+        return 0;
+    }
+
+    print_result(wl->name, scale, runs, &res);
+    return 1;
+}
+
+/****************************************************************************
+*                         functions for the scaling                         *
+****************************************************************************/
+
+void append_lines(struct str_buf* doc, uint32_t count)
+{
+    /* about 50 characters, shorter than the document */
+    for ( uint32_t i=0; i<count; i++ ) {
+        append_words(doc, 8, i);
+        str_buf_append(doc, "\n");
+    }
+}
+
+void write_scaling_file(const char* name, struct str_buf* text)
+{
+    FILE* file = fopen(name, "w");
+    if ( file == NULL )
+        exit_on_error("Error: can't write the file", NULL);
+
+    fputs(text->data, file);
+    fclose(file);
+    free(text->data);
+}
+
+void scale_text(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    char line[32];
+    snprintf(line, sizeof(line), "<%s>\n", tag);
+    str_buf_append(doc, line);
+    append_lines(doc, items);
+    snprintf(line, sizeof(line), "</%s>\n", tag);
+    str_buf_append(doc, line);
+}
+
+void scale_if(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    str_buf_append(doc, "<if 1>\n");
+    append_lines(doc, items);
+    str_buf_append(doc, "</if>\n");
+}
+
+void scale_lines(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    char line[32];
+    snprintf(line, sizeof(line), "<lines %u>\n", items);
+    str_buf_append(doc, line);
+}
+
+void scale_header(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    /* one long line */
+    char line[32];
+    snprintf(line, sizeof(line), "<%s>", tag);
+    str_buf_append(doc, line);
+    for ( uint32_t i=0; i<items; i++ ) {
+        str_buf_append(doc, (i > 0) ? " " : "");
+        str_buf_append(doc, words[i % words_count]);
+    }
+
+    snprintf(line, sizeof(line), "</%s>\n", tag);
+    str_buf_append(doc, line);
+}
+
+void scale_histogram(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    generate_histogram_rows(doc, items);
+}
+
+void scale_table(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    generate_table_rows(doc, items);
+}
+
+void scale_calc(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    generate_calc_lines(doc, items);
+}
+
+void scale_numbers(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    char line[32];
+    snprintf(line, sizeof(line), "<%s>\n", tag);
+    str_buf_append(doc, line);
+    for ( uint32_t i=0; i<items; i++ ) {
+        snprintf(line, sizeof(line), "%u.%02u\n", (i * 37) % 1000, i % 100);
+        str_buf_append(doc, line);
+    }
+
+    snprintf(line, sizeof(line), "</%s>\n", tag);
+    str_buf_append(doc, line);
+}
+
+void scale_insert(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    struct str_buf text;
+    str_buf_init(&text, items * 64);
+    append_lines(&text, items);
+    write_scaling_file(SCALING_TEXT_FILE, &text);
+    str_buf_append(doc, "<insert " SCALING_TEXT_FILE ">\n");
+}
+
+void scale_include(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    /* a tag on every line: the engine itself */
+    (void)tag;
+    char line[64];
+    struct str_buf text;
+    str_buf_init(&text, items * 32);
+    for ( uint32_t i=0; i<items; i++ ) {
+        snprintf(line, sizeof(line), "<right>%s %u</right>\n",
+                 words[i % words_count], i);
+        str_buf_append(&text, line);
+    }
+
+    write_scaling_file(SCALING_TEXT_FILE, &text);
+    str_buf_append(doc, "<include " SCALING_TEXT_FILE ">\n");
+}
+
+void write_scaling_csv(uint32_t items)
+{
+    char line[64];
+    struct str_buf text;
+    str_buf_init(&text, items * 32);
+    for ( uint32_t i=0; i<items; i++ ) {
+        snprintf(line, sizeof(line), "%u,%s,%u.%02u\n", i + 1,
+                 words[i % words_count], (i * 37) % 1000, i % 100);
+        str_buf_append(&text, line);
+    }
+
+    write_scaling_file(SCALING_CSV_FILE, &text);
+}
+
+void scale_csv(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    write_scaling_csv(items);
+    str_buf_append(doc, "<csv " SCALING_CSV_FILE ">\n");
+}
+
+void scale_foreach(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    write_scaling_csv(items);
+    str_buf_append(doc, "<foreach " SCALING_CSV_FILE ">\n"
+                        "{{#}}. {{2}}: {{3}}\n</foreach>\n");
+}
+
+void scale_set(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    char line[64];
+    for ( uint32_t i=0; i<items; i++ ) {
+        snprintf(line, sizeof(line), "<set x=%u>\n", i);
+        str_buf_append(doc, line);
+        append_words(doc, 8, i);
+        str_buf_append(doc, "\n");
+    }
+}
+
+void scale_define(struct str_buf* doc, const char* tag, uint32_t items)
+{
+    (void)tag;
+    str_buf_append(doc, "<define m>\n");
+    append_lines(doc, items);
+    str_buf_append(doc, "{{content}}\n</define>\n<m>end</m>\n");
+}
+
+/* the tags that don't get more input (sep, date, doc_width...) and the
+   headers limited by the width of the document are not here */
+struct scaling_case scaling_cases[] = { { "right",     1000, scale_text },
+                                        { "center",    1000, scale_text },
+                                        { "p",         1000, scale_text },
+                                        { "frame",     1000, scale_text },
+                                        { "list",      1000, scale_text },
+                                        { "lines",     2000, scale_lines },
+                                        { "histogram", 500,  scale_histogram },
+                                        { "table",     250,  scale_table },
+                                        { "calc",      500,  scale_calc },
+                                        { "h4",        200,  scale_header },
+                                        { "insert",    1000, scale_insert },
+                                        { "csv",       500,  scale_csv },
+                                        { "stats",     1000, scale_numbers },
+                                        { "chart",     1000, scale_numbers },
+                                        { "foreach",   250,  scale_foreach },
+                                        { "set",       250,  scale_set },
+                                        { "if",        1000, scale_if },
+                                        { "include",   250,  scale_include },
+                                        { "define",    1000, scale_define } };
+const uint16_t scaling_cases_count = sizeof(scaling_cases) /
+                                     sizeof(scaling_cases[0]);
+
+double fit_exponent(const uint32_t* items, const double* ms, uint16_t count)
+{
+    /* the slope of log(time) over log(size), least squares */
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for ( uint16_t i=0; i<count; i++ ) {
+        double x = log(items[i]);
+        double y = log((ms[i] > 1e-6) ? ms[i] : 1e-6);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    double d = count * sxx - sx * sx;
+    return (count > 1 && d != 0) ? (count * sxy - sx * sy) / d : 0;
+}
+
+void run_scaling(const void* arg, void* res)
+{
+    /* big blocks are not given back to the system, so the allocator
+       doesn't turn into mmap() and page faults at some size */
+    mallopt(M_MMAP_THRESHOLD, 1 << 30);
+    mallopt(M_TRIM_THRESHOLD, 1 << 30);
+    const struct scaling_case* sc = arg;
+    struct scaling_result* sr = res;
+    FILE* out = fopen("/dev/null", "w");
+    if ( out == NULL )
+        exit_on_error("Error: can't open /dev/null", NULL);
+
+    double total_ms = 0;
+    for ( uint16_t i=0; i<SCALING_STEPS && total_ms < SCALING_STOP_MS; i++ ) {
+        uint32_t items = sc->items << i;
+        struct str_buf doc;
+        str_buf_init(&doc, 1 << 16);
+        sc->generate(&doc, sc->tag, items);
+
+        double best = 0, output_ms;
+        total_ms = 0;
+        for ( uint16_t run=0; run < SCALING_MIN_RUNS ||
+                              total_ms < SCALING_MIN_MS; run++ ) {
+            double ms = render_once(doc.data, out, &output_ms);
+            best = (run == 0 || ms < best) ? ms : best;
+            total_ms += ms;
+            if ( total_ms >= SCALING_STOP_MS )
+                break;
+        }
+
+        sr->items[i] = items;
+        sr->render_ms[i] = best;
+        sr->steps++;
+        free(doc.data);
+    }
+
+    sr->exponent = fit_exponent(sr->items, sr->render_ms, sr->steps);
+    fclose(out);
+}
+
+uint8_t check_scaling(const struct scaling_case* sc, double max_exponent)
+{
+    struct scaling_result sr;
+    if ( run_in_child(run_scaling, sc, &sr, sizeof(sr)) == 0 ) {
+        printf("tag=%s error=failed\n", sc->tag);
+        return 0;
+    }
+
+    uint16_t last = sr.steps - 1;
+    uint8_t ok = sr.exponent <= max_exponent;
+    printf("tag=%s items=%u..%u render_ms=%.3f..%.3f exponent=%.2f "
+           "result=%s\n", sc->tag, sr.items[0], sr.items[last],
+           sr.render_ms[0], sr.render_ms[last], sr.exponent,
+           (ok) ? "ok" : "superlinear");
+    fflush(stdout);
+    return ok;
+}
+
+int scaling_main(int argc, char* argv[])
+{
+    /* exits with an error if a tag grows faster than items^max_exponent */
+    double max_exponent = (argc > 2) ? atof(argv[2]) : SCALING_MAX_EXPONENT;
+    const char* only = (argc > 3) ? argv[3] : NULL;
+    if ( max_exponent <= 0 )
+        max_exponent = SCALING_MAX_EXPONENT;
+
+    printf("# txtfmt scaling %u max_exponent=%.2f\n", BENCH_VERSION,
+           max_exponent);
+    uint16_t failed = 0;
+    for ( uint16_t i=0; i<scaling_cases_count; i++ ) {
+        if ( only == NULL || strcmp(only, scaling_cases[i].tag) == 0 )
+            failed += check_scaling(&scaling_cases[i], max_exponent) == 0;
+    }
+
+    unlink(SCALING_TEXT_FILE);
+    unlink(SCALING_CSV_FILE);
+    if ( failed > 0 )
+        printf("# %u tags grow faster than the limit\n", failed);
+
+    return (failed > 0) ? EXIT_FAILURE : 0;
+}
+
+/****************************************************************************
+*                         functions for the limits                          *
+****************************************************************************/
+
+/* the cases of the scaling that give a line of output for every item */
+char* limits_tags[] = { "right", "list", "histogram", "table", "calc", "csv",
+                        "foreach", NULL };
+
+void run_limits(const void* arg, void* res)
+{
+    /* a counter that wraps around can loop forever */
+    alarm(LIMITS_TIMEOUT_S);
+    const struct scaling_case* sc = arg;
+    struct limits_result* lr = res;
+    struct str_buf doc;
+    str_buf_init(&doc, 1 << 16);
+    sc->generate(&doc, sc->tag, LIMITS_ITEMS);
+
+    set_doc_width(DEFAULT_DOC_WIDTH);
+    clear_doc_vars();
+    clear_macros();
+    uint64_t start = get_clock_ns();
+    char* result = execute_all_tags(doc.data);
+    lr->render_ms = get_ms(start);
+    for ( char* line = result; (line = strchr(line, '\n')) != NULL; line++ )
+        lr->lines++;
+
+    free(result);
+    free(doc.data);
+}
+
+uint8_t check_limits(const struct scaling_case* sc)
+{
+    struct limits_result lr;
+    if ( run_in_child(run_limits, sc, &lr, sizeof(lr)) == 0 ) {
+        printf("tag=%s items=%u error=failed\n", sc->tag, LIMITS_ITEMS);
+        return 0;
+    }
+
+    uint8_t ok = lr.lines >= LIMITS_ITEMS;
+    printf("tag=%s items=%u lines=%lu render_ms=%.3f result=%s\n", sc->tag,
+           LIMITS_ITEMS, (unsigned long)lr.lines, lr.render_ms,
+           (ok) ? "ok" : "lost");
+    fflush(stdout);
+    return ok;
+}
+
+int limits_main(int argc, char* argv[])
+{
+    /* exits with an error if a tag loses items or doesn't finish */
+    const char* only = (argc > 2) ? argv[2] : NULL;
+    printf("# txtfmt limits %u items=%u\n", BENCH_VERSION, LIMITS_ITEMS);
+    uint16_t failed = 0;
+    for ( uint16_t i=0; i<scaling_cases_count; i++ ) {
+        char* tag = (char*)scaling_cases[i].tag;
+        if ( (only == NULL) ? in_str_array(limits_tags, tag) :
+                              strcmp(only, tag) == 0 )
+            failed += check_limits(&scaling_cases[i]) == 0;
+    }
+
+    unlink(SCALING_TEXT_FILE);
+    unlink(SCALING_CSV_FILE);
+    if ( failed > 0 )
+        printf("# %u tags failed over %u items\n", failed, LIMITS_ITEMS);
+
+    return (failed > 0) ? EXIT_FAILURE : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if ( argc > 1 && strcmp(argv[1], "--scaling") == 0 )
+        return scaling_main(argc, argv);
+
+    if ( argc > 1 && strcmp(argv[1], "--limits") == 0 )
+        return limits_main(argc, argv);
+
+    if ( argc > 2 && strcmp(argv[1], "--generate") == 0 ) {
+        uint32_t scale = (argc > 3) ? atol(argv[3]) : 1;
+        for ( uint16_t i=0; i<workloads_count; i++ ) {
+            if ( strcmp(workloads[i].name, argv[2]) == 0 ) {
+                struct str_buf doc;
+                str_buf_init(&doc, 1 << 16);
+                workloads[i].generate(&doc, (scale > 0) ? scale : 1);
+                fputs(doc.data, stdout);
+                free(doc.data);
+                return 0;
+            }
+        }
+
+        printf("Error: unknown workload \"%s\"\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t scale = (argc > 1) ? atol(argv[1]) : 1;
+    uint16_t runs = (argc > 2) ? atol(argv[2]) : 5;
+    const char* only = (argc > 3) ? argv[3] : NULL;
+    if ( scale == 0 )
+        scale = 1;
+
+    if ( runs == 0 )
+        runs = 1;
+
+    if ( write_insert_file() == 0 ) {
+        printf("Error: can't write \"%s\"\n", BENCH_INSERT_FILE);
+        return EXIT_FAILURE;
+    }
+
+    printf("# txtfmt bench %u\n", BENCH_VERSION);
+    uint8_t ok = 1;
+    for ( uint16_t i=0; i<workloads_count; i++ ) {
+        if ( only == NULL || strcmp(only, workloads[i].name) == 0 )
+            ok &= bench_workload(&workloads[i], scale, runs);
+    }
+
+    unlink(BENCH_INSERT_FILE);
+    return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,214 @@
+/* txtfmt_load.c
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ *
+ * Load generator for txtfmt --serve:
+ *     txtfmt_load /path/to/socket file.txtm [requests] [connections] [width]
+ */
+#include "server.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct load_job
+{
+    const char*  socket_path;
+    const char*  text;
+    uint32_t     len;
+    uint32_t     width;
+    uint32_t     requests;    /* for every connection */
+    uint64_t*    latencies;   /* ns, requests of every connection */
+    uint32_t     failed;
+};
+
+uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint8_t read_full(int fd, void* buf, uint64_t len)
+{
+    char* pos = buf;
+    while ( len > 0 ) {
+        ssize_t n = read(fd, pos, len);
+        if ( n <= 0 )
+            return 0;
+
+        pos += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+uint8_t write_full(int fd, const void* buf, uint64_t len)
+{
+    const char* pos = buf;
+    while ( len > 0 ) {
+        ssize_t n = send(fd, pos, len, MSG_NOSIGNAL);
+        if ( n <= 0 )
+            return 0;
+
+        pos += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+int connect_server(const char* socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( fd != -1 &&
+         connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void* load_connection(void* arg)
+{
+    struct load_job* job = arg;
+    int fd = connect_server(job->socket_path);
+    if ( fd == -1 ) {
+        job->failed = job->requests;
+        return NULL;
+    }
+
+    struct render_request req = { job->width, job->len };
+    char* output = NULL;
+    uint32_t output_cap = 0;
+    for ( uint32_t i=0; i<job->requests; i++ ) {
+        uint64_t start = get_time_ns();
+        struct render_response resp;
+        if ( !write_full(fd, &req, sizeof(req)) ||
+             !write_full(fd, job->text, job->len) ||
+             !read_full(fd, &resp, sizeof(resp)) ||
+             resp.status != RENDER_OK ) {
+            job->failed += job->requests - i;
+            break;
+        }
+
+        if ( resp.length > output_cap ) {
+            output_cap = resp.length;
+            output = realloc(output, output_cap);
+            if ( output == NULL ) {
+                puts("Error: out of memory");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if ( !read_full(fd, output, resp.length) ) {
+            job->failed += job->requests - i;
+            break;
+        }
+
+        job->latencies[i] = get_time_ns() - start;
+    }
+
+    free(output);
+    close(fd);
+    return NULL;
+}
+
+int compare_latencies(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[])
+{
+    if ( argc < 3 ) {
+        puts("usage: txtfmt_load /path/to/socket file.txtm [requests] "
+             "[connections] [width]");
+        return EXIT_FAILURE;
+    }
+
+    FILE* file = fopen(argv[2], "rb");
+    if ( file == NULL ) {
+        printf("Error: can't open file \"%s\"\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    rewind(file);
+    char* text = malloc(len + 1);
+    if ( text == NULL || fread(text, 1, len, file) != (size_t)len ) {
+        printf("Error: can't read file \"%s\"\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    fclose(file);
+    uint32_t requests = (argc > 3) ? atol(argv[3]) : 1000;
+    uint32_t connections = (argc > 4) ? atol(argv[4]) : 4;
+    uint32_t width = (argc > 5) ? atol(argv[5]) : 0;
+    if ( connections == 0 )
+        connections = 1;
+
+    /* the requests are split between the connections */
+    uint32_t per_connection = (requests + connections - 1) / connections;
+    uint64_t* latencies = calloc((uint64_t)per_connection * connections,
+                                 sizeof(uint64_t));
+    struct load_job* jobs = calloc(connections, sizeof(struct load_job));
+    pthread_t* threads = calloc(connections, sizeof(pthread_t));
+    if ( latencies == NULL || jobs == NULL || threads == NULL ) {
+        puts("Error: out of memory");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = get_time_ns();
+    for ( uint32_t i=0; i<connections; i++ ) {
+        jobs[i].socket_path = argv[1];
+        jobs[i].text = text;
+        jobs[i].len = len;
+        jobs[i].width = width;
+        jobs[i].requests = per_connection;
+        jobs[i].latencies = &latencies[(uint64_t)i * per_connection];
+        pthread_create(&threads[i], NULL, load_connection, &jobs[i]);
+    }
+
+    uint32_t failed = 0;
+    for ( uint32_t i=0; i<connections; i++ ) {
+        pthread_join(threads[i], NULL);
+        failed += jobs[i].failed;
+    }
+
+    double seconds = (get_time_ns() - start) / 1e9;
+    /* failed requests have no latency and are left out */
+    uint64_t count = 0;
+    for ( uint64_t i=0; i<(uint64_t)per_connection * connections; i++ ) {
+        if ( latencies[i] != 0 )
+            latencies[count++] = latencies[i];
+    }
+
+    qsort(latencies, count, sizeof(uint64_t), compare_latencies);
+    printf("%lu requests, %u failed, %u connections, %.2f s, %.0f req/s\n",
+           (unsigned long)count, failed, connections, seconds,
+           count / seconds);
+    if ( count > 0 )
+        printf("latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               latencies[count / 2] / 1e6, latencies[count * 99 / 100] / 1e6,
+               latencies[count - 1] / 1e6);
+
+    free(threads);
+    free(jobs);
+    free(latencies);
+    free(text);
+    return (failed == 0) ? 0 : EXIT_FAILURE;
+}
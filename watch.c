@@ -0,0 +1,251 @@
+/* watch.c
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ */
+#include "watch.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
+uint64_t get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#ifdef __linux__
+/* Directories are watched rather than files: editors often save a file by
+   writing a new one and renaming it over the old one. */
+void watch_dir(struct watch_state* ws, const char* path)
+{
+    for ( uint16_t i=0; i<ws->dirs_count; i++ ) {
+        if ( strcmp(ws->dirs[i].path, path) == 0 )
+            return;
+    }
+
+    if ( ws->dirs_count == MAX_WATCHED_DIRS )
+        return;
+
+    int wd = inotify_add_watch(ws->fd, path,
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+    if ( wd == -1 ) {
+        printf("  Error: can't watch \"%s\". Ignoring\n", path);
+        return;
+    }
+
+    ws->dirs[ws->dirs_count].wd = wd;
+    ws->dirs[ws->dirs_count].path = strdup(path);
+    is_memory_allocated(ws->dirs[ws->dirs_count].path);
+    ws->dirs_count++;
+}
+
+void watch_file_dir(struct watch_state* ws, const char* file_path)
+{
+    const char* slash = strrchr(file_path, '/');
+    if ( slash == NULL )
+        return;
+
+    char* dir = (slash == file_path) ? strdup("/") :
+                strndup(file_path, slash - file_path);
+    is_memory_allocated(dir);
+    watch_dir(ws, dir);
+    free(dir);
+}
+
+void render_watched_doc(struct watch_state* ws, uint16_t i)
+{
+    /* the files read this time are the ones to watch for the document */
+    struct watched_doc* doc = &ws->docs[i];
+    for ( uint16_t j=0; j<doc->deps_count; j++ )
+        free(doc->deps[j]);
+
+    free(doc->deps);
+    start_file_tracking();
+    ws->render(doc->name);
+    doc->deps = stop_file_tracking(&doc->deps_count);
+    for ( uint16_t j=0; j<doc->deps_count; j++ )
+        watch_file_dir(ws, doc->deps[j]);
+}
+
+int32_t find_watched_doc(struct watch_state* ws, const char* path)
+{
+    for ( uint16_t i=0; i<ws->docs_count; i++ ) {
+        if ( strcmp(ws->docs[i].path, path) == 0 )
+            return i;
+    }
+
+    return -1;
+}
+
+uint8_t add_watched_doc(struct watch_state* ws, char* name)
+{
+    if ( ws->docs_count == MAX_WATCHED_DOCS )
+        return 0;
+
+    struct watched_doc* doc = &ws->docs[ws->docs_count++];
+    doc->name = strdup(name);
+    is_memory_allocated(doc->name);
+    doc->path = get_full_path(name);
+    doc->deps = NULL;
+    doc->deps_count = 0;
+    return 1;
+}
+
+void add_changed_path(struct watch_state* ws, const char* dir,
+                      const char* name)
+{
+    char* path = calloc(strlen(dir) + strlen(name) + 2, sizeof(char));
+    is_memory_allocated(path);
+    sprintf(path, "%s/%s", strcmp(dir, "/") == 0 ? "" : dir, name);
+    if ( is_changed_path(ws, path) ) {
+        free(path);
+        return;
+    }
+
+    if ( ws->changed_count == ws->changed_cap ) {
+        ws->changed_cap = (ws->changed_cap == 0) ? 64 : ws->changed_cap * 2;
+        ws->changed = realloc(ws->changed, ws->changed_cap * sizeof(char*));
+        is_memory_allocated(ws->changed);
+    }
+
+    ws->changed[ws->changed_count++] = path;
+}
+
+uint8_t is_changed_path(struct watch_state* ws, const char* path)
+{
+    for ( uint32_t i=0; i<ws->changed_count; i++ ) {
+        if ( strcmp(ws->changed[i], path) == 0 )
+            return 1;
+    }
+
+    return 0;
+}
+
+uint8_t read_watch_events(struct watch_state* ws, int timeout)
+{
+    /* 0 if nothing has come in timeout ms (-1 - wait for events) */
+    struct pollfd pfd = { ws->fd, POLLIN, 0 };
+    if ( poll(&pfd, 1, timeout) <= 0 )
+        return 0;
+
+    char events[WATCH_EVENTS_SIZE]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(ws->fd, events, sizeof(events));
+    if ( len <= 0 )
+        return 0;
+
+    char* pos = events;
+    while ( pos < events + len ) {
+        struct inotify_event* event = (struct inotify_event*)pos;
+        for ( uint16_t i=0; event->len > 0 && i<ws->dirs_count; i++ ) {
+            if ( ws->dirs[i].wd == event->wd )
+                add_changed_path(ws, ws->dirs[i].path, event->name);
+        }
+
+        pos += sizeof(struct inotify_event) + event->len;
+    }
+
+    return 1;
+}
+
+uint16_t render_changed_docs(struct watch_state* ws)
+{
+    /* new documents first, then every document that has read a changed
+       file or is changed itself */
+    uint32_t ext_len = strlen(ws->extension);
+    uint16_t docs_count_before = ws->docs_count;
+    for ( uint32_t i=0; i<ws->changed_count; i++ ) {
+        uint32_t len = strlen(ws->changed[i]);
+        if ( len > ext_len &&
+             strcmp(&ws->changed[i][len - ext_len], ws->extension) == 0 &&
+             find_watched_doc(ws, ws->changed[i]) == -1 ) {
+            char* name = strrchr(ws->changed[i], '/') + 1;
+            char* path = get_full_path(name);
+            if ( strcmp(path, ws->changed[i]) == 0 &&
+                 access(name, F_OK) == 0 && add_watched_doc(ws, name) )
+                render_watched_doc(ws, ws->docs_count - 1);
+
+            free(path);
+        }
+    }
+
+    uint16_t rendered = ws->docs_count - docs_count_before;
+    for ( uint16_t i=0; i<docs_count_before; i++ ) {
+        struct watched_doc* doc = &ws->docs[i];
+        uint8_t changed = is_changed_path(ws, doc->path);
+        for ( uint16_t j=0; changed == 0 && j<doc->deps_count; j++ )
+            changed = is_changed_path(ws, doc->deps[j]);
+
+        if ( changed && access(doc->name, F_OK) == 0 ) {
+            render_watched_doc(ws, i);
+            rendered++;
+        }
+    }
+
+    for ( uint32_t i=0; i<ws->changed_count; i++ )
+        free(ws->changed[i]);
+
+    ws->changed_count = 0;
+    return rendered;
+}
+
+void watch_documents(char* extension, void (*render)(char*))
+{
+    /* the process stays alive, so the caches stay warm between edits */
+    struct watch_state* ws = calloc(1, sizeof(struct watch_state));
+    is_memory_allocated(ws);
+    ws->fd = inotify_init1(IN_CLOEXEC);
+    if ( ws->fd == -1 ) {
+        puts("Error: can't start watching the files");
+        free(ws);
+        return;
+    }
+
+    ws->extension = extension;
+    ws->render = render;
+    char* src_dir = realpath(".", NULL);
+    is_memory_allocated(src_dir);
+    watch_dir(ws, src_dir);
+    free(src_dir);
+
+    uint16_t files_count = get_files_count(".", extension);
+    char** files = get_files_in_dir(".", extension);
+    for ( uint16_t i=0; i<files_count; i++ ) {
+        if ( add_watched_doc(ws, files[i]) )
+            render_watched_doc(ws, ws->docs_count - 1);
+        free(files[i]);
+    }
+
+    free(files);
+    printf("watching %u documents, press Ctrl+C to stop\n", ws->docs_count);
+    while ( 1 ) {
+        if ( read_watch_events(ws, -1) == 0 )
+            continue;
+
+        uint64_t start = get_time_ms();
+        while ( get_time_ms() - start < WATCH_DEBOUNCE_MAX_MS &&
+                read_watch_events(ws, WATCH_DEBOUNCE_MS) )
+            ;
+
+        uint16_t rendered = render_changed_docs(ws);
+        if ( rendered > 0 ) {
+            printf("  %u documents updated in %lu ms\n", rendered,
+                   (unsigned long)(get_time_ms() - start));
+            fflush(stdout);
+        }
+    }
+}
+#else
+void watch_documents(char* extension, void (*render)(char*))
+{
+    puts("Error: --watch needs inotify, it is available on Linux only");
+}
+#endif
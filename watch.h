@@ -0,0 +1,66 @@
+/* watch.h
+ *
+ * Copyright (C) 2024 Dmitriy Eliseev
+ * This file is part of txtFormatter.
+ *
+ * txtFormatter is licensed under the GNU General Public License, version 3.
+ * See the LICENSE file or <https://www.gnu.org/licenses/gpl-3.0.en.html>
+ * for details.
+ */
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "tags_lib.h"
+
+/* events closer than this are handled together */
+#define        WATCH_DEBOUNCE_MS     20
+#define        WATCH_DEBOUNCE_MAX_MS 250  /* a stream of events is cut here */
+#define        MAX_WATCHED_DOCS      1024
+#define        MAX_WATCHED_DIRS      256
+#define        WATCH_EVENTS_SIZE     65536
+
+struct watched_doc
+{
+    char*      name;          /* in the source directory */
+    char*      path;          /* see get_full_path() */
+    char**     deps;          /* files read by the last rendering */
+    uint16_t   deps_count;
+};
+
+struct watched_dir
+{
+    int        wd;
+    char*      path;
+};
+
+struct watch_state
+{
+    int        fd;
+    char*      extension;
+    void     (*render)(char*);
+    struct watched_doc docs[MAX_WATCHED_DOCS];
+    uint16_t   docs_count;
+    struct watched_dir dirs[MAX_WATCHED_DIRS];
+    uint16_t   dirs_count;
+    char**     changed;       /* full paths from the current events */
+    uint32_t   changed_count;
+    uint32_t   changed_cap;
+};
+
+uint64_t       get_time_ms           (void);
+void           watch_dir             (struct watch_state* ws, const char* path);
+void           watch_file_dir        (struct watch_state* ws,
+                                      const char* file_path);
+void           render_watched_doc    (struct watch_state* ws, uint16_t i);
+int32_t        find_watched_doc      (struct watch_state* ws,
+                                      const char* path);
+uint8_t        add_watched_doc       (struct watch_state* ws, char* name);
+void           add_changed_path      (struct watch_state* ws,
+                                      const char* dir, const char* name);
+uint8_t        is_changed_path       (struct watch_state* ws,
+                                      const char* path);
+uint8_t        read_watch_events     (struct watch_state* ws, int timeout);
+uint16_t       render_changed_docs   (struct watch_state* ws);
+void           watch_documents       (char* extension, void (*render)(char*));
+
+#endif /* WATCH_H */